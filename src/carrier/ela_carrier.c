@@ -1675,8 +1675,17 @@ void handle_friend_message(ElaCarrier *w, uint32_t friend_number, ElaCP *cp)
     msg  = elacp_get_raw_data(cp);
     len  = elacp_get_raw_data_length(cp);
 
-    if (w->callbacks.friend_message && !name)
-        w->callbacks.friend_message(w, friendid, msg, len, w->context);
+    if (name) {
+        if (strcmp(name, "session") == 0) {
+            SessionExtension *ext = (SessionExtension *)w->session;
+            if (ext && ext->friend_message_cb)
+                ext->friend_message_cb(w, friendid, msg, len,
+                                       ext->friend_message_context);
+        }
+    } else {
+        if (w->callbacks.friend_message)
+            w->callbacks.friend_message(w, friendid, msg, len, w->context);
+    }
 }
 
 static
@@ -107,12 +107,17 @@ struct ElaCarrier {
 
 typedef void (*friend_invite_callback)(ElaCarrier *, const char *,
                                        const char *, const void *, size_t, void *);
+typedef void (*friend_message_callback)(ElaCarrier *, const char *,
+                                        const void *, size_t, void *);
 typedef struct SessionExtension {
     ElaCarrier              *carrier;
 
     friend_invite_callback  friend_invite_cb;
     void                    *friend_invite_context;
 
+    friend_message_callback friend_message_cb;
+    void                    *friend_message_context;
+
     uint8_t                 reserved[1];
 } SessionExtension;
 
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <crystal.h>
+
+#include "buffer_pool.h"
+
+/*
+ * Buffers are carved from slabs of BUFFER_POOL_SLAB_BUFFERS, which stay
+ * with the pool until it is destroyed, so a busy stream recycles the same
+ * memory instead of going to the heap for every packet.
+ */
+typedef struct Slab {
+    struct Slab             *next;
+} Slab;
+
+#define SLAB_HEADER_LEN     ((sizeof(Slab) + 15) & ~(size_t)15)
+
+static void buffer_pool_destroy(void *p)
+{
+    BufferPool *pool = (BufferPool *)p;
+    Slab *slab;
+
+    vlogD("Session: Buffer pool destroyed, %llu gets, %llu hits, "
+          "%llu overflows, %d slabs, peak %d buffers.",
+          (unsigned long long)pool->stats.gets,
+          (unsigned long long)pool->stats.hits,
+          (unsigned long long)pool->stats.overflows,
+          pool->stats.slabs, pool->stats.peak_in_use);
+
+    while (pool->slabs) {
+        slab = (Slab *)pool->slabs;
+        pool->slabs = slab->next;
+        free(slab);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+}
+
+BufferPool *buffer_pool_create(size_t capacity, int max_slabs)
+{
+    BufferPool *pool;
+
+    assert(capacity > 0);
+
+    pool = (BufferPool *)rc_zalloc(sizeof(BufferPool), buffer_pool_destroy);
+    if (!pool)
+        return NULL;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->capacity = capacity;
+    pool->stride = (sizeof(ElaStreamBuffer) + capacity + 15) & ~(size_t)15;
+    pool->max_slabs = max_slabs;
+
+    return pool;
+}
+
+// Must be called with pool lock held.
+static bool buffer_pool_grow(BufferPool *pool)
+{
+    ElaStreamBuffer *buf;
+    Slab *slab;
+    char *p;
+    int i;
+
+    if (pool->stats.slabs >= pool->max_slabs)
+        return false;
+
+    slab = (Slab *)malloc(SLAB_HEADER_LEN +
+                          pool->stride * BUFFER_POOL_SLAB_BUFFERS);
+    if (!slab)
+        return false;
+
+    slab->next = (Slab *)pool->slabs;
+    pool->slabs = slab;
+    pool->stats.slabs++;
+
+    p = (char *)slab + SLAB_HEADER_LEN;
+    for (i = 0; i < BUFFER_POOL_SLAB_BUFFERS; i++, p += pool->stride) {
+        buf = (ElaStreamBuffer *)p;
+        buf->slab = 1;
+        buf->next = pool->free_list;
+        pool->free_list = buf;
+    }
+
+    return true;
+}
+
+/*
+ * Every buffer handed out holds a reference to its pool, so the pool
+ * outlives its worker while the application still keeps buffers.
+ */
+ElaStreamBuffer *buffer_pool_get(BufferPool *pool, size_t headroom)
+{
+    ElaStreamBuffer *buf;
+
+    assert(pool);
+    assert(headroom < pool->capacity);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.gets++;
+
+    if (pool->free_list)
+        pool->stats.hits++;
+    else
+        buffer_pool_grow(pool);
+
+    buf = pool->free_list;
+    if (buf)
+        pool->free_list = buf->next;
+    else
+        pool->stats.overflows++;
+
+    if (++pool->stats.in_use > pool->stats.peak_in_use)
+        pool->stats.peak_in_use = pool->stats.in_use;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!buf) {
+        buf = (ElaStreamBuffer *)malloc(sizeof(ElaStreamBuffer) + pool->capacity);
+        if (!buf) {
+            pthread_mutex_lock(&pool->lock);
+            pool->stats.in_use--;
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        buf->slab = 0;
+    }
+
+    flex_buffer_init(&buf->flex, buf + 1, pool->capacity, headroom);
+    buf->flex.owner = buf;
+    buf->pool = pool;
+    buf->refcount = 1;
+    buf->next = NULL;
+    ref(pool);
+
+    return buf;
+}
+
+void buffer_pool_get_stats(BufferPool *pool, BufferPoolStats *stats)
+{
+    assert(pool);
+    assert(stats);
+
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+ElaStreamBuffer *buffer_retain(ElaStreamBuffer *buf)
+{
+    assert(buf);
+
+    pthread_mutex_lock(&buf->pool->lock);
+    buf->refcount++;
+    pthread_mutex_unlock(&buf->pool->lock);
+
+    return buf;
+}
+
+void buffer_release(ElaStreamBuffer *buf)
+{
+    BufferPool *pool;
+
+    assert(buf);
+
+    pool = buf->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    assert(buf->refcount > 0);
+    if (--buf->refcount > 0) {
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+
+    pool->stats.in_use--;
+
+    if (buf->slab) {
+        buf->pool = NULL;
+        buf->next = pool->free_list;
+        pool->free_list = buf;
+    } else {
+        free(buf);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    deref(pool);
+}
+
+const void *ela_stream_buffer_data(const ElaStreamBuffer *buffer)
+{
+    if (!buffer || !buffer->flex.size)
+        return NULL;
+
+    return buffer->flex.buffer + buffer->flex.offset;
+}
+
+size_t ela_stream_buffer_size(const ElaStreamBuffer *buffer)
+{
+    return buffer ? buffer->flex.size : 0;
+}
+
+ElaStreamBuffer *ela_stream_buffer_retain(ElaStreamBuffer *buffer)
+{
+    return buffer ? buffer_retain(buffer) : NULL;
+}
+
+void ela_stream_buffer_release(ElaStreamBuffer *buffer)
+{
+    if (buffer)
+        buffer_release(buffer);
+}
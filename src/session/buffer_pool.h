@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <crystal.h>
+
+#include "ela_session.h"
+#include "flex_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Buffers carved from one slab allocation */
+#define BUFFER_POOL_SLAB_BUFFERS    16
+
+/* Slabs a pool may grow to, beyond that buffers come from the heap */
+#define BUFFER_POOL_MAX_SLABS       16
+
+typedef struct BufferPool BufferPool;
+
+/*
+ * A pooled buffer. The FlexBuffer points at the data area following the
+ * structure, and its owner field points back at the pooled buffer, so a
+ * handler can tell a pooled buffer from a stack one.
+ */
+struct ElaStreamBuffer {
+    FlexBuffer              flex;
+    BufferPool              *pool;
+    int                     refcount;
+    int                     slab;
+    ElaStreamBuffer         *next;
+};
+
+typedef struct BufferPoolStats {
+    uint64_t                gets;       /* Buffers handed out */
+    uint64_t                hits;       /* Served from the free list */
+    uint64_t                overflows;  /* Heap allocated, pool exhausted */
+    int                     slabs;
+    int                     in_use;
+    int                     peak_in_use;
+} BufferPoolStats;
+
+struct BufferPool {
+    pthread_mutex_t         lock;
+    size_t                  capacity;
+    size_t                  stride;
+    int                     max_slabs;
+    void                    *slabs;
+    ElaStreamBuffer         *free_list;
+    BufferPoolStats         stats;
+};
+
+BufferPool *buffer_pool_create(size_t capacity, int max_slabs);
+
+/*
+ * Get a buffer with @headroom bytes reserved in front of the payload for
+ * the headers lower handlers prepend.
+ */
+ElaStreamBuffer *buffer_pool_get(BufferPool *pool, size_t headroom);
+
+void buffer_pool_get_stats(BufferPool *pool, BufferPoolStats *stats);
+
+ElaStreamBuffer *buffer_retain(ElaStreamBuffer *buf);
+
+void buffer_release(ElaStreamBuffer *buf);
+
+static inline
+ElaStreamBuffer *flex_buffer_owner(FlexBuffer *buf)
+{
+    return (ElaStreamBuffer *)buf->owner;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BUFFER_POOL_H__ */
@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <crystal.h>
+
+#include "flex_buffer.h"
+#include "session.h"
+#include "stream_handler.h"
+#include "lz_codec.h"
+
+/*
+ * Every packet is compressed on its own. Below the reliable handler
+ * packets may be lost or retransmitted, so no state is carried from one
+ * packet to the next. A one byte header tells whether the rest is raw or
+ * compressed.
+ */
+#define COMPRESS_RAW            0
+#define COMPRESS_LZ             1
+
+#define COMPRESS_HEADER_LEN     1
+
+/* Shorter packets never gain enough to pay for the header */
+#define COMPRESS_MIN_LEN        64
+
+/* Packets skipped at most after repeated incompressible ones */
+#define COMPRESS_MAX_BACKOFF    64
+
+typedef struct CompressHandler {
+    StreamHandler base;
+
+    pthread_mutex_t lock;
+    int backoff;
+    int skip;
+    ElaStreamCompressStats stats;
+} CompressHandler;
+
+/*
+ * Already compressed or encrypted payloads don't shrink, each failure
+ * doubles the number of packets sent raw without trying.
+ */
+static bool compress_handler_should_try(CompressHandler *handler)
+{
+    bool try_it;
+
+    pthread_mutex_lock(&handler->lock);
+    try_it = (handler->skip == 0);
+    if (!try_it)
+        handler->skip--;
+    pthread_mutex_unlock(&handler->lock);
+
+    return try_it;
+}
+
+static void compress_handler_update_tx(CompressHandler *handler,
+                                       bool tried, bool compressed,
+                                       size_t len, size_t wire_len,
+                                       uint64_t elapsed)
+{
+    pthread_mutex_lock(&handler->lock);
+
+    if (tried) {
+        if (compressed) {
+            handler->backoff = 0;
+        } else {
+            handler->backoff = handler->backoff ? handler->backoff * 2 : 1;
+            if (handler->backoff > COMPRESS_MAX_BACKOFF)
+                handler->backoff = COMPRESS_MAX_BACKOFF;
+            handler->skip = handler->backoff;
+        }
+    }
+
+    handler->stats.tx_packets++;
+    if (compressed)
+        handler->stats.tx_compressed++;
+    handler->stats.tx_bytes += len;
+    handler->stats.tx_wire_bytes += wire_len;
+    handler->stats.tx_time += elapsed;
+
+    pthread_mutex_unlock(&handler->lock);
+}
+
+static
+ssize_t compress_handler_write(StreamHandler *base, FlexBuffer *buf)
+{
+    CompressHandler *handler = (CompressHandler *)base;
+    size_t len = flex_buffer_size(buf);
+    FlexBuffer *wire = buf;
+    uint64_t start = 0;
+    uint64_t elapsed = 0;
+    bool tried = false;
+    ssize_t written;
+
+    assert(base->next);
+
+    if (len >= COMPRESS_MIN_LEN && len <= LZ_MAX_INPUT_LEN &&
+            compress_handler_should_try(handler)) {
+        FlexBuffer *out;
+        size_t limit;
+        ssize_t rc;
+
+        tried = true;
+        start = get_monotonic_time();
+
+        flex_buffer_alloca(out, FLEX_BUFFER_MAX_LEN, FLEX_PADDING_LEN);
+
+        // Anything short of saving a byte beyond the header is a failure.
+        limit = len - COMPRESS_HEADER_LEN - 1;
+        if (limit > flex_buffer_available(out))
+            limit = flex_buffer_available(out);
+
+        rc = lz_compress(flex_buffer_ptr(buf), len,
+                         flex_buffer_mutable_ptr(out), limit);
+        if (rc > 0) {
+            flex_buffer_set_size(out, (size_t)rc);
+            flex_buffer_backward_offset(out, COMPRESS_HEADER_LEN);
+            *(uint8_t *)flex_buffer_mutable_ptr(out) = COMPRESS_LZ;
+            wire = out;
+        }
+
+        elapsed = get_monotonic_time() - start;
+    }
+
+    if (wire == buf) {
+        flex_buffer_backward_offset(buf, COMPRESS_HEADER_LEN);
+        *(uint8_t *)flex_buffer_mutable_ptr(buf) = COMPRESS_RAW;
+    }
+
+    compress_handler_update_tx(handler, tried, wire != buf, len,
+                               flex_buffer_size(wire), elapsed);
+
+    written = base->next->write(base->next, wire);
+
+    return written == (ssize_t)flex_buffer_size(wire) ? (ssize_t)len : written;
+}
+
+static
+void compress_handler_on_rx_data(StreamHandler *base, FlexBuffer *buf)
+{
+    CompressHandler *handler = (CompressHandler *)base;
+    ElaStream *s = base->stream;
+    ElaStreamBuffer *pbuf = NULL;
+    FlexBuffer *out;
+    size_t wire_len = flex_buffer_size(buf);
+    uint64_t start;
+    ssize_t len;
+    uint8_t type;
+
+    assert(base->prev);
+
+    if (wire_len < COMPRESS_HEADER_LEN) {
+        vlogE("Stream: %d compress handler got truncated data.", s->id);
+        return;
+    }
+
+    type = *(const uint8_t *)flex_buffer_ptr(buf);
+    flex_buffer_forward_offset(buf, COMPRESS_HEADER_LEN);
+
+    if (type == COMPRESS_RAW) {
+        pthread_mutex_lock(&handler->lock);
+        handler->stats.rx_packets++;
+        handler->stats.rx_wire_bytes += wire_len;
+        handler->stats.rx_bytes += flex_buffer_size(buf);
+        pthread_mutex_unlock(&handler->lock);
+
+        base->prev->on_data(base->prev, buf);
+        return;
+    }
+
+    if (type != COMPRESS_LZ) {
+        vlogE("Stream: %d compress handler got unknown packet type %d.",
+              s->id, type);
+        return;
+    }
+
+    // The reliable handler copies into its own buffer anyway.
+    if (stream_wants_rx_buffers(s) && !s->reliable)
+        pbuf = buffer_pool_get(stream_get_buffer_pool(s), FLEX_PADDING_LEN);
+
+    if (pbuf)
+        out = &pbuf->flex;
+    else
+        flex_buffer_alloca(out, FLEX_BUFFER_MAX_LEN, FLEX_PADDING_LEN);
+
+    start = get_monotonic_time();
+    len = lz_decompress(flex_buffer_ptr(buf), flex_buffer_size(buf),
+                        flex_buffer_mutable_ptr(out),
+                        flex_buffer_available(out));
+    if (len < 0) {
+        vlogE("Stream: %d compress handler got malformed data.", s->id);
+        if (pbuf)
+            buffer_release(pbuf);
+        return;
+    }
+
+    flex_buffer_set_size(out, (size_t)len);
+
+    pthread_mutex_lock(&handler->lock);
+    handler->stats.rx_packets++;
+    handler->stats.rx_decompressed++;
+    handler->stats.rx_wire_bytes += wire_len;
+    handler->stats.rx_bytes += (uint64_t)len;
+    handler->stats.rx_time += get_monotonic_time() - start;
+    pthread_mutex_unlock(&handler->lock);
+
+    vlogT("Stream: %d compress handler decompressed %zu bytes to %zd bytes.",
+          s->id, wire_len, len);
+
+    base->prev->on_data(base->prev, out);
+
+    if (pbuf)
+        buffer_release(pbuf);
+}
+
+void compress_handler_get_stats(StreamHandler *base,
+                                ElaStreamCompressStats *stats)
+{
+    CompressHandler *handler = (CompressHandler *)base;
+
+    pthread_mutex_lock(&handler->lock);
+    *stats = handler->stats;
+    pthread_mutex_unlock(&handler->lock);
+}
+
+static void compress_handler_destroy(void *p)
+{
+    CompressHandler *handler = (CompressHandler *)p;
+    ElaStreamCompressStats *stats = &handler->stats;
+
+    vlogD("Stream: %d compress handler destroyed, sent %llu packets "
+          "(%llu compressed) %llu -> %llu bytes in %llu us, received "
+          "%llu packets (%llu compressed) %llu -> %llu bytes in %llu us.",
+          handler->base.stream->id,
+          (unsigned long long)stats->tx_packets,
+          (unsigned long long)stats->tx_compressed,
+          (unsigned long long)stats->tx_bytes,
+          (unsigned long long)stats->tx_wire_bytes,
+          (unsigned long long)stats->tx_time,
+          (unsigned long long)stats->rx_packets,
+          (unsigned long long)stats->rx_decompressed,
+          (unsigned long long)stats->rx_wire_bytes,
+          (unsigned long long)stats->rx_bytes,
+          (unsigned long long)stats->rx_time);
+
+    pthread_mutex_destroy(&handler->lock);
+
+    if (handler->base.next)
+        deref(handler->base.next);
+}
+
+int compress_handler_create(ElaStream *s, StreamHandler **handler)
+{
+    CompressHandler *_handler;
+
+    _handler = (CompressHandler *)rc_zalloc(sizeof(CompressHandler),
+                                            compress_handler_destroy);
+    if (!_handler)
+        return ELA_GENERAL_ERROR(ELAERR_OUT_OF_MEMORY);
+
+    pthread_mutex_init(&_handler->lock, NULL);
+
+    _handler->base.name = "Compress Handler";
+    _handler->base.stream = s;
+
+    _handler->base.init    = default_handler_init;
+    _handler->base.prepare = default_handler_prepare;
+    _handler->base.start   = default_handler_start;
+    _handler->base.stop    = default_handler_stop;
+    _handler->base.write   = compress_handler_write;
+    _handler->base.on_data = compress_handler_on_rx_data;
+    _handler->base.on_state_changed = default_handler_on_state_changed;
+
+    vlogD("Stream: %d compress handler created.", s->id);
+
+    *handler = (StreamHandler *)_handler;
+    return 0;
+}
@@ -21,108 +21,540 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
 #include <assert.h>
 #include <sys/types.h>
+#include <pthread.h>
 
 #include <crystal.h>
+#include <sodium.h>
 
 #include "flex_buffer.h"
 #include "session.h"
 #include "stream_handler.h"
 
+/*
+ * Streams with parallel crypto hand every packet to the crypto pool as a
+ * job. Jobs complete in any order, each direction keeps its jobs in
+ * submission order and whichever thread finds the head completed passes
+ * packets on, one thread at a time.
+ */
+#define CRYPTO_QUEUE_MAX_PENDING    256
+
+typedef struct CryptoJob CryptoJob;
+
+typedef struct CryptoQueue {
+    pthread_mutex_t lock;
+    CryptoJob *head;
+    CryptoJob *tail;
+    int pending;
+    int delivering;
+
+    int  (*process)(StreamHandler *handler, FlexBuffer *buf);
+    void (*deliver)(StreamHandler *handler, FlexBuffer *buf);
+} CryptoQueue;
+
 typedef struct CryptoHandler {
     StreamHandler base;
+
+    pthread_mutex_t lock;
+    uint64_t tx_seq;
+
+    CryptoPool *pool;
+    CryptoQueue tx;
+    CryptoQueue rx;
+    int stopped;
 } CryptoHandler;
 
-static
-ssize_t crypto_handler_write(StreamHandler *handler, FlexBuffer *buf)
+struct CryptoJob {
+    CryptoTask task;
+    CryptoJob *next;
+    CryptoHandler *handler;
+    CryptoQueue *queue;
+    ElaStreamBuffer *buf;
+    int rc;
+    int done;
+};
+
+/*
+ * AES-GCM packets carry an explicit nonce, the session nonce is fixed for
+ * the whole session and must never be reused with GCM. The nonce is the
+ * stream id and a per stream sequence number, unique for the sender, and
+ * each direction has its own key. Wire format is nonce, then tag, then
+ * cipher text.
+ */
+#define GCM_NONCE_BYTES     crypto_aead_aes256gcm_NPUBBYTES
+#define GCM_TAG_BYTES       crypto_aead_aes256gcm_ABYTES
+#define GCM_HEADER_BYTES    (GCM_NONCE_BYTES + GCM_TAG_BYTES)
+
+static const char *cipher_names[] = {
+    "xsalsa20poly1305",
+    "aes256gcm"
+};
+
+const char *crypto_cipher_name(int cipher)
 {
+    if (cipher < 0 || cipher >= (int)(sizeof(cipher_names) / sizeof(cipher_names[0])))
+        return "unknown";
+
+    return cipher_names[cipher];
+}
+
+/*
+ * Local ciphers in preference order. AES-GCM is only offered when the
+ * CPU has hardware AES, it is slow and not constant time otherwise.
+ */
+const char *crypto_cipher_list(void)
+{
+    // CPU features are probed by sodium_init(), it's safe to call again.
+    if (sodium_init() >= 0 && crypto_aead_aes256gcm_is_available())
+        return "aes256gcm xsalsa20poly1305";
+    else
+        return "xsalsa20poly1305";
+}
+
+static bool cipher_list_has(const char *list, size_t len, const char *name)
+{
+    size_t name_len = strlen(name);
+    const char *end = list + len;
+
+    while (list < end) {
+        const char *p = list;
+
+        while (p < end && *p != ' ')
+            p++;
+
+        if ((size_t)(p - list) == name_len && !strncmp(list, name, name_len))
+            return true;
+
+        list = p + 1;
+    }
+
+    return false;
+}
+
+/*
+ * Both peers must end up with the same cipher, but the answer is encoded
+ * before the offer is applied. So the choice is the first cipher in the
+ * offerer's list the answerer supports too, computed on both sides.
+ */
+int crypto_cipher_select(const char *offer, size_t offer_len,
+                         const char *answer, size_t answer_len)
+{
+    const char *end;
+
+    if (!offer || !answer)
+        return CryptoCipher_XSalsa20Poly1305;
+
+    end = offer + offer_len;
+    while (offer < end) {
+        const char *p = offer;
+        int i;
+
+        while (p < end && *p != ' ')
+            p++;
+
+        for (i = 0; i < (int)(sizeof(cipher_names) / sizeof(cipher_names[0])); i++) {
+            if ((size_t)(p - offer) == strlen(cipher_names[i]) &&
+                !strncmp(offer, cipher_names[i], p - offer) &&
+                cipher_list_has(answer, answer_len, cipher_names[i]))
+                return i;
+        }
+
+        offer = p + 1;
+    }
+
+    return CryptoCipher_XSalsa20Poly1305;
+}
+
+static void derive_key(ElaSession *ws, const char *label, uint8_t *key)
+{
+    crypto_generichash(key, SYMMETRIC_KEY_BYTES,
+                       (const uint8_t *)label, strlen(label),
+                       ws->crypto.key, sizeof(ws->crypto.key));
+}
+
+void crypto_cipher_setup(ElaSession *ws)
+{
+    static const char *offerer_label = "aes256gcm offerer";
+    static const char *answerer_label = "aes256gcm answerer";
+
+    assert(ws);
+
+    // Separate AES-GCM keys per direction, from the shared session key.
+    if (ws->crypto.cipher == CryptoCipher_AES256GCM) {
+        derive_key(ws, ws->offerer ? offerer_label : answerer_label,
+                   ws->crypto.tx_key);
+        derive_key(ws, ws->offerer ? answerer_label : offerer_label,
+                   ws->crypto.rx_key);
+    }
+
+    vlogI("Session: Session to %s using cipher %s.", ws->to,
+          crypto_cipher_name(ws->crypto.cipher));
+}
+
+
+static int crypto_seal_gcm(StreamHandler *handler, FlexBuffer *buf)
+{
+    CryptoHandler *_handler = (CryptoHandler *)handler;
     ElaSession *ws = handler->stream->session;
-    FlexBuffer *cipher_buf;
-    ssize_t cipher_len;
-    ssize_t written;
+    uint32_t id = (uint32_t)handler->stream->id;
+    uint64_t seq;
+    size_t plain_len;
+    uint8_t *hdr;
+
+    assert(flex_buffer_offset(buf) >= GCM_HEADER_BYTES);
+
+    plain_len = flex_buffer_size(buf);
+
+    flex_buffer_backward_offset(buf, GCM_HEADER_BYTES);
+    hdr = (uint8_t *)flex_buffer_mutable_ptr(buf);
+
+    pthread_mutex_lock(&_handler->lock);
+    seq = _handler->tx_seq++;
+    pthread_mutex_unlock(&_handler->lock);
+
+    memcpy(hdr, &id, sizeof(id));
+    memcpy(hdr + sizeof(id), &seq, sizeof(seq));
+
+    crypto_aead_aes256gcm_encrypt_detached(hdr + GCM_HEADER_BYTES,
+                            hdr + GCM_NONCE_BYTES, NULL,
+                            hdr + GCM_HEADER_BYTES, plain_len,
+                            NULL, 0, NULL, hdr, ws->crypto.tx_key);
+
+    vlogT("Stream: %d crypto handler encrypted %zu bytes data.",
+          handler->stream->id, plain_len);
+
+    return 0;
+}
+
+static int crypto_open_gcm(StreamHandler *handler, FlexBuffer *buf)
+{
+    ElaSession *ws = handler->stream->session;
+    size_t cipher_len;
+    uint8_t *hdr;
+    int rc;
+
+    cipher_len = flex_buffer_size(buf);
+    if (cipher_len < GCM_HEADER_BYTES) {
+        vlogE("Stream: %d crypto handler got truncated data.",
+              handler->stream->id);
+        return ELA_GENERAL_ERROR(ELAERR_ENCRYPT);
+    }
+
+    cipher_len -= GCM_HEADER_BYTES;
+    hdr = (uint8_t *)flex_buffer_mutable_ptr(buf);
+
+    rc = crypto_aead_aes256gcm_decrypt_detached(hdr + GCM_HEADER_BYTES, NULL,
+                            hdr + GCM_HEADER_BYTES, cipher_len,
+                            hdr + GCM_NONCE_BYTES, NULL, 0,
+                            hdr, ws->crypto.rx_key);
+    if (rc != 0) {
+        vlogE("Stream: %d crypto handler decrypt data error.",
+              handler->stream->id);
+        return ELA_GENERAL_ERROR(ELAERR_ENCRYPT);
+    }
+
+    vlogT("Stream: %d crypto handler decrypt %zu bytes data.",
+          handler->stream->id, cipher_len);
+
+    flex_buffer_forward_offset(buf, GCM_HEADER_BYTES);
+
+    return 0;
+}
+
+/*
+ * Packets are sealed and opened in place. The zero padded NaCl box works
+ * with the same input and output buffer, and the padding fits in the
+ * headroom every FlexBuffer reserves, so no second buffer is needed.
+ * Buffers handed to the crypto handler are owned by the pipeline, they
+ * are never the application's data.
+ */
+static int crypto_seal(StreamHandler *handler, FlexBuffer *buf)
+{
+    ElaSession *ws = handler->stream->session;
+    size_t plain_len;
+    uint8_t *box;
+    int rc;
+
+    if (ws->crypto.cipher == CryptoCipher_AES256GCM)
+        return crypto_seal_gcm(handler, buf);
 
-    assert(handler);
-    assert(handler->next);
-    assert(buf);
     assert(flex_buffer_offset(buf) >= ZERO_BYTES);
 
-    flex_buffer_alloca(cipher_buf, flex_buffer_size(buf) + FLEX_PADDING_LEN,
-                       FLEX_PADDING_LEN - ZERO_BYTES);
+    plain_len = flex_buffer_size(buf);
 
     flex_buffer_backward_offset(buf, ZERO_BYTES);
+    box = (uint8_t *)flex_buffer_mutable_ptr(buf);
+    memset(box, 0, ZERO_BYTES);
 
-    cipher_len  = crypto_encrypt2(ws->crypto.key, ws->nonce,
-                                  flex_buffer_mutable_ptr(buf),
-                                  flex_buffer_size(buf),
-                                  flex_buffer_mutable_ptr(cipher_buf));
+    rc = crypto_box_afternm(box, box, plain_len + ZERO_BYTES,
+                            ws->nonce, ws->crypto.key);
+    if (rc != 0) {
+        vlogE("Stream: %d crypto handler encrypt data error.",
+              handler->stream->id);
+        flex_buffer_forward_offset(buf, ZERO_BYTES);
+        return ELA_GENERAL_ERROR(ELAERR_ENCRYPT);
+    }
 
-    // Reset plain buf's offset
-    flex_buffer_forward_offset(buf, ZERO_BYTES);
+    vlogT("Stream: %d crypto handler encrypted %zu bytes data.",
+          handler->stream->id, plain_len);
 
-    if (cipher_len <= 0) {
-        vlogE("Stream: %d crypto handler encrypt data error.",
+    // Wire format is MAC followed by cipher text.
+    flex_buffer_forward_offset(buf, ZERO_BYTES - MAC_BYTES);
+
+    return 0;
+}
+
+static int crypto_open(StreamHandler *handler, FlexBuffer *buf)
+{
+    ElaSession *ws = handler->stream->session;
+    size_t cipher_len;
+    uint8_t *box;
+    int rc;
+
+    if (ws->crypto.cipher == CryptoCipher_AES256GCM)
+        return crypto_open_gcm(handler, buf);
+
+    assert(flex_buffer_offset(buf) >= (ZERO_BYTES - MAC_BYTES));
+
+    cipher_len = flex_buffer_size(buf);
+    if (cipher_len < MAC_BYTES) {
+        vlogE("Stream: %d crypto handler got truncated data.",
+              handler->stream->id);
+        return ELA_GENERAL_ERROR(ELAERR_ENCRYPT);
+    }
+
+    flex_buffer_backward_offset(buf, ZERO_BYTES - MAC_BYTES);
+    box = (uint8_t *)flex_buffer_mutable_ptr(buf);
+    memset(box, 0, ZERO_BYTES - MAC_BYTES);
+
+    rc = crypto_box_open_afternm(box, box, flex_buffer_size(buf),
+                                 ws->nonce, ws->crypto.key);
+    if (rc != 0) {
+        vlogE("Stream: %d crypto handler decrypt data error.",
               handler->stream->id);
+        // TODO: need to stop stream or fire failed state.
         return ELA_GENERAL_ERROR(ELAERR_ENCRYPT);
-    } else {
-        vlogT("Stream: %d crypto handler encrypted %zu bytes data.",
-              handler->stream->id, cipher_len - ZERO_BYTES);
+    }
 
-        flex_buffer_set_size(cipher_buf, cipher_len);
-        flex_buffer_forward_offset(cipher_buf, ZERO_BYTES - MAC_BYTES);
+    vlogT("Stream: %d crypto handler decrypt %zu bytes data.",
+          handler->stream->id, cipher_len - MAC_BYTES);
 
-        written = handler->next->write(handler->next, cipher_buf);
+    flex_buffer_forward_offset(buf, ZERO_BYTES);
 
-        return written == flex_buffer_size(cipher_buf) ?
-                                flex_buffer_size(buf) : written;
+    return 0;
+}
+
+static void crypto_deliver_tx(StreamHandler *handler, FlexBuffer *buf)
+{
+    ssize_t rc;
+
+    rc = handler->next->write(handler->next, buf);
+    if (rc < 0 && rc != ELA_GENERAL_ERROR(ELAERR_BUSY))
+        vlogW("Stream: %d crypto handler send data error 0x%x.",
+              handler->stream->id, (int)rc);
+}
+
+static void crypto_deliver_rx(StreamHandler *handler, FlexBuffer *buf)
+{
+    handler->prev->on_data(handler->prev, buf);
+}
+
+static void crypto_job_finish(CryptoJob *job)
+{
+    CryptoHandler *handler = job->handler;
+    ElaStream *s = handler->base.stream;
+    ElaSession *ws = s->session;
+
+    if (job->rc == 0 && !handler->stopped)
+        job->queue->deliver(&handler->base, &job->buf->flex);
+
+    buffer_release(job->buf);
+    free(job);
+
+    deref(s);
+    deref(ws);
+}
+
+// Runs on a crypto pool thread.
+static void crypto_job_run(CryptoTask *task)
+{
+    CryptoJob *job = (CryptoJob *)task;
+    CryptoQueue *queue = job->queue;
+    ElaStream *s = job->handler->base.stream;
+    CryptoJob *ready;
+
+    job->rc = queue->process(&job->handler->base, &job->buf->flex);
+
+    pthread_mutex_lock(&queue->lock);
+    job->done = 1;
+
+    if (queue->delivering) {
+        // The delivering thread picks this job up, hands off from here.
+        pthread_mutex_unlock(&queue->lock);
+        return;
+    }
+
+    // Finishing jobs drops their references, keep the queue alive.
+    ref(s);
+    queue->delivering = 1;
+
+    while (queue->head && queue->head->done) {
+        ready = queue->head;
+        queue->head = ready->next;
+        if (!queue->head)
+            queue->tail = NULL;
+        queue->pending--;
+
+        pthread_mutex_unlock(&queue->lock);
+        crypto_job_finish(ready);
+        pthread_mutex_lock(&queue->lock);
     }
+
+    queue->delivering = 0;
+    pthread_mutex_unlock(&queue->lock);
+
+    deref(s);
+}
+
+/*
+ * Queue the packet for the crypto pool. A received pooled buffer is kept
+ * as is, anything else is copied into a pooled buffer since the caller's
+ * buffer is gone on return. The queue never blocks, the caller may hold
+ * the stream lock the delivering thread needs: a full queue fails writes
+ * as busy and drops received packets, both left to the upper layers.
+ */
+static int crypto_offload(CryptoHandler *handler, CryptoQueue *queue,
+                          FlexBuffer *buf)
+{
+    ElaStream *s = handler->base.stream;
+    ElaStreamBuffer *pbuf;
+    CryptoJob *job;
+
+    job = (CryptoJob *)calloc(1, sizeof(CryptoJob));
+    if (!job)
+        return ELA_GENERAL_ERROR(ELAERR_OUT_OF_MEMORY);
+
+    pbuf = stream_rx_buffer(s, buf);
+    if (!pbuf) {
+        free(job);
+        return ELA_GENERAL_ERROR(ELAERR_OUT_OF_MEMORY);
+    }
+
+    job->task.run = crypto_job_run;
+    job->handler = handler;
+    job->queue = queue;
+    job->buf = pbuf;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->pending >= CRYPTO_QUEUE_MAX_PENDING) {
+        pthread_mutex_unlock(&queue->lock);
+        buffer_release(pbuf);
+        free(job);
+        return ELA_GENERAL_ERROR(ELAERR_BUSY);
+    }
+
+    if (queue->tail)
+        queue->tail->next = job;
+    else
+        queue->head = job;
+    queue->tail = job;
+    queue->pending++;
+
+    ref(s);
+    ref(s->session);
+    pthread_mutex_unlock(&queue->lock);
+
+    crypto_pool_submit(handler->pool, &job->task);
+
+    return 0;
+}
+
+static
+ssize_t crypto_handler_write(StreamHandler *handler, FlexBuffer *buf)
+{
+    CryptoHandler *_handler = (CryptoHandler *)handler;
+    size_t plain_len;
+    ssize_t written;
+    int rc;
+
+    assert(handler);
+    assert(handler->next);
+    assert(buf);
+
+    plain_len = flex_buffer_size(buf);
+
+    if (_handler->pool) {
+        rc = crypto_offload(_handler, &_handler->tx, buf);
+        return rc < 0 ? rc : (ssize_t)plain_len;
+    }
+
+    rc = crypto_seal(handler, buf);
+    if (rc < 0)
+        return rc;
+
+    written = handler->next->write(handler->next, buf);
+
+    return written == (ssize_t)flex_buffer_size(buf) ?
+                            (ssize_t)plain_len : written;
 }
 
 static
 void crypto_handler_on_rx_data(StreamHandler *handler, FlexBuffer *buf)
 {
-    ElaSession *ws = handler->stream->session;
-    FlexBuffer *plain_buf;
-    ssize_t plain_len;
+    CryptoHandler *_handler = (CryptoHandler *)handler;
+    int rc;
 
     assert(handler);
     assert(handler->prev);
     assert(buf);
-    assert(flex_buffer_offset(buf) >= (ZERO_BYTES - MAC_BYTES));
 
-    flex_buffer_alloca(plain_buf, flex_buffer_size(buf) + FLEX_PADDING_LEN,
-                       FLEX_PADDING_LEN - (ZERO_BYTES - MAC_BYTES));
+    if (_handler->pool) {
+        rc = crypto_offload(_handler, &_handler->rx, buf);
+        if (rc < 0)
+            vlogW("Stream: %d crypto handler dropped %zu bytes data (0x%x).",
+                  handler->stream->id, flex_buffer_size(buf), rc);
+        return;
+    }
 
-    flex_buffer_backward_offset(buf, ZERO_BYTES - MAC_BYTES);
+    if (crypto_open(handler, buf) < 0)
+        return;
 
-    plain_len = crypto_decrypt2(ws->crypto.key, ws->nonce,
-                                flex_buffer_mutable_ptr(buf),
-                                flex_buffer_size(buf),
-                                flex_buffer_mutable_ptr(plain_buf));
+    handler->prev->on_data(handler->prev, buf);
+}
 
-    // Reset cipher buf's offset
-    flex_buffer_forward_offset(buf, ZERO_BYTES - MAC_BYTES);
+static void crypto_handler_stop(StreamHandler *handler, int error)
+{
+    CryptoHandler *_handler = (CryptoHandler *)handler;
 
-    if (plain_len <=0) {
-        vlogE("Stream: %d crypto handler decrypt data error.",
-              handler->stream->id);
-        // TODO: need to stop stream or fire failed state.
-        return;
-    } else {
-        vlogT("Stream: %d crypto handler decrypt %zu bytes data.",
-              handler->stream->id, plain_len - ZERO_BYTES);
+    // Offloaded packets still in flight are dropped.
+    _handler->stopped = 1;
 
-        flex_buffer_set_size(plain_buf, plain_len);
-        flex_buffer_forward_offset(plain_buf, ZERO_BYTES);
+    default_handler_stop(handler, error);
+}
 
-        handler->prev->on_data(handler->prev, plain_buf);
-    }
+static void crypto_queue_init(CryptoQueue *queue,
+                int  (*process)(StreamHandler *handler, FlexBuffer *buf),
+                void (*deliver)(StreamHandler *handler, FlexBuffer *buf))
+{
+    pthread_mutex_init(&queue->lock, NULL);
+    queue->process = process;
+    queue->deliver = deliver;
 }
 
 static void crypto_handler_destroy(void *p)
 {
     CryptoHandler *handler = (CryptoHandler *)p;
 
+    // Jobs hold the stream, none can be left once the handler goes.
+    assert(!handler->tx.head && !handler->rx.head);
+
+    pthread_mutex_destroy(&handler->tx.lock);
+    pthread_mutex_destroy(&handler->rx.lock);
+    pthread_mutex_destroy(&handler->lock);
+
     if (handler->base.next)
         deref(handler->base.next);
 
@@ -137,18 +569,30 @@ int crypto_handler_create(ElaStream *s, StreamHandler **handler)
     if (!_handler)
         return ELA_GENERAL_ERROR(ELAERR_OUT_OF_MEMORY);
 
+    pthread_mutex_init(&_handler->lock, NULL);
+    crypto_queue_init(&_handler->tx, crypto_seal, crypto_deliver_tx);
+    crypto_queue_init(&_handler->rx, crypto_open, crypto_deliver_rx);
+
+    if (s->parallel_crypto) {
+        _handler->pool = stream_get_crypto_pool(s);
+        if (!_handler->pool)
+            vlogW("Stream: %d no crypto pool, encrypt on the caller's "
+                  "thread.", s->id);
+    }
+
     _handler->base.name = "Crypto Handler";
     _handler->base.stream = s;
 
     _handler->base.init    = default_handler_init;
     _handler->base.prepare = default_handler_prepare;
     _handler->base.start   = default_handler_start;
-    _handler->base.stop    = default_handler_stop;
+    _handler->base.stop    = crypto_handler_stop;
     _handler->base.write   = crypto_handler_write;
     _handler->base.on_data = crypto_handler_on_rx_data;
     _handler->base.on_state_changed = default_handler_on_state_changed;
 
-    vlogD("Stream: %d crypto handler created", s->id);
+    vlogD("Stream: %d crypto handler created%s", s->id,
+          _handler->pool ? " with parallel crypto." : ".");
 
     *handler = (StreamHandler *)_handler;
     return 0;
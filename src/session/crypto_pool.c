@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#endif
+
+#include <crystal.h>
+
+#include "crypto_pool.h"
+
+struct CryptoPool {
+    pthread_mutex_t         lock;
+    pthread_cond_t          cond;
+    CryptoTask              *head;
+    CryptoTask              *tail;
+    int                     queued;
+    int                     stopping;
+    int                     nthreads;
+    pthread_t               threads[CRYPTO_POOL_MAX_THREADS];
+};
+
+/*
+ * Each worker takes its share of the queue at once, up to
+ * CRYPTO_POOL_BATCH tasks, so a burst of packets costs one lock round
+ * trip per batch while still spreading over all threads.
+ */
+static void *crypto_pool_routine(void *arg)
+{
+    CryptoPool *pool = (CryptoPool *)arg;
+    CryptoTask *batch;
+    CryptoTask *task;
+    int n;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->head && !pool->stopping)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+
+        // Queued tasks still run on stopping, they hold references.
+        if (!pool->head)
+            break;
+
+        n = (pool->queued + pool->nthreads - 1) / pool->nthreads;
+        if (n > CRYPTO_POOL_BATCH)
+            n = CRYPTO_POOL_BATCH;
+
+        batch = task = pool->head;
+        while (--n > 0 && task->next)
+            task = task->next;
+
+        pool->head = task->next;
+        if (!pool->head)
+            pool->tail = NULL;
+        task->next = NULL;
+
+        for (task = batch; task; task = task->next)
+            pool->queued--;
+
+        pthread_mutex_unlock(&pool->lock);
+
+        while (batch) {
+            task = batch;
+            batch = batch->next;
+            task->run(task);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static void crypto_pool_destroy(void *p)
+{
+    CryptoPool *pool = (CryptoPool *)p;
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+
+    vlogD("Session: Crypto pool destroyed.");
+}
+
+static int get_cpu_count(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)n : 1;
+#else
+    return 1;
+#endif
+}
+
+CryptoPool *crypto_pool_create(int threads)
+{
+    CryptoPool *pool;
+    int rc;
+
+    if (threads <= 0)
+        threads = get_cpu_count();
+
+    if (threads > CRYPTO_POOL_MAX_THREADS)
+        threads = CRYPTO_POOL_MAX_THREADS;
+
+    pool = (CryptoPool *)rc_zalloc(sizeof(CryptoPool), crypto_pool_destroy);
+    if (!pool)
+        return NULL;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    for (; pool->nthreads < threads; pool->nthreads++) {
+        rc = pthread_create(&pool->threads[pool->nthreads], NULL,
+                            crypto_pool_routine, pool);
+        if (rc != 0) {
+            vlogE("Session: Create crypto pool thread error (%d).", rc);
+            break;
+        }
+    }
+
+    if (pool->nthreads == 0) {
+        deref(pool);
+        return NULL;
+    }
+
+    vlogD("Session: Crypto pool created with %d threads.", pool->nthreads);
+
+    return pool;
+}
+
+int crypto_pool_get_threads(CryptoPool *pool)
+{
+    assert(pool);
+
+    return pool->nthreads;
+}
+
+void crypto_pool_submit(CryptoPool *pool, CryptoTask *task)
+{
+    assert(pool);
+    assert(task && task->run);
+
+    task->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail)
+        pool->tail->next = task;
+    else
+        pool->head = task;
+    pool->tail = task;
+    pool->queued++;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
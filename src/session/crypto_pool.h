@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __CRYPTO_POOL_H__
+#define __CRYPTO_POOL_H__
+
+#include <crystal.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Threads shared by all streams which offload packet encryption. Tasks are
+ * embedded in the caller's own job structure and run in no particular
+ * order, the caller restores ordering itself.
+ */
+#define CRYPTO_POOL_MAX_THREADS     4
+
+#define CRYPTO_POOL_BATCH           16
+
+typedef struct CryptoPool CryptoPool;
+typedef struct CryptoTask CryptoTask;
+
+struct CryptoTask {
+    CryptoTask              *next;
+    void (*run)(CryptoTask *task);
+};
+
+/*
+ * Threads default to one per core when threads is 0, never more than
+ * CRYPTO_POOL_MAX_THREADS.
+ */
+CryptoPool *crypto_pool_create(int threads);
+
+int crypto_pool_get_threads(CryptoPool *pool);
+
+void crypto_pool_submit(CryptoPool *pool, CryptoTask *task);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CRYPTO_POOL_H__ */
@@ -202,8 +202,244 @@ typedef struct ElaTransportInfo {
      * The remote address information.
      */
     ElaAddressInfo remote;
+    /**
+     * \~English
+     * The path MTU the reliable transport sizes its segments for, found
+     * by probing the path; 0 for streams without ELA_STREAM_RELIABLE.
+     */
+    int mtu;
 } ElaTransportInfo;
 
+/**
+ * \~English
+ * Carrier session setup latency, broken down by phase.
+ *
+ * All values are in milliseconds, or -1 if the phase has not completed
+ * (yet). Phases of streams are measured from the first stream that entered
+ * the phase to the last stream that completed it.
+ */
+typedef struct ElaSessionTimings {
+    /**
+     * \~English
+     * The time spent on acquiring TURN server credentials.
+     */
+    int turn;
+    /**
+     * \~English
+     * The time spent on gathering local candidates.
+     */
+    int gathering;
+    /**
+     * \~English
+     * On the requesting side, the time from sending the local SDP until
+     * the remote SDP arrived. On the replying side, the time from receiving
+     * the request until the reply was sent.
+     */
+    int signaling;
+    /**
+     * \~English
+     * The time spent on ICE connectivity checks.
+     */
+    int checking;
+    /**
+     * \~English
+     * The time spent on the reliable transport handshake, or 0 for
+     * unreliable streams.
+     */
+    int handshake;
+    /**
+     * \~English
+     * The time from creating the session until all streams connected.
+     */
+    int total;
+} ElaSessionTimings;
+
+/**
+ * \~English
+ * Compression counters of a stream created with ELA_STREAM_COMPRESS.
+ *
+ * Bytes are counted before and after the compress handler, so the
+ * compression ratio is tx_wire_bytes / tx_bytes. Times are in
+ * microseconds spent in the codec.
+ */
+typedef struct ElaStreamCompressStats {
+    /**
+     * \~English
+     * The number of packets sent.
+     */
+    uint64_t tx_packets;
+    /**
+     * \~English
+     * The number of packets sent compressed, the rest were sent raw.
+     */
+    uint64_t tx_compressed;
+    /**
+     * \~English
+     * The bytes handed to the compress handler for sending.
+     */
+    uint64_t tx_bytes;
+    /**
+     * \~English
+     * The bytes sent by the compress handler, headers included.
+     */
+    uint64_t tx_wire_bytes;
+    /**
+     * \~English
+     * The time spent on compressing.
+     */
+    uint64_t tx_time;
+    /**
+     * \~English
+     * The number of packets received.
+     */
+    uint64_t rx_packets;
+    /**
+     * \~English
+     * The number of received packets that were compressed.
+     */
+    uint64_t rx_decompressed;
+    /**
+     * \~English
+     * The bytes received by the compress handler, headers included.
+     */
+    uint64_t rx_wire_bytes;
+    /**
+     * \~English
+     * The bytes passed on after decompressing.
+     */
+    uint64_t rx_bytes;
+    /**
+     * \~English
+     * The time spent on decompressing.
+     */
+    uint64_t rx_time;
+} ElaStreamCompressStats;
+
+/**
+ * \~English
+ * Forward error correction counters of a stream created with
+ * ELA_STREAM_FEC.
+ *
+ * Loss rates are in per mille.
+ */
+typedef struct ElaStreamFecStats {
+    /**
+     * \~English
+     * The number of packets sent.
+     */
+    uint64_t tx_packets;
+    /**
+     * \~English
+     * The number of parity packets sent along with them.
+     */
+    uint64_t tx_parity;
+    /**
+     * \~English
+     * The number of packets received, recovered ones not included.
+     */
+    uint64_t rx_packets;
+    /**
+     * \~English
+     * The number of packets the path lost, counted by group once the
+     * group is complete.
+     */
+    uint64_t rx_lost;
+    /**
+     * \~English
+     * The number of lost packets rebuilt from parity.
+     */
+    uint64_t rx_recovered;
+    /**
+     * \~English
+     * The number of packets protected by one parity packet at present.
+     */
+    uint32_t group_size;
+    /**
+     * \~English
+     * The loss rate the remote peer reports for the packets sent.
+     */
+    uint32_t loss;
+} ElaStreamFecStats;
+
+/**
+ * \~English
+ * Loss recovery counters of a stream created with ELA_STREAM_RELIABLE.
+ *
+ * Counters are for the data this side sends. Times are in milliseconds.
+ */
+typedef struct ElaStreamReliableStats {
+    /**
+     * \~English
+     * The number of segments sent again, for any reason.
+     */
+    uint64_t retransmits;
+    /**
+     * \~English
+     * The number of retransmission timeouts.
+     */
+    uint64_t timeouts;
+    /**
+     * \~English
+     * The number of probes sent because the tail of a flight went
+     * unacknowledged.
+     */
+    uint64_t tail_loss_probes;
+    /**
+     * \~English
+     * The number of times fast recovery was entered.
+     */
+    uint64_t fast_recoveries;
+    /**
+     * \~English
+     * The number of segments found lost by the time they were sent
+     * rather than by duplicate acknowledgements.
+     */
+    uint64_t time_losses;
+    /**
+     * \~English
+     * The number of larger segments sent to find out the path MTU.
+     */
+    uint64_t mtu_probes;
+    /**
+     * \~English
+     * The smoothed round trip time.
+     */
+    uint32_t srtt;
+    /**
+     * \~English
+     * The current retransmission timeout.
+     */
+    uint32_t rto;
+} ElaStreamReliableStats;
+
+/**
+ * \~English
+ * A buffer of outgoing data for scatter/gather writes.
+ */
+typedef struct ElaStreamIOVec {
+    /**
+     * \~English
+     * The outgoing data.
+     */
+    const void *data;
+    /**
+     * \~English
+     * The outgoing data length.
+     */
+    size_t len;
+} ElaStreamIOVec;
+
+/**
+ * \~English
+ * A refcounted buffer of received stream data.
+ *
+ * Delivered by ElaStreamCallbacks::stream_buffer and
+ * ElaStreamCallbacks::channel_buffer. The buffer is valid while the
+ * callback runs; call ela_stream_buffer_retain() to keep it after the
+ * callback returns, and ela_stream_buffer_release() when done with it.
+ */
+typedef struct ElaStreamBuffer ElaStreamBuffer;
+
 /* Global session APIs */
 
 /**
@@ -372,6 +608,27 @@ void ela_session_set_userdata(ElaSession *session, void *userdata);
 CARRIER_API
 void *ela_session_get_userdata(ElaSession *session);
 
+/**
+ * \~English
+ * Get the setup latency of the session, broken down by phase.
+ *
+ * The breakdown is also logged once all streams of the session are
+ * connected.
+ *
+ * @param
+ *      session     [in] A handle to the carrier session.
+ * @param
+ *      timings     [out] The session setup latency defined in
+ *                        ElaSessionTimings.
+ *
+ * @return
+ *      0 on success, or -1 if an error occurred.
+ *      The specific error code can be retrieved by calling
+ *      ela_get_error().
+ */
+CARRIER_API
+int ela_session_get_timings(ElaSession *session, ElaSessionTimings *timings);
+
 /**
  * \~English
  * An application-defined function that receive session request complete
@@ -400,6 +657,33 @@ typedef void ElaSessionRequestCompleteCallback(ElaSession *session,
         const char *bundle, int status, const char *reason,
         const char *sdp, size_t len, void *context);
 
+/**
+ * \~English
+ * Enable trickle ICE on the session.
+ *
+ * By default a stream reports ElaStreamState_initialized only after all
+ * local candidates (host, server reflexive and relayed) are gathered, and
+ * the whole candidate list is carried in the session request or reply.
+ * With trickle ICE enabled, streams become initialized as soon as host
+ * candidates are available, so the request or reply goes out without
+ * waiting for STUN/TURN round trips. The remaining candidates are sent to
+ * the peer in follow-up messages once gathering completes, and both sides
+ * begin connectivity checks after the candidate lists are complete.
+ *
+ * This function must be called before any stream is added. Only enable
+ * trickle ICE when the remote peer is known to support it; a legacy peer
+ * only uses the candidates carried in the session request or reply.
+ *
+ * @param
+ *      session     [in] A handle to the ElaSession.
+ *
+ * @return
+ *      0 on success, or -1 if an error occurred. The specific error code
+ *      can be retrieved by calling ela_get_error().
+ */
+CARRIER_API
+int ela_session_enable_trickle(ElaSession *session);
+
 /**
  * \~English
  * Send session request to the friend.
@@ -552,6 +836,15 @@ typedef struct ElaStreamCallbacks {
      * receive stream_data callback any more. All data will reported
      * as multiplexing channel data.
      *
+     * On a reliable stream, data is reported as it lies in the receive
+     * buffer, so one call may carry up to the whole buffer, which grows
+     * with the bandwidth-delay product up to 2 MB, or the limit set with
+     * ela_stream_set_buffer_limits().
+     *
+     * The callback may run on the transport thread with the stream lock
+     * held. It may write to the stream, but must not wait on another
+     * thread that uses it.
+     *
      * @param
      *      session     [in] The handle to the ElaSession.
      * @param
@@ -680,11 +973,80 @@ typedef struct ElaStreamCallbacks {
      */
     void (*channel_resume)(ElaSession *session, int stream, int channel,
                            void *context);
+
+    /* Zero-copy receive callbacks */
+    /**
+     * \~English
+     * Callback will be called when the stream receives incoming packet,
+     * in place of stream_data.
+     *
+     * The packet is delivered in a pooled buffer that the application may
+     * retain with ela_stream_buffer_retain() instead of copying the data.
+     *
+     * @param
+     *      session     [in] The handle to the ElaSession.
+     * @param
+     *      stream      [in] The stream ID.
+     * @param
+     *      buffer      [in] The received packet buffer.
+     * @param
+     *      context     [in] The application defined context data.
+     */
+    void (*stream_buffer)(ElaSession *session, int stream,
+                          ElaStreamBuffer *buffer, void *context);
+
+    /**
+     * \~English
+     * Callback will be called when channel received incoming data,
+     * in place of channel_data.
+     *
+     * The data is delivered in a pooled buffer that the application may
+     * retain with ela_stream_buffer_retain() instead of copying the data.
+     *
+     * @param
+     *      session     [in] The handle to the ElaSession.
+     * @param
+     *      stream      [in] The stream ID.
+     * @param
+     *      channel     [in] The current channel ID.
+     * @param
+     *      buffer      [in] The received data buffer.
+     * @param
+     *      context     [in] The application defined context data.
+     *
+     * @return
+     *      True on success, or false if an error occurred.
+     *      If this callback return false, the channel will be closed
+     *      with CloseReason_Error.
+     */
+    bool (*channel_buffer)(ElaSession *session, int stream, int channel,
+                           ElaStreamBuffer *buffer, void *context);
+
+    /* Flow control callbacks */
+    /**
+     * \~English
+     * Callback will be called when a non-blocking reliable stream can
+     * take more data, after a write to it was cut short or failed with
+     * EAGAIN.
+     *
+     * The callback runs on the stream's transport thread with the stream
+     * lock held. It may write to the stream, but must not wait for another
+     * thread that uses the same stream or session, or it deadlocks.
+     *
+     * @param
+     *      session     [in] The handle to the ElaSession.
+     * @param
+     *      stream      [in] The stream ID.
+     * @param
+     *      context     [in] The application defined context data.
+     */
+    void (*stream_writable)(ElaSession *session, int stream, void *context);
 } ElaStreamCallbacks;
 
 /**
  * Compress option, indicates data would be compressed before transmission.
- * For now, just reserved this bit option for future implement.
+ * Packets are compressed one by one, and sent as is when they don't
+ * shrink. Both peers must use this option on the stream.
  */
 #define ELA_STREAM_COMPRESS             0x01
 
@@ -716,6 +1078,44 @@ typedef struct ElaStreamCallbacks {
  */
 #define ELA_STREAM_PORT_FORWARDING      0x10
 
+/**
+ * Parallel crypto option, indicates packets would be encrypted and
+ * decrypted on a small pool of threads, so a bulk transfer is not bound
+ * to the speed of one core. Packets keep their order. This option only
+ * affects the local side, and is ignored on plain streams.
+ */
+#define ELA_STREAM_PARALLEL_CRYPTO      0x20
+
+/**
+ * BBR congestion control option, indicates the reliable transport would
+ * size its window by the measured bottleneck bandwidth and round trip
+ * time instead of backing off on every loss, which keeps throughput up
+ * on lossy or long-haul paths. This option only affects the sending
+ * side of the local end, and is ignored on unreliable streams.
+ */
+#define ELA_STREAM_BBR                  0x40
+
+/**
+ * Low latency option, indicates the reliable transport would send small
+ * writes at once instead of holding them back while earlier data is
+ * unacknowledged, and acknowledge every segment as it arrives, which
+ * saves round trips on request/response traffic at the cost of more
+ * packets. Without it, a bulk transfer acknowledges only a few segments
+ * per round trip. This option only affects the local side, and is
+ * ignored on unreliable streams.
+ */
+#define ELA_STREAM_LOW_LATENCY          0x80
+
+/**
+ * Forward error correction option, indicates a parity packet would be
+ * sent after every few packets, and once writes pause, so a lost packet
+ * can be rebuilt by the receiver instead of being retransmitted. Parity
+ * is sent more often as the receiver reports more loss. Both peers must
+ * use this option on the stream. The option is ignored on reliable
+ * streams.
+ */
+#define ELA_STREAM_FEC                  0x100
+
 /**
  * \~English
  * Add a new stream to session.
@@ -740,6 +1140,8 @@ typedef struct ElaStreamCallbacks {
  *                       by a bitwise-inclusive OR of flags from the
  *                       following list:
  *
+ *                       - ELA_STREAM_COMPRESS
+ *                         Compressed mode.
  *                       - ELA_STREAM_PLAIN
  *                         Plain mode.
  *                       - ELA_STREAM_RELIABLE
@@ -748,6 +1150,14 @@ typedef struct ElaStreamCallbacks {
  *                         Multiplexing mode.
  *                       - ELA_STREAM_PORT_FORWARDING
  *                         Support portforwarding over multiplexing.
+ *                       - ELA_STREAM_PARALLEL_CRYPTO
+ *                         Encrypt and decrypt on multiple threads.
+ *                       - ELA_STREAM_BBR
+ *                         BBR congestion control on reliable mode.
+ *                       - ELA_STREAM_LOW_LATENCY
+ *                         No Nagle and no delayed ACKs on reliable mode.
+ *                       - ELA_STREAM_FEC
+ *                         Forward error correction on unreliable mode.
  *
  * @param
  *      callbacks   [in] The Application defined callback functions in
@@ -884,6 +1294,198 @@ CARRIER_API
 int ela_stream_get_transport_info(ElaSession *session, int stream,
                                       ElaTransportInfo *info);
 
+/**
+ * \~English
+ * Get the compression counters of a carrier stream.
+ *
+ * @param
+ *      session     [in] The handle to the ElaSession.
+ * @param
+ *      stream      [in] The stream ID.
+ * @param
+ *      stats       [out] The compression counters defined in
+ *                        ElaStreamCompressStats.
+ *
+ * @return
+ *      0 on success, or -1 if an error occurred, including the stream
+ *      not being created with ELA_STREAM_COMPRESS.
+ *      The specific error code can be retrieved by calling
+ *      ela_get_error().
+ */
+CARRIER_API
+int ela_stream_get_compress_stats(ElaSession *session, int stream,
+                                  ElaStreamCompressStats *stats);
+
+/**
+ * \~English
+ * Get the forward error correction counters of a carrier stream.
+ *
+ * @param
+ *      session     [in] The handle to the ElaSession.
+ * @param
+ *      stream      [in] The stream ID.
+ * @param
+ *      stats       [out] The forward error correction counters defined
+ *                        in ElaStreamFecStats.
+ *
+ * @return
+ *      0 on success, or -1 if an error occurred, including the stream
+ *      not being created with ELA_STREAM_FEC, or being reliable.
+ *      The specific error code can be retrieved by calling
+ *      ela_get_error().
+ */
+CARRIER_API
+int ela_stream_get_fec_stats(ElaSession *session, int stream,
+                             ElaStreamFecStats *stats);
+
+/**
+ * \~English
+ * Set the buffer limits of a reliable stream.
+ *
+ * The send and receive buffers start at min_size bytes and grow at
+ * runtime towards the bandwidth-delay product of the connection, up to
+ * max_size bytes. A max_size equal to min_size disables the autotuning.
+ * Zero keeps the default for that bound: 60 KB for receiving and 90 KB
+ * for sending as minimum, 2 MB as maximum.
+ *
+ * This function must be called before the stream is prepared by
+ * ela_session_request() or ela_session_reply_request().
+ *
+ * @param
+ *      session     [in] The handle to the ElaSession.
+ * @param
+ *      stream      [in] The stream ID.
+ * @param
+ *      min_size    [in] The initial buffer size in bytes, or 0.
+ * @param
+ *      max_size    [in] The autotuning ceiling in bytes, or 0. At most
+ *                       1 GB.
+ *
+ * @return
+ *      0 on success, or -1 if an error occurred, including the stream
+ *      not being created with ELA_STREAM_RELIABLE.
+ *      The specific error code can be retrieved by calling
+ *      ela_get_error().
+ */
+CARRIER_API
+int ela_stream_set_buffer_limits(ElaSession *session, int stream,
+                                 size_t min_size, size_t max_size);
+
+/**
+ * \~English
+ * Get the loss recovery counters of a reliable stream.
+ *
+ * @param
+ *      session     [in] The handle to the ElaSession.
+ * @param
+ *      stream      [in] The stream ID.
+ * @param
+ *      stats       [out] The loss recovery counters defined in
+ *                        ElaStreamReliableStats.
+ *
+ * @return
+ *      0 on success, or -1 if an error occurred, including the stream
+ *      not being created with ELA_STREAM_RELIABLE.
+ *      The specific error code can be retrieved by calling
+ *      ela_get_error().
+ */
+CARRIER_API
+int ela_stream_get_reliable_stats(ElaSession *session, int stream,
+                                  ElaStreamReliableStats *stats);
+
+/**
+ * \~English
+ * Set the floor of the retransmission timeout of a reliable stream.
+ *
+ * The timeout follows the measured round trip time and its variation,
+ * and is never less than the round trip time plus this floor. The
+ * default of 200 milliseconds suits most paths; a lower one recovers
+ * faster on low latency links at the risk of spurious retransmissions.
+ *
+ * This function must be called before the stream is prepared by
+ * ela_session_request() or ela_session_reply_request().
+ *
+ * @param
+ *      session     [in] The handle to the ElaSession.
+ * @param
+ *      stream      [in] The stream ID.
+ * @param
+ *      min_rto     [in] The floor in milliseconds, or 0 for the default.
+ *                       At most 60000.
+ *
+ * @return
+ *      0 on success, or -1 if an error occurred, including the stream
+ *      not being created with ELA_STREAM_RELIABLE.
+ *      The specific error code can be retrieved by calling
+ *      ela_get_error().
+ */
+CARRIER_API
+int ela_stream_set_min_rto(ElaSession *session, int stream,
+                           uint32_t min_rto);
+
+/**
+ * \~English
+ * Set whether a reliable stream paces its data.
+ *
+ * Without pacing the stream sends whatever its window allows back to
+ * back, and the bursts overflow shallow buffers on the way, such as TURN
+ * relays and mobile links. A paced stream spreads its data evenly over
+ * the round trip instead, at a rate derived from its window and round
+ * trip time. Pacing is off by default, and is most effective together
+ * with ELA_STREAM_BBR.
+ *
+ * This function must be called before the stream is prepared by
+ * ela_session_request() or ela_session_reply_request().
+ *
+ * @param
+ *      session     [in] The handle to the ElaSession.
+ * @param
+ *      stream      [in] The stream ID.
+ * @param
+ *      pacing      [in] True to pace the data sent on the stream.
+ *
+ * @return
+ *      0 on success, or -1 if an error occurred, including the stream
+ *      not being created with ELA_STREAM_RELIABLE.
+ *      The specific error code can be retrieved by calling
+ *      ela_get_error().
+ */
+CARRIER_API
+int ela_stream_set_pacing(ElaSession *session, int stream, bool pacing);
+
+/**
+ * \~English
+ * Set whether writes to a reliable stream block.
+ *
+ * By default a write to a reliable stream waits until all the data fits
+ * in the send buffer. A non-blocking stream takes what fits instead, and
+ * ela_stream_write() returns the number of bytes taken, or fails with
+ * ELA_SYS_ERROR(EAGAIN) if there is no room at all. The stream_writable
+ * callback is then called once the peer has acknowledged enough data to
+ * write again.
+ *
+ * The mode is not available on multiplexing streams, since a channel
+ * packet can not be sent in part.
+ *
+ * @param
+ *      session     [in] The handle to the ElaSession.
+ * @param
+ *      stream      [in] The stream ID.
+ * @param
+ *      nonblocking [in] True to make writes non-blocking, false to make
+ *                       them block again.
+ *
+ * @return
+ *      0 on success, or -1 if an error occurred, including the stream
+ *      being created without ELA_STREAM_RELIABLE or with
+ *      ELA_STREAM_MULTIPLEXING.
+ *      The specific error code can be retrieved by calling
+ *      ela_get_error().
+ */
+CARRIER_API
+int ela_stream_set_nonblocking(ElaSession *session, int stream,
+                               bool nonblocking);
+
 /**
  * \~English
  * Send outgoing data to remote peer.
@@ -892,6 +1494,11 @@ int ela_stream_get_transport_info(ElaSession *session, int stream,
  * call this function to send data. If this function is called
  * on multiplexing mode stream, it will return error.
  *
+ * The data length of unreliable stream can not exceed
+ * ELA_MAX_USER_DATA_LEN. The data to reliable stream can be of any
+ * length, it will be segmented internally. A non-blocking reliable
+ * stream may take less than len bytes; see ela_stream_set_nonblocking().
+ *
  * @param
  *      session     [in] The handle to the ElaSession.
  * @param
@@ -910,6 +1517,34 @@ CARRIER_API
 ssize_t ela_stream_write(ElaSession *session, int stream,
                              const void *data, size_t len);
 
+/**
+ * \~English
+ * Send outgoing data gathered from multiple buffers to remote peer.
+ *
+ * Same as ela_stream_write() but with the data scattered in several
+ * buffers. For unreliable stream the buffers are sent as one packet, so
+ * the total length can not exceed ELA_MAX_USER_DATA_LEN. For reliable
+ * stream the buffers are passed to the transport without an intermediate
+ * copy, and the total length is unlimited.
+ *
+ * @param
+ *      session     [in] The handle to the ElaSession.
+ * @param
+ *      stream      [in] The stream ID.
+ * @param
+ *      iov         [in] The outgoing data buffers.
+ * @param
+ *      iovcnt      [in] The count of the outgoing data buffers.
+ *
+ * @return
+ *      Sent bytes on success, or -1 if an error occurred.
+ *      The specific error code can be retrieved by calling
+ *      ela_get_error().
+ */
+CARRIER_API
+ssize_t ela_stream_writev(ElaSession *session, int stream,
+                          const ElaStreamIOVec *iov, int iovcnt);
+
 /**
  * \~English
  * Open a new channel on multiplexing stream.
@@ -981,6 +1616,89 @@ CARRIER_API
 ssize_t ela_stream_write_channel(ElaSession *session, int stream,
                     int channel, const void *data, size_t len);
 
+/**
+ * \~English
+ * Send outgoing data gathered from multiple buffers to remote peer.
+ *
+ * If the stream is not multiplexing this function will fail.
+ *
+ * The data is sent in channel packets of at most ELA_MAX_USER_DATA_LEN
+ * bytes. On unreliable stream the total length can not exceed
+ * ELA_MAX_USER_DATA_LEN, on reliable stream it is unlimited.
+ *
+ * @param
+ *      session     [in] The handle to the ElaSession.
+ * @param
+ *      stream      [in] The stream ID.
+ * @param
+ *      channel     [in] The channel ID.
+ * @param
+ *      iov         [in] The outgoing data buffers.
+ * @param
+ *      iovcnt      [in] The count of the outgoing data buffers.
+ *
+ * @return
+ *      Sent bytes on success, or -1 if an error occurred.
+ *      The specific error code can be retrieved by calling
+ *      ela_get_error().
+ */
+CARRIER_API
+ssize_t ela_stream_write_channelv(ElaSession *session, int stream, int channel,
+                                  const ElaStreamIOVec *iov, int iovcnt);
+
+/**
+ * \~English
+ * Get the data of a received stream buffer.
+ *
+ * @param
+ *      buffer      [in] The stream buffer.
+ *
+ * @return
+ *      The pointer to the received data, or NULL if buffer is empty.
+ */
+CARRIER_API
+const void *ela_stream_buffer_data(const ElaStreamBuffer *buffer);
+
+/**
+ * \~English
+ * Get the data length of a received stream buffer.
+ *
+ * @param
+ *      buffer      [in] The stream buffer.
+ *
+ * @return
+ *      The received data length.
+ */
+CARRIER_API
+size_t ela_stream_buffer_size(const ElaStreamBuffer *buffer);
+
+/**
+ * \~English
+ * Keep a received stream buffer after the receive callback returns.
+ *
+ * Every call must be balanced by ela_stream_buffer_release().
+ *
+ * @param
+ *      buffer      [in] The stream buffer.
+ *
+ * @return
+ *      The same stream buffer.
+ */
+CARRIER_API
+ElaStreamBuffer *ela_stream_buffer_retain(ElaStreamBuffer *buffer);
+
+/**
+ * \~English
+ * Release a stream buffer retained by ela_stream_buffer_retain().
+ *
+ * The buffer returns to its pool when the last reference is released.
+ *
+ * @param
+ *      buffer      [in] The stream buffer.
+ */
+CARRIER_API
+void ela_stream_buffer_release(ElaStreamBuffer *buffer);
+
 /**
  * \~English
  * Request remote peer to pend channel data sending.
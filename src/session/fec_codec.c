@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "fec_codec.h"
+
+#define FEC_PARITY_BIT          (1U << FEC_GROUP_MAX)
+
+static void fec_xor(uint8_t *acc, size_t *acc_len,
+                    const uint8_t *data, size_t len)
+{
+    size_t i;
+
+    if (len > *acc_len) {
+        memset(acc + *acc_len, 0, len - *acc_len);
+        *acc_len = len;
+    }
+
+    for (i = 0; i < len; i++)
+        acc[i] ^= data[i];
+}
+
+static void fec_put_header(uint8_t *hdr, uint8_t type, uint8_t index,
+                           uint8_t count, uint8_t group)
+{
+    hdr[0] = type;
+    hdr[1] = index;
+    hdr[2] = count;
+    hdr[3] = group;
+}
+
+/*
+ * The longest group that loses about a quarter of a packet on average, so
+ * two losses in one stay unlikely.
+ */
+static int fec_group_size(int loss)
+{
+    int count;
+
+    if (loss <= 0)
+        return FEC_GROUP_MAX;
+
+    count = 250 / loss - 1;
+    if (count < FEC_GROUP_MIN)
+        count = FEC_GROUP_MIN;
+    if (count > FEC_GROUP_MAX)
+        count = FEC_GROUP_MAX;
+
+    return count;
+}
+
+void fec_encoder_init(FecEncoder *enc)
+{
+    memset(enc, 0, offsetof(FecEncoder, parity));
+    enc->loss = FEC_LOSS_DEFAULT;
+}
+
+int fec_encoder_group_size(FecEncoder *enc)
+{
+    return fec_group_size(enc->loss);
+}
+
+bool fec_encode(FecEncoder *enc, const uint8_t *data, size_t len,
+                uint8_t *hdr)
+{
+    if (len > FEC_PAYLOAD_MAX) {
+        fec_put_header(hdr, FEC_DATA, 0, 0, 0);
+        return false;
+    }
+
+    if (enc->index == 0)
+        enc->count = fec_group_size(enc->loss);
+
+    fec_put_header(hdr, FEC_DATA, (uint8_t)enc->index++, (uint8_t)enc->count,
+                   enc->group);
+
+    fec_xor(enc->parity, &enc->len, data, len);
+    enc->length_xor ^= (uint16_t)len;
+
+    return enc->index == enc->count;
+}
+
+size_t fec_encode_parity(FecEncoder *enc, uint8_t *out)
+{
+    size_t len;
+
+    if (!enc->index)
+        return 0;
+
+    fec_put_header(out, FEC_PARITY, (uint8_t)enc->index, (uint8_t)enc->index,
+                   enc->group);
+    out[FEC_HEADER_LEN] = (uint8_t)(enc->length_xor >> 8);
+    out[FEC_HEADER_LEN + 1] = (uint8_t)enc->length_xor;
+    memcpy(out + FEC_HEADER_LEN + FEC_LENGTH_LEN, enc->parity, enc->len);
+    len = FEC_HEADER_LEN + FEC_LENGTH_LEN + enc->len;
+
+    enc->group++;
+    enc->index = 0;
+    enc->length_xor = 0;
+    enc->len = 0;
+
+    return len;
+}
+
+void fec_encoder_on_report(FecEncoder *enc, int loss)
+{
+    enc->loss = (enc->loss * 3 + loss) / 4;
+}
+
+size_t fec_encode_report(int loss, uint8_t *out)
+{
+    if (loss > UINT16_MAX)
+        loss = UINT16_MAX;
+
+    fec_put_header(out, FEC_REPORT, 0, 0, 0);
+    out[FEC_HEADER_LEN] = (uint8_t)(loss >> 8);
+    out[FEC_HEADER_LEN + 1] = (uint8_t)loss;
+
+    return FEC_REPORT_LEN;
+}
+
+int fec_decode_report(const uint8_t *packet, size_t len)
+{
+    if (len < FEC_REPORT_LEN || packet[0] != FEC_REPORT)
+        return -1;
+
+    return (packet[FEC_HEADER_LEN] << 8) | packet[FEC_HEADER_LEN + 1];
+}
+
+void fec_decoder_init(FecDecoder *dec)
+{
+    memset(dec, 0, sizeof(*dec));
+}
+
+/*
+ * Counts what the path lost of a group the receiver is done with, before
+ * recovery, towards the next report.
+ */
+static void fec_group_close(FecDecoder *dec, FecGroup *g)
+{
+    int size;
+    int lost;
+
+    if (!g->active)
+        return;
+
+    // Without its parity, a group is taken to end at the last packet in.
+    size = g->size ? g->size : g->highest;
+
+    lost = size - g->data;
+    dec->total_lost += (uint64_t)lost;
+
+    if (!(g->received & FEC_PARITY_BIT))
+        lost++;
+
+    dec->expected += size + 1;
+    dec->lost += lost;
+    g->active = 0;
+}
+
+int fec_decode(FecDecoder *dec, const uint8_t *packet, size_t len,
+               uint8_t *out, size_t *out_len)
+{
+    FecGroup *g;
+    const uint8_t *data;
+    uint8_t type, index, count, group;
+    uint16_t length_xor;
+    uint32_t bit;
+    int rc;
+
+    if (len < FEC_HEADER_LEN)
+        return -1;
+
+    type = packet[0];
+    index = packet[1];
+    count = packet[2];
+    group = packet[3];
+
+    data = packet + FEC_HEADER_LEN;
+    len -= FEC_HEADER_LEN;
+
+    if (type == FEC_DATA) {
+        if (count > FEC_GROUP_MAX || (count && index >= count))
+            return -1;
+
+        // Packets too long to protect come in a group of size 0.
+        if (!count || len > FEC_PAYLOAD_MAX)
+            return FEC_DELIVER;
+
+        length_xor = (uint16_t)len;
+        bit = 1U << index;
+        rc = FEC_DELIVER;
+    } else if (type == FEC_PARITY) {
+        if (!count || count > FEC_GROUP_MAX || index != count ||
+                len < FEC_LENGTH_LEN || len > FEC_LENGTH_LEN + FEC_PAYLOAD_MAX)
+            return -1;
+
+        length_xor = (uint16_t)((data[0] << 8) | data[1]);
+        data += FEC_LENGTH_LEN;
+        len -= FEC_LENGTH_LEN;
+        bit = FEC_PARITY_BIT;
+        rc = 0;
+    } else {
+        return -1;
+    }
+
+    g = &dec->groups[group % FEC_WINDOW];
+
+    if (!g->active || g->group != group) {
+        // Behind the window, too late to tell from a duplicate.
+        if (g->active && (int8_t)(group - g->group) < 0)
+            return 0;
+
+        fec_group_close(dec, g);
+        memset(g, 0, offsetof(FecGroup, buf));
+        g->active = 1;
+        g->group = group;
+    }
+
+    // A duplicate, or a packet recovered before it came in.
+    if (g->received & bit)
+        return 0;
+
+    if (type == FEC_DATA) {
+        // Not the group the rest was sent in, pass it on but leave it out.
+        if ((g->count && g->count != count) || (g->size && index >= g->size))
+            return rc;
+
+        g->count = count;
+        if (index >= g->highest)
+            g->highest = index + 1;
+        g->data++;
+    } else {
+        if ((g->count && count > g->count) || g->highest > count)
+            return rc;
+
+        g->size = count;
+    }
+
+    g->received |= bit;
+    g->length_xor ^= length_xor;
+    fec_xor(g->buf, &g->len, data, len);
+
+    if (!g->size || g->data != g->size - 1 || g->recovered)
+        return rc;
+
+    g->recovered = 1;
+
+    // The length XOR is off, the group was corrupted on the way.
+    if (g->length_xor > g->len)
+        return rc;
+
+    // The missing packet is as good as received from now on.
+    g->received |= (1U << g->size) - 1;
+    memcpy(out, g->buf, g->length_xor);
+    *out_len = g->length_xor;
+    dec->total_recovered++;
+
+    return rc | FEC_RECOVERED;
+}
+
+int fec_decoder_loss(FecDecoder *dec)
+{
+    int loss;
+
+    if (dec->expected < FEC_REPORT_PACKETS)
+        return -1;
+
+    loss = (int)((uint64_t)dec->lost * 1000 / dec->expected);
+    dec->expected = 0;
+    dec->lost = 0;
+
+    return loss;
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __FEC_CODEC_H__
+#define __FEC_CODEC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "ela_session.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Packets are protected in groups: after the last packet of a group the
+ * sender adds a parity packet, the XOR of the group's packets padded to
+ * the longest one, together with the XOR of their lengths. The receiver
+ * XORs every packet of a group it gets, parity included, into one buffer,
+ * so once the parity and all but one packet are in, the buffer holds the
+ * missing packet, whatever order they arrived in.
+ *
+ * The receiver reports the loss it sees now and then, and the sender
+ * sizes its groups by it: longer groups cost less parity, but are more
+ * likely to lose two packets, which one parity can't recover. A group
+ * the sender closes early, because it has nothing more to send for now,
+ * is as long as its parity says.
+ *
+ * Every packet starts with a header of its type, index in the group, the
+ * group size and the group number. Parity packets carry the group size
+ * they close in both index and size, and go on with the length XOR,
+ * reports with the loss rate in per mille.
+ */
+#define FEC_DATA                0
+#define FEC_PARITY              1
+#define FEC_REPORT              2
+
+#define FEC_HEADER_LEN          4
+#define FEC_LENGTH_LEN          2
+
+/* Longest packet protected, with room for the headers of the handlers
+ * above. Longer ones go out on their own, in a group of size 0. */
+#define FEC_PAYLOAD_MAX         (ELA_MAX_USER_DATA_LEN + 32)
+
+#define FEC_PARITY_MAX_LEN      (FEC_HEADER_LEN + FEC_LENGTH_LEN + \
+                                 FEC_PAYLOAD_MAX)
+#define FEC_REPORT_LEN          (FEC_HEADER_LEN + 2)
+
+#define FEC_GROUP_MIN           2
+#define FEC_GROUP_MAX           16
+
+/* Loss assumed until the peer reports, in per mille */
+#define FEC_LOSS_DEFAULT        25
+
+/* Groups the receiver collects at a time */
+#define FEC_WINDOW              8
+
+/* Packets expected, parity included, between loss reports */
+#define FEC_REPORT_PACKETS      64
+
+typedef struct FecEncoder {
+    int loss;
+    uint8_t group;
+    int count;
+    int index;
+    uint16_t length_xor;
+    size_t len;
+    uint8_t parity[FEC_PAYLOAD_MAX];
+} FecEncoder;
+
+typedef struct FecGroup {
+    int active;
+    uint8_t group;
+    int count;              /* size the data packets were sent with */
+    int size;               /* size the parity closed the group with */
+    int highest;            /* highest data index received, plus one */
+    uint32_t received;      /* a bit per data index, and the parity bit */
+    int data;
+    int recovered;
+    uint16_t length_xor;
+    size_t len;             /* bytes beyond len are taken as zeroes */
+    uint8_t buf[FEC_PAYLOAD_MAX];
+} FecGroup;
+
+typedef struct FecDecoder {
+    FecGroup groups[FEC_WINDOW];
+    uint32_t expected;      /* since the last report, parity included */
+    uint32_t lost;
+    uint64_t total_lost;    /* data packets, before recovery */
+    uint64_t total_recovered;
+} FecDecoder;
+
+/* What fec_decode() asks of the caller */
+#define FEC_DELIVER             0x01
+#define FEC_RECOVERED           0x02
+
+void fec_encoder_init(FecEncoder *enc);
+
+/*
+ * The group size the encoder opens its next group with.
+ */
+int fec_encoder_group_size(FecEncoder *enc);
+
+/*
+ * Adds a data packet to the open group, opening one if none is, and fills
+ * in its header at hdr. Packets longer than FEC_PAYLOAD_MAX go out
+ * unprotected. Returns true when the packet fills the group, which is
+ * then to be closed with fec_encode_parity().
+ */
+bool fec_encode(FecEncoder *enc, const uint8_t *data, size_t len,
+                uint8_t *hdr);
+
+/*
+ * Closes the open group, full or not, into a parity packet at out, which
+ * has room for FEC_PARITY_MAX_LEN bytes. Returns the packet length, or 0
+ * if no group is open.
+ */
+size_t fec_encode_parity(FecEncoder *enc, uint8_t *out);
+
+/*
+ * Takes a loss report of the peer into the group size.
+ */
+void fec_encoder_on_report(FecEncoder *enc, int loss);
+
+/*
+ * Writes a report of loss, in per mille, to out, which has room for
+ * FEC_REPORT_LEN bytes. Returns the packet length.
+ */
+size_t fec_encode_report(int loss, uint8_t *out);
+
+/*
+ * Returns the loss a report packet carries, or -1 if the packet is not
+ * a report.
+ */
+int fec_decode_report(const uint8_t *packet, size_t len);
+
+void fec_decoder_init(FecDecoder *dec);
+
+/*
+ * Adds a received data or parity packet to its group. Returns -1 if the
+ * packet is malformed, otherwise FEC_DELIVER if it is data to pass on,
+ * the payload starting FEC_HEADER_LEN bytes in, and FEC_RECOVERED if it
+ * completes a group, with the missing packet copied to out, which has
+ * room for FEC_PAYLOAD_MAX bytes, and its length in out_len.
+ *
+ * Duplicates, and packets that come in after being recovered, are not
+ * delivered. Neither are packets of groups already behind the window,
+ * which can't be told from duplicates any more.
+ */
+int fec_decode(FecDecoder *dec, const uint8_t *packet, size_t len,
+               uint8_t *out, size_t *out_len);
+
+/*
+ * Returns the loss seen since the last report in per mille, once enough
+ * packets were expected to report it, otherwise -1.
+ */
+int fec_decoder_loss(FecDecoder *dec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FEC_CODEC_H__ */
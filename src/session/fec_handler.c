@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <crystal.h>
+
+#include "flex_buffer.h"
+#include "session.h"
+#include "stream_handler.h"
+#include "fec_codec.h"
+
+/*
+ * Packets are passed on as they arrive, a recovered one follows the rest
+ * of its group. A group the writer leaves open for a whole flush interval
+ * is closed short, so the last packets of a burst are not left without
+ * parity until the next one.
+ */
+#define FEC_FLUSH_INTERVAL      20      /* ms */
+
+typedef struct FecHandler {
+    StreamHandler base;
+
+    pthread_mutex_t lock;
+
+    FecEncoder encoder;
+    int tx_idle;            /* nothing written since the last flush check */
+    Timer *timer;
+
+    FecDecoder decoder;
+
+    ElaStreamFecStats stats;
+} FecHandler;
+
+static
+ssize_t fec_handler_write(StreamHandler *base, FlexBuffer *buf)
+{
+    FecHandler *handler = (FecHandler *)base;
+    size_t len = flex_buffer_size(buf);
+    FlexBuffer *parity = NULL;
+    uint8_t *hdr;
+    ssize_t written;
+
+    assert(base->next);
+
+    flex_buffer_backward_offset(buf, FEC_HEADER_LEN);
+    hdr = (uint8_t *)flex_buffer_mutable_ptr(buf);
+
+    pthread_mutex_lock(&handler->lock);
+
+    if (fec_encode(&handler->encoder, hdr + FEC_HEADER_LEN, len, hdr)) {
+        flex_buffer_alloca(parity, FLEX_BUFFER_MAX_LEN, FLEX_PADDING_LEN);
+        flex_buffer_set_size(parity, fec_encode_parity(&handler->encoder,
+                                 (uint8_t *)flex_buffer_mutable_ptr(parity)));
+        handler->stats.tx_parity++;
+    }
+
+    handler->tx_idle = 0;
+    handler->stats.tx_packets++;
+    handler->stats.group_size =
+            (uint32_t)fec_encoder_group_size(&handler->encoder);
+
+    pthread_mutex_unlock(&handler->lock);
+
+    written = base->next->write(base->next, buf);
+
+    // A lost parity packet only costs the group its protection.
+    if (parity)
+        base->next->write(base->next, parity);
+
+    return written == (ssize_t)flex_buffer_size(buf) ? (ssize_t)len : written;
+}
+
+static bool fec_handler_flush(void *user_data)
+{
+    FecHandler *handler = (FecHandler *)user_data;
+    StreamHandler *base = &handler->base;
+    FlexBuffer *parity;
+    size_t len = 0;
+
+    flex_buffer_alloca(parity, FLEX_BUFFER_MAX_LEN, FLEX_PADDING_LEN);
+
+    pthread_mutex_lock(&handler->lock);
+
+    if (handler->tx_idle) {
+        len = fec_encode_parity(&handler->encoder,
+                                (uint8_t *)flex_buffer_mutable_ptr(parity));
+        if (len)
+            handler->stats.tx_parity++;
+    }
+    handler->tx_idle = 1;
+
+    pthread_mutex_unlock(&handler->lock);
+
+    if (len) {
+        flex_buffer_set_size(parity, len);
+        base->next->write(base->next, parity);
+    }
+
+    return true;
+}
+
+static void fec_handler_destroy_timer(FecHandler *handler)
+{
+    TransportWorker *wk;
+
+    if (!handler->timer)
+        return;
+
+    wk = stream_get_worker(handler->base.stream);
+    assert(wk);
+
+    wk->destroy_timer(wk, handler->timer);
+    handler->timer = NULL;
+}
+
+static int fec_handler_start(StreamHandler *base)
+{
+    FecHandler *handler = (FecHandler *)base;
+    TransportWorker *wk;
+    int rc;
+
+    assert(base->next);
+
+    rc = base->next->start(base->next);
+    if (rc != 0)
+        return rc;
+
+    wk = stream_get_worker(base->stream);
+    assert(wk);
+
+    rc = wk->create_timer(wk, base->stream->id | 0x00120000,
+                          FEC_FLUSH_INTERVAL, fec_handler_flush, handler,
+                          &handler->timer);
+    if (rc < 0) {
+        vlogE("Stream: %d FEC handler start error.", base->stream->id);
+        return rc;
+    }
+
+    return 0;
+}
+
+static void fec_handler_stop(StreamHandler *base, int error)
+{
+    FecHandler *handler = (FecHandler *)base;
+
+    assert(base->next);
+
+    fec_handler_destroy_timer(handler);
+
+    base->next->stop(base->next, error);
+}
+
+static void fec_send_report(FecHandler *handler, int loss)
+{
+    StreamHandler *base = &handler->base;
+    FlexBuffer *report;
+
+    flex_buffer_alloca(report, FLEX_BUFFER_MAX_LEN, FLEX_PADDING_LEN);
+    flex_buffer_set_size(report, fec_encode_report(loss,
+                             (uint8_t *)flex_buffer_mutable_ptr(report)));
+
+    base->next->write(base->next, report);
+}
+
+static
+void fec_handler_on_rx_data(StreamHandler *base, FlexBuffer *buf)
+{
+    FecHandler *handler = (FecHandler *)base;
+    ElaStream *s = base->stream;
+    const uint8_t *packet = (const uint8_t *)flex_buffer_ptr(buf);
+    size_t len = flex_buffer_size(buf);
+    FlexBuffer *recovered;
+    size_t recovered_len = 0;
+    uint8_t group;
+    int report;
+    int rc;
+
+    assert(base->prev);
+
+    report = fec_decode_report(packet, len);
+    if (report >= 0) {
+        pthread_mutex_lock(&handler->lock);
+        fec_encoder_on_report(&handler->encoder, report);
+        handler->stats.loss = (uint32_t)handler->encoder.loss;
+        handler->stats.group_size =
+                (uint32_t)fec_encoder_group_size(&handler->encoder);
+        pthread_mutex_unlock(&handler->lock);
+        return;
+    }
+
+    flex_buffer_alloca(recovered, FLEX_BUFFER_MAX_LEN, FLEX_PADDING_LEN);
+
+    pthread_mutex_lock(&handler->lock);
+
+    rc = fec_decode(&handler->decoder, packet, len,
+                    (uint8_t *)flex_buffer_mutable_ptr(recovered),
+                    &recovered_len);
+    if (rc >= 0 && packet[0] == FEC_DATA)
+        handler->stats.rx_packets++;
+    handler->stats.rx_lost = handler->decoder.total_lost;
+    handler->stats.rx_recovered = handler->decoder.total_recovered;
+
+    report = fec_decoder_loss(&handler->decoder);
+
+    pthread_mutex_unlock(&handler->lock);
+
+    if (rc < 0) {
+        vlogE("Stream: %d FEC handler got malformed data.", s->id);
+        return;
+    }
+
+    if (report >= 0)
+        fec_send_report(handler, report);
+
+    group = packet[3];
+
+    if (rc & FEC_DELIVER) {
+        flex_buffer_forward_offset(buf, FEC_HEADER_LEN);
+        base->prev->on_data(base->prev, buf);
+    }
+
+    if (rc & FEC_RECOVERED) {
+        flex_buffer_set_size(recovered, recovered_len);
+        vlogT("Stream: %d FEC handler recovered %zu bytes of group %d.",
+              s->id, recovered_len, group);
+        base->prev->on_data(base->prev, recovered);
+    }
+}
+
+void fec_handler_get_stats(StreamHandler *base, ElaStreamFecStats *stats)
+{
+    FecHandler *handler = (FecHandler *)base;
+
+    pthread_mutex_lock(&handler->lock);
+    *stats = handler->stats;
+    pthread_mutex_unlock(&handler->lock);
+}
+
+static void fec_handler_destroy(void *p)
+{
+    FecHandler *handler = (FecHandler *)p;
+    ElaStreamFecStats *stats = &handler->stats;
+
+    vlogD("Stream: %d FEC handler destroyed, sent %llu packets with %llu "
+          "parity, received %llu packets, %llu lost and %llu recovered.",
+          handler->base.stream->id,
+          (unsigned long long)stats->tx_packets,
+          (unsigned long long)stats->tx_parity,
+          (unsigned long long)stats->rx_packets,
+          (unsigned long long)stats->rx_lost,
+          (unsigned long long)stats->rx_recovered);
+
+    fec_handler_destroy_timer(handler);
+
+    pthread_mutex_destroy(&handler->lock);
+
+    if (handler->base.next)
+        deref(handler->base.next);
+}
+
+int fec_handler_create(ElaStream *s, StreamHandler **handler)
+{
+    FecHandler *_handler;
+
+    _handler = (FecHandler *)rc_zalloc(sizeof(FecHandler),
+                                       fec_handler_destroy);
+    if (!_handler)
+        return ELA_GENERAL_ERROR(ELAERR_OUT_OF_MEMORY);
+
+    pthread_mutex_init(&_handler->lock, NULL);
+
+    fec_encoder_init(&_handler->encoder);
+    fec_decoder_init(&_handler->decoder);
+
+    _handler->stats.loss = (uint32_t)_handler->encoder.loss;
+    _handler->stats.group_size =
+            (uint32_t)fec_encoder_group_size(&_handler->encoder);
+
+    _handler->base.name = "FEC Handler";
+    _handler->base.stream = s;
+
+    _handler->base.init    = default_handler_init;
+    _handler->base.prepare = default_handler_prepare;
+    _handler->base.start   = fec_handler_start;
+    _handler->base.stop    = fec_handler_stop;
+    _handler->base.write   = fec_handler_write;
+    _handler->base.on_data = fec_handler_on_rx_data;
+    _handler->base.on_state_changed = default_handler_on_state_changed;
+
+    vlogD("Stream: %d FEC handler created.", s->id);
+
+    *handler = (StreamHandler *)_handler;
+    return 0;
+}
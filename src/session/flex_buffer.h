@@ -80,6 +80,7 @@ typedef struct FlexBuffer {
     size_t offset;      /* First available byte is buffer + offset */
     size_t size;        /* Data length, the last data byte is buffer + offset + size - 1 */
     char *buffer;
+    void *owner;        /* Pooled buffer holding this one, NULL if not pooled */
 } FlexBuffer;
 
 #define flex_buffer_alloca(__buf, __capacity, __offset) \
@@ -89,6 +90,7 @@ typedef struct FlexBuffer {
         __buf->offset = (__offset); \
         __buf->size = 0; \
         __buf->buffer = (char *)(__buf + 1); \
+        __buf->owner = NULL; \
     } while (0)
 
 #define flex_buffer_from(__buf, __offset, __src, __len) \
@@ -99,6 +101,7 @@ typedef struct FlexBuffer {
         __buf->offset = (__offset); \
         __buf->size = (__len); \
         __buf->buffer = (char *)(__buf + 1); \
+        __buf->owner = NULL; \
         memcpy(__buf->buffer + (__offset), (__src), (__len)); \
     } while (0)
 
@@ -110,6 +113,7 @@ FlexBuffer *flex_buffer_init(FlexBuffer *buf, const void *buffer,
     buf->offset = offset;
     buf->size = 0;
     buf->buffer = (char *)buffer;
+    buf->owner = NULL;
 
     return buf;
 }
@@ -59,9 +59,15 @@
 #include "ela_session.h"
 #include "ice.h"
 #include "session.h"
+#include "stream_handler.h"
+#include "sdp_compact.h"
 
 #define DEFAULT_KEEPALIVE_INTERVAL      30000 /* 30 seconds */
 #define DEFAULT_TIMEOUT_INTERVAL        120000 /* 120 seconds */
+#define DEFAULT_TRICKLE_TIMEOUT         5000  /* 5 seconds */
+
+/* Higher than any candidate priority pjnath computes with its type prefs */
+#define RESUME_CAND_PRIO                ((127u << 24) | (65535u << 8) | 255u)
 
 #define KA_INTERVAL         25
 
@@ -440,9 +446,57 @@ static void ice_worker_destroy(void *p)
 
     pj_caching_pool_destroy(&worker->cp);
 
+    worker_base_destroy(&worker->base);
+
     vlogD("Session: ICE worker %d destroyed", worker->base.id);
 }
 
+static int pairs_key_compare(const void *key1, size_t len1,
+                             const void *key2, size_t len2)
+{
+    return strcmp(key1, key2);
+}
+
+static void ice_transport_save_pair(IceTransport *transport, const char *friendid,
+                                    const pj_ice_sess_check *check)
+{
+    IcePair *pair;
+
+    // Relayed addresses are allocated per session, not worth to cache.
+    if (check->lcand->type == PJ_ICE_CAND_TYPE_RELAYED ||
+        check->rcand->type == PJ_ICE_CAND_TYPE_RELAYED) {
+        deref(hashtable_remove(transport->pairs, (void *)friendid, strlen(friendid)));
+        return;
+    }
+
+    pair = (IcePair *)rc_zalloc(sizeof(IcePair), NULL);
+    if (!pair)
+        return;
+
+    pj_sockaddr_cp(&pair->local_base, &check->lcand->base_addr);
+    pj_sockaddr_cp(&pair->remote_addr, &check->rcand->addr);
+    pair->remote_type = check->rcand->type;
+    strncpy(pair->friendid, friendid, sizeof(pair->friendid) - 1);
+
+    pair->he.data = pair;
+    pair->he.key = pair->friendid;
+    pair->he.keylen = strlen(pair->friendid);
+
+    hashtable_put(transport->pairs, &pair->he);
+    deref(pair);
+}
+
+static IcePair *ice_transport_get_pair(IceTransport *transport, const char *friendid)
+{
+    return (IcePair *)hashtable_get(transport->pairs, (void *)friendid,
+                                    strlen(friendid));
+}
+
+static void ice_transport_forget_pair(IceTransport *transport, const char *friendid)
+{
+    deref(hashtable_remove(transport->pairs, (void *)friendid, strlen(friendid)));
+}
+
 static int ice_transport_init(IceTransport *transport)
 {
     pj_status_t status;
@@ -454,6 +508,10 @@ static int ice_transport_init(IceTransport *transport)
     if (rc != 0)
         return ELA_GENERAL_ERROR(ELAERR_OUT_OF_MEMORY);
 
+    transport->pairs = hashtable_create(8, 1, NULL, pairs_key_compare);
+    if (!transport->pairs)
+        return ELA_GENERAL_ERROR(ELAERR_OUT_OF_MEMORY);
+
     pj_log_set_level(0);
     pj_log_set_log_func(ice_log_print);
 
@@ -489,6 +547,9 @@ static void ice_transport_destroy(void *p)
 
     transport_base_destroy(p);
 
+    if (transport->pairs)
+        deref(transport->pairs);
+
     pj_shutdown();
 
     pthread_key_delete(transport->pj_thread_ctx);
@@ -708,10 +769,15 @@ static void notify_state_changed(StreamHandler *handler, int state)
 
 }
 
+static void ice_handler_trickle_gathered(IceHandler *handler);
+static int ice_handler_resume_failed(IceHandler *handler);
+
 static void stream_on_ice_complete(pj_ice_strans *ice_st, pj_ice_strans_op op,
                                    pj_status_t status)
 {
     IceStream *stream;
+    IceHandler *handler;
+    ElaSession *ws;
     int state;
 
     pj_grp_lock_t *lock = pj_ice_strans_get_grp_lock(ice_st);
@@ -724,16 +790,46 @@ static void stream_on_ice_complete(pj_ice_strans *ice_st, pj_ice_strans_op op,
         return;
     }
 
+    handler = (IceHandler *)stream->handler;
+    ws = stream_get_session(&stream->base);
+
     if (op == PJ_ICE_STRANS_OP_INIT) {
-        if (status == PJ_SUCCESS) {
+        handler->trickle.gathered = 1;
+        session_timing_mark(ws, &ws->timing.gathered);
+
+        if (status == PJ_SUCCESS && handler->trickle.early) {
+            // Initialized state was reported with host candidates already.
+            vlogD("Stream: %d ICE candidates gathering completed.",
+                  stream->base.id);
+            ice_handler_trickle_gathered(handler);
+            pj_grp_lock_release(lock);
+            return;
+        } else if (status == PJ_SUCCESS) {
             state = ElaStreamState_initialized;
         } else {
             vlogE("Session: Stream initialization error (0x%x)", ELA_ICE_ERROR(status));
+            // The cached TURN credentials may be rejected, acquire new ones
+            // for next session.
+            session_reset_turn_server(stream_get_session(&stream->base));
             state = ElaStreamState_failed;
         }
     } else if (op == PJ_ICE_STRANS_OP_NEGOTIATION) {
         if (status == PJ_SUCCESS) {
+            IceSession *session = (IceSession *)stream_get_session(&stream->base);
+            const pj_ice_sess_check *check;
+
+            check = pj_ice_strans_get_valid_pair(ice_st, 1);
+            if (check)
+                ice_transport_save_pair((IceTransport *)stream_get_transport(&stream->base),
+                                        session->base.to, check);
+
+            handler->resume.active = 0;
+            session_timing_mark(&session->base, &session->base.timing.nominated);
             state = ElaStreamState_connected;
+        } else if (handler->resume.active && !handler->stopping &&
+                   ice_handler_resume_failed(handler) == 0) {
+            pj_grp_lock_release(lock);
+            return;
         } else {
             vlogE("Session: Stream negotiation error (0x%x)", ELA_ICE_ERROR(status));
             state = ElaStreamState_failed;
@@ -743,7 +839,7 @@ static void stream_on_ice_complete(pj_ice_strans *ice_st, pj_ice_strans_op op,
         return;
     }
 
-    notify_state_changed(stream->handler, state);
+    notify_state_changed(&handler->base, state);
     pj_grp_lock_release(lock);
 }
 
@@ -810,16 +906,35 @@ static void stream_on_rx_data(pj_ice_strans *ice_st, unsigned comp, void *data,
         gettimeofday(&stream->remote_timestamp, NULL);
     } else {
         // Copy to user data to FlexBuffer with 128 bytes prefixed space
+        ElaStreamBuffer *pbuf = NULL;
         FlexBuffer *buf;
 
-        flex_buffer_from(buf, FLEX_PADDING_LEN,
-                        (const void *)packet->data, (size_t)packet->len);
+        // Datagrams are decrypted in place and go to the application as
+        // they are, so receive them into a buffer it can retain.
+        if (!stream_is_reliable(&stream->base) &&
+                stream_wants_rx_buffers(&stream->base) &&
+                (size_t)packet->len + FLEX_PADDING_LEN <= FLEX_BUFFER_MAX_LEN)
+            pbuf = buffer_pool_get(stream_get_buffer_pool(&stream->base),
+                                   FLEX_PADDING_LEN);
+
+        if (pbuf) {
+            buf = &pbuf->flex;
+            memcpy(flex_buffer_mutable_ptr(buf), packet->data, packet->len);
+            flex_buffer_set_size(buf, packet->len);
+        } else {
+            flex_buffer_from(buf, FLEX_PADDING_LEN,
+                            (const void *)packet->data, (size_t)packet->len);
+        }
+
         vlogT("Stream: %d ICE component %d received %d bytes data from %s.",
               stream->base.id, comp, (int)size,
               pj_sockaddr_print(src_addr, addr, sizeof(addr), 3));
 
         gettimeofday(&stream->remote_timestamp, NULL);
         stream->handler->on_data(stream->handler, buf);
+
+        if (pbuf)
+            buffer_release(pbuf);
     }
 
     pj_grp_lock_release(lock);
@@ -837,6 +952,9 @@ static void ice_handler_destroy(void *p)
     if (stream->keepalive_timer)
         ice_worker_destroy_timer(session->base.worker, stream->keepalive_timer);
 
+    if (handler->trickle.timer)
+        ice_worker_destroy_timer(session->base.worker, handler->trickle.timer);
+
     if (handler->st) {
         if (pj_ice_strans_has_sess(handler->st))
             pj_ice_strans_stop_ice(handler->st);
@@ -855,9 +973,12 @@ static int ice_handler_init(StreamHandler *base)
     IceTransport *transport = (IceTransport *)stream_get_transport(base->stream);
     pj_ice_strans_cb cbs;
     pj_status_t status;
+    pj_grp_lock_t *lock;
 
     prepare_thread_context(transport);
 
+    handler->trickle.enabled = session->base.trickle.enabled;
+
     cbs.on_ice_complete = stream_on_ice_complete;
     cbs.on_rx_data = stream_on_rx_data;
 
@@ -874,6 +995,16 @@ static int ice_handler_init(StreamHandler *base)
         return ELA_ICE_ERROR(status);
     }
 
+    // Host candidates are available right after creation, report the
+    // stream initialized without waiting for srflx/relay candidates.
+    lock = pj_ice_strans_get_grp_lock(handler->st);
+    pj_grp_lock_acquire(lock);
+    if (handler->trickle.enabled && !handler->trickle.gathered) {
+        handler->trickle.early = 1;
+        notify_state_changed(base, ElaStreamState_initialized);
+    }
+    pj_grp_lock_release(lock);
+
     vlogD("Stream: %d ICE handler initialized.", base->stream->id);
 
     return 0;
@@ -965,15 +1096,229 @@ static int ice_handler_prepare(StreamHandler *base)
     return status == PJ_SUCCESS ? 0 : ELA_ICE_ERROR(status);
 }
 
+static int ice_handler_start_checks(IceHandler *handler)
+{
+    IceStream *stream = (IceStream *)handler->base.stream;
+    ElaSession *ws = stream_get_session(&stream->base);
+    pj_status_t status;
+    pj_str_t rufrag;
+    pj_str_t rpwd;
+
+    handler->trickle.pending = 0;
+    handler->trickle.started = 1;
+
+    session_timing_mark_once(ws, &ws->timing.checking);
+
+    status = pj_ice_strans_start_ice(handler->st,
+                                     pj_cstr(&rufrag, handler->remote.ufrag),
+                                     pj_cstr(&rpwd, handler->remote.pwd),
+                                     handler->remote.cand_cnt, handler->remote.cand);
+    if (status == PJ_SUCCESS) {
+        vlogD("Stream: %d ICE handler starting negotiation...", stream->base.id);
+    } else {
+        notify_state_changed(&handler->base, ElaStreamState_failed);
+
+        vlogE("Stream: %d ICE handler negotiation failed: %s.",
+              stream->base.id, ice_strerror(status));
+    }
+
+    return (status == PJ_SUCCESS ? 0 : ELA_ICE_ERROR(status));
+}
+
+static bool ice_stream_trickle_callback(void *user_data)
+{
+    IceStream *stream = (IceStream *)user_data;
+    IceHandler *handler = (IceHandler *)stream->handler;
+    pj_grp_lock_t *lock;
+
+    lock = pj_ice_strans_get_grp_lock(handler->st);
+    pj_grp_lock_acquire(lock);
+
+    if (handler->trickle.pending && !handler->stopping) {
+        vlogW("Stream: %d ICE trickle candidates timeout, start negotiation "
+              "with %u remote candidates.", stream->base.id,
+              handler->remote.cand_cnt);
+        ice_handler_start_checks(handler);
+    }
+
+    pj_grp_lock_release(lock);
+    return false;
+}
+
+static int ice_handler_defer_checks(IceHandler *handler)
+{
+    IceStream *stream = (IceStream *)handler->base.stream;
+    IceSession *session = (IceSession *)stream_get_session(&stream->base);
+    int rc;
+
+    // The check list can not be extended once negotiation started,
+    // so wait for the rest of local and remote candidates.
+    if (!handler->trickle.timer) {
+        rc = ice_worker_create_timer(session->base.worker,
+                                     stream->base.id | 0x00020000,
+                                     DEFAULT_TRICKLE_TIMEOUT,
+                                     ice_stream_trickle_callback,
+                                     stream, &handler->trickle.timer);
+        if (rc != 0) {
+            vlogW("Stream: %d ICE handler create trickle timer error: %08X.",
+                  stream->base.id, rc);
+            return rc;
+        }
+    } else {
+        ice_worker_schedule_timer(session->base.worker, handler->trickle.timer,
+                (unsigned long)(get_monotonic_time() / 1000) + DEFAULT_TRICKLE_TIMEOUT);
+    }
+
+    handler->trickle.pending = 1;
+
+    vlogD("Stream: %d ICE handler waiting for trickle candidates.",
+          stream->base.id);
+    return 0;
+}
+
+/*
+ * Give the remote candidate of the last nominated pair with the same friend
+ * the highest priority, so it is checked first. Returns non-zero if the
+ * cached pair is still usable.
+ */
+static int ice_handler_resume(IceHandler *handler)
+{
+    IceStream *stream = (IceStream *)handler->base.stream;
+    IceSession *session = (IceSession *)stream_get_session(&stream->base);
+    IceTransport *transport = (IceTransport *)stream_get_transport(&stream->base);
+    pj_ice_sess_cand cand[PJ_ICE_ST_MAX_CAND];
+    unsigned cand_cnt = PJ_ARRAY_SIZE(cand);
+    pj_ice_sess_cand *rcand;
+    IcePair *pair;
+    unsigned i;
+
+    pair = ice_transport_get_pair(transport, session->base.to);
+    if (!pair)
+        return 0;
+
+    // The local network changed since last time.
+    if (pj_ice_strans_enum_cands(handler->st, 1, &cand_cnt, cand) != PJ_SUCCESS)
+        cand_cnt = 0;
+
+    for (i = 0; i < cand_cnt; i++) {
+        if (cand[i].type == PJ_ICE_CAND_TYPE_HOST &&
+            pj_sockaddr_cmp(&cand[i].addr, &pair->local_base) == 0)
+            break;
+    }
+
+    if (i == cand_cnt) {
+        vlogD("Stream: %d ICE cached candidate pair is stale.", stream->base.id);
+        ice_transport_forget_pair(transport, session->base.to);
+        deref(pair);
+        return 0;
+    }
+
+    for (i = 0; i < handler->remote.cand_cnt; i++) {
+        if (handler->remote.cand[i].comp_id == 1 &&
+            pj_sockaddr_cmp(&handler->remote.cand[i].addr, &pair->remote_addr) == 0)
+            break;
+    }
+
+    if (i == handler->remote.cand_cnt) {
+        // Not signaled (yet), the peer may trickle it later.
+        if (i >= PJ_ICE_ST_MAX_CAND) {
+            deref(pair);
+            return 0;
+        }
+
+        rcand = &handler->remote.cand[i];
+        memset(rcand, 0, sizeof(*rcand));
+
+        strcpy(handler->remote.foundation[i], "resume");
+        rcand->foundation = pj_str(handler->remote.foundation[i]);
+        rcand->comp_id = 1;
+        rcand->type = pair->remote_type;
+        pj_sockaddr_cp(&rcand->addr, &pair->remote_addr);
+        pj_sockaddr_cp(&rcand->rel_addr, &pair->remote_addr);
+
+        handler->remote.cand_cnt++;
+        handler->resume.injected = 1;
+    } else {
+        rcand = &handler->remote.cand[i];
+        handler->resume.injected = 0;
+    }
+
+    handler->resume.index = (int)i;
+    handler->resume.prio = rcand->prio;
+    rcand->prio = RESUME_CAND_PRIO;
+
+    deref(pair);
+
+    vlogD("Stream: %d ICE candidate %u of last nominated pair preferred.",
+          stream->base.id, i);
+    return 1;
+}
+
+/*
+ * Called with ICE group lock held when the negotiation started with cached
+ * pair failed, rerun the full ICE with all gathered and trickled candidates.
+ */
+static int ice_handler_resume_failed(IceHandler *handler)
+{
+    IceStream *stream = (IceStream *)handler->base.stream;
+    IceSession *session = (IceSession *)stream_get_session(&stream->base);
+    IceTransport *transport = (IceTransport *)stream_get_transport(&stream->base);
+    pj_status_t status;
+    pj_str_t ufrag;
+    pj_str_t pwd;
+    int i;
+
+    handler->resume.active = 0;
+
+    ice_transport_forget_pair(transport, session->base.to);
+
+    if (handler->resume.injected) {
+        for (i = handler->resume.index; i < (int)handler->remote.cand_cnt - 1; i++) {
+            handler->remote.cand[i] = handler->remote.cand[i + 1];
+            strcpy(handler->remote.foundation[i], handler->remote.foundation[i + 1]);
+            handler->remote.cand[i].foundation = pj_str(handler->remote.foundation[i]);
+        }
+        handler->remote.cand_cnt--;
+    } else {
+        handler->remote.cand[handler->resume.index].prio = handler->resume.prio;
+    }
+
+    if (handler->remote.cand_cnt == 0)
+        return ELA_GENERAL_ERROR(ELAERR_WRONG_STATE);
+
+    pj_ice_strans_stop_ice(handler->st);
+
+    ufrag = pj_str(session->ufrag);
+    pwd = pj_str(session->pwd);
+
+    status = pj_ice_strans_init_ice(handler->st, session->role, &ufrag, &pwd);
+    if (status != PJ_SUCCESS) {
+        vlogE("Stream: %d ICE handler reinit error: %s.", stream->base.id,
+              ice_strerror(status));
+        return ELA_ICE_ERROR(status);
+    }
+
+    handler->trickle.started = 0;
+
+    vlogD("Stream: %d ICE cached candidate pair failed, fall back to full "
+          "negotiation.", stream->base.id);
+
+    if (!handler->trickle.gathered || !handler->trickle.remote_done) {
+        if (ice_handler_defer_checks(handler) == 0)
+            return 0;
+    }
+
+    return ice_handler_start_checks(handler);
+}
+
 static int ice_handler_start(StreamHandler *base)
 {
     IceHandler *handler = (IceHandler *)base;
     IceStream *stream = (IceStream *)base->stream;
     IceSession *session = (IceSession *)stream_get_session(base->stream);
     IceTransport *transport = (IceTransport *)stream_get_transport(base->stream);
-    pj_status_t status;
-    pj_str_t rufrag;
-    pj_str_t rpwd;
+    pj_grp_lock_t *lock;
+    int resumed;
     int rc;
 
     assert(handler->remote.cand_cnt > 0 && handler->remote.comp_cnt > 0);
@@ -1000,20 +1345,28 @@ static int ice_handler_start(StreamHandler *base)
     gettimeofday(&stream->local_timestamp, NULL);
     gettimeofday(&stream->remote_timestamp, NULL);
 
-    status = pj_ice_strans_start_ice(handler->st,
-                                     pj_cstr(&rufrag, handler->remote.ufrag),
-                                     pj_cstr(&rpwd, handler->remote.pwd),
-                                     handler->remote.cand_cnt, handler->remote.cand);
-    if (status == PJ_SUCCESS) {
-        vlogD("Stream: %d ICE handler starting negotiation...", stream->base.id);
-    } else {
-        notify_state_changed(base, ElaStreamState_failed);
+    lock = pj_ice_strans_get_grp_lock(handler->st);
+    pj_grp_lock_acquire(lock);
 
-        vlogE("Stream: %d ICE handler negotiation failed: %s.",
-              stream->base.id, ice_strerror(status));
+    resumed = ice_handler_resume(handler);
+
+    if (!handler->trickle.gathered || !handler->trickle.remote_done) {
+        if (resumed) {
+            // Probe the cached pair right now, full ICE with the trickled
+            // candidates runs only if it fails.
+            handler->resume.active = 1;
+            vlogD("Stream: %d ICE handler probing cached candidate pair.",
+                  stream->base.id);
+        } else if (ice_handler_defer_checks(handler) == 0) {
+            pj_grp_lock_release(lock);
+            return 0;
+        }
     }
 
-    return (status == PJ_SUCCESS ? 0 : ELA_ICE_ERROR(status));
+    rc = ice_handler_start_checks(handler);
+    pj_grp_lock_release(lock);
+
+    return rc;
 }
 
 static void ice_handler_stop(StreamHandler *base, int error)
@@ -1060,6 +1413,11 @@ static void ice_handler_stop(StreamHandler *base, int error)
         stream->keepalive_timer = NULL;
     }
 
+    if (handler->trickle.timer) {
+        ice_worker_destroy_timer(session->base.worker, handler->trickle.timer);
+        handler->trickle.timer = NULL;
+    }
+
     if (pj_ice_strans_has_sess(handler->st)) {
         pj_ice_strans_stop_ice(handler->st);
 
@@ -1238,6 +1596,320 @@ static void ice_stream_unlock(ElaStream *base)
     pj_grp_lock_release(lock);
 }
 
+static int format_candidate(const pj_ice_sess_cand *candidate,
+                            char *buf, size_t len)
+{
+    char str_addr[PJ_INET6_ADDRSTRLEN+1];
+    char str_rel_addr[PJ_INET6_ADDRSTRLEN+1];
+
+    if (candidate->type == PJ_ICE_CAND_TYPE_HOST) {
+        return snprintf(buf, len, "%.*s %u UDP %u %s %u typ %s",
+                        (int)candidate->foundation.slen,
+                        candidate->foundation.ptr,
+                        (unsigned)candidate->comp_id,
+                        candidate->prio,
+                        pj_sockaddr_print(&candidate->addr, str_addr, sizeof(str_addr), 0),
+                        (unsigned)pj_sockaddr_get_port(&candidate->addr),
+                        pj_ice_get_cand_type_name(candidate->type));
+    } else if ((candidate->type == PJ_ICE_CAND_TYPE_SRFLX)
+               || (candidate->type == PJ_ICE_CAND_TYPE_RELAYED)) {
+        return snprintf(buf, len, "%.*s %u UDP %u %s %u typ %s raddr %s rport %u",
+                        (int)candidate->foundation.slen,
+                        candidate->foundation.ptr,
+                        (unsigned)candidate->comp_id,
+                        candidate->prio,
+                        pj_sockaddr_print(&candidate->addr, str_addr, sizeof(str_addr), 0),
+                        (unsigned)pj_sockaddr_get_port(&candidate->addr),
+                        pj_ice_get_cand_type_name(candidate->type),
+                        pj_sockaddr_print(&candidate->rel_addr, str_rel_addr, sizeof(str_rel_addr), 0),
+                        (unsigned)pj_sockaddr_get_port(&candidate->rel_addr));
+    }
+
+    return 0;
+}
+
+static int parse_candidate(IceHandler *handler, const char *value)
+{
+    int comp_id, prio, port, rport;
+    int cnt;
+    int af;
+    char foundation[33], transport[13], ipaddr[81], type[33], raddr[81];
+    pj_ice_sess_cand *cand;
+    pj_str_t str_addr;
+
+    if (handler->remote.cand_cnt >= PJ_ICE_ST_MAX_CAND)
+        return ELA_GENERAL_ERROR(ELAERR_LIMIT_EXCEEDED);
+
+    cand = &handler->remote.cand[handler->remote.cand_cnt];
+
+    cnt = sscanf(value,
+                 "%32s %d %12s %d %80s %d typ %32s raddr %80s rport %d",
+                 foundation,
+                 &comp_id,
+                 transport,
+                 &prio,
+                 ipaddr,
+                 &port,
+                 type,
+                 raddr,
+                 &rport);
+    if (cnt != 7 && cnt != 9)
+        return ELA_GENERAL_ERROR(ELAERR_INVALID_SDP);
+
+    if (strcmp(type, "host")==0)
+        cand->type = PJ_ICE_CAND_TYPE_HOST;
+    else if (strcmp(type, "srflx")==0)
+        cand->type = PJ_ICE_CAND_TYPE_SRFLX;
+    else if (strcmp(type, "relay")==0)
+        cand->type = PJ_ICE_CAND_TYPE_RELAYED;
+    else if (strcmp(type, "prflx")==0)
+        cand->type = PJ_ICE_CAND_TYPE_PRFLX;
+    else
+        return ELA_GENERAL_ERROR(ELAERR_INVALID_SDP);
+
+    strcpy(handler->remote.foundation[handler->remote.cand_cnt], foundation);
+
+    cand->comp_id = (pj_uint8_t)comp_id;
+    cand->foundation = pj_str(handler->remote.foundation[handler->remote.cand_cnt]);
+    cand->prio = (pj_uint32_t)prio;
+
+    if (strchr(ipaddr, ':'))
+        af = pj_AF_INET6();
+    else
+        af = pj_AF_INET();
+
+    str_addr = pj_str(ipaddr);
+    pj_sockaddr_init(af, &cand->addr, &str_addr, (pj_uint16_t)port);
+    if (cnt == 9) {
+        str_addr = pj_str(raddr);
+        pj_sockaddr_init(af, &cand->rel_addr, &str_addr, (pj_uint16_t)rport);
+    }
+
+    if (comp_id > (int)handler->remote.comp_cnt)
+        handler->remote.comp_cnt = comp_id;
+
+    handler->remote.cand_cnt++;
+    return 0;
+}
+
+static void ice_handler_send_trickle(IceHandler *handler)
+{
+    IceStream *stream = (IceStream *)handler->base.stream;
+    IceSession *session = (IceSession *)stream_get_session(&stream->base);
+    const char *eoc = "a=end-of-candidates\r\n";
+    char msg[ELA_MAX_APP_MESSAGE_LEN];
+    size_t hdr_len;
+    size_t len;
+    unsigned ncomps;
+    unsigned i;
+    int rc;
+
+    len = hdr_len = (size_t)sprintf(msg, "a=ice-ufrag:%s\r\na=mid:%d\r\n",
+                                    session->ufrag, handler->trickle.mid);
+
+    ncomps = pj_ice_strans_get_running_comp_cnt(handler->st);
+    for (i = 0; i < ncomps; i++) {
+        pj_ice_sess_cand cand[PJ_ICE_ST_MAX_CAND];
+        unsigned cand_cnt = PJ_ARRAY_SIZE(cand);
+        unsigned j;
+
+        if (pj_ice_strans_enum_cands(handler->st, i+1, &cand_cnt, cand) != PJ_SUCCESS)
+            continue;
+
+        for (j = 0; j < cand_cnt; j++) {
+            char line[160];
+            int n;
+
+            // Host candidates were carried in the local SDP already.
+            if (cand[j].type == PJ_ICE_CAND_TYPE_HOST)
+                continue;
+
+            n = sprintf(line, "a=candidate:");
+            rc = format_candidate(&cand[j], line + n, sizeof(line) - n - 2);
+            if (rc <= 0 || rc >= (int)(sizeof(line) - n - 2))
+                continue;
+            n += rc;
+            n += sprintf(line + n, "\r\n");
+
+            if (len + n + strlen(eoc) > sizeof(msg)) {
+                session_send_trickle(&session->base, msg, len);
+                len = hdr_len;
+            }
+
+            memcpy(msg + len, line, n);
+            len += n;
+        }
+    }
+
+    memcpy(msg + len, eoc, strlen(eoc));
+    len += strlen(eoc);
+
+    rc = session_send_trickle(&session->base, msg, len);
+    if (rc < 0)
+        vlogW("Stream: %d ICE handler send trickle candidates error 0x%x.",
+              stream->base.id, rc);
+    else
+        vlogD("Stream: %d ICE handler trickled candidates.", stream->base.id);
+}
+
+/*
+ * Called with ICE group lock held when local candidates gathering completed
+ * after the stream had been reported initialized.
+ */
+static void ice_handler_trickle_gathered(IceHandler *handler)
+{
+    IceStream *stream = (IceStream *)handler->base.stream;
+    IceSession *session = (IceSession *)stream_get_session(&stream->base);
+    IceTransport *transport = (IceTransport *)stream_get_transport(&stream->base);
+    pj_status_t status;
+    pj_str_t ufrag;
+    pj_str_t pwd;
+
+    prepare_thread_context(transport);
+
+    // Not prepared yet, local SDP will carry all candidates.
+    if (!pj_ice_strans_has_sess(handler->st) || handler->stopping)
+        return;
+
+    if (!handler->trickle.started) {
+        // Recreate ICE session to take the late candidates into account.
+        pj_ice_strans_stop_ice(handler->st);
+
+        ufrag = pj_str(session->ufrag);
+        pwd = pj_str(session->pwd);
+
+        status = pj_ice_strans_init_ice(handler->st, session->role, &ufrag, &pwd);
+        if (status != PJ_SUCCESS) {
+            vlogE("Stream: %d ICE handler reinit with gathered candidates "
+                  "error: %s.", stream->base.id, ice_strerror(status));
+            notify_state_changed(&handler->base, ElaStreamState_failed);
+            return;
+        }
+    } else if (!handler->resume.active) {
+        vlogW("Stream: %d ICE negotiation already started, late local "
+              "candidates are not used.", stream->base.id);
+    }
+
+    if (handler->trickle.partial)
+        ice_handler_send_trickle(handler);
+
+    if (handler->trickle.pending && handler->trickle.remote_done)
+        ice_handler_start_checks(handler);
+}
+
+static IceStream *get_stream_by_mid(ElaSession *base, int mid)
+{
+    IceStream *stream;
+    list_iterator_t iterator;
+    int rc;
+
+rescan:
+    list_iterate(base->streams, &iterator);
+    while (list_iterator_has_next(&iterator)) {
+        rc = list_iterator_next(&iterator, (void **)&stream);
+        if (rc == 0)
+            break;
+
+        if (rc == -1)
+            goto rescan;
+
+        if (!stream->base.deactivate &&
+            ((IceHandler *)stream->handler)->remote.mid == mid)
+            return stream;
+
+        deref(stream);
+    }
+
+    return NULL;
+}
+
+static int ice_session_apply_remote_candidates(ElaSession *base,
+                                               const char *data, size_t len)
+{
+    IceTransport *transport = (IceTransport *)session_get_transport(base);
+    IceStream *stream = NULL;
+    IceHandler *handler = NULL;
+    pj_grp_lock_t *lock = NULL;
+    const char *line = data;
+    const char *end = data + len;
+    int matched = 0;
+    int rc = 0;
+
+    assert(base && data && len);
+
+    prepare_thread_context(transport);
+
+    while (line < end && rc == 0) {
+        const char *eol = line;
+        char value[256];
+        size_t n;
+        int mid;
+
+        while (eol < end && *eol != '\r' && *eol != '\n')
+            eol++;
+
+        n = (size_t)(eol - line);
+        if (n >= sizeof(value))
+            n = sizeof(value) - 1;
+        memcpy(value, line, n);
+        value[n] = 0;
+
+        while (eol < end && (*eol == '\r' || *eol == '\n'))
+            eol++;
+        line = eol;
+
+        if (strncmp(value, "a=ice-ufrag:", 12) == 0) {
+            matched = (strcmp(value + 12, base->trickle.peer_ufrag) == 0);
+        } else if (!matched) {
+            continue;
+        } else if (sscanf(value, "a=mid:%d", &mid) == 1) {
+            if (stream) {
+                pj_grp_lock_release(lock);
+                deref(stream);
+            }
+
+            stream = get_stream_by_mid(base, mid);
+            if (!stream) {
+                vlogW("Session: No stream matched trickle candidates of "
+                      "media %d, ignored.", mid);
+                continue;
+            }
+
+            handler = (IceHandler *)stream->handler;
+            lock = pj_ice_strans_get_grp_lock(handler->st);
+            pj_grp_lock_acquire(lock);
+        } else if (!stream || handler->stopping) {
+            continue;
+        } else if (strncmp(value, "a=candidate:", 12) == 0) {
+            // Keep candidates for the fallback if probing cached pair.
+            if (handler->trickle.started && !handler->resume.active) {
+                vlogW("Stream: %d ICE negotiation already started, trickle "
+                      "candidate ignored.", stream->base.id);
+                continue;
+            }
+
+            rc = parse_candidate(handler, value + 12);
+            if (rc < 0)
+                vlogE("Stream: %d invalid trickle candidate: %s.",
+                      stream->base.id, value + 12);
+        } else if (strcmp(value, "a=end-of-candidates") == 0) {
+            vlogD("Stream: %d ICE remote candidates completed, total %u.",
+                  stream->base.id, handler->remote.cand_cnt);
+
+            handler->trickle.remote_done = 1;
+            if (handler->trickle.pending && handler->trickle.gathered)
+                ice_handler_start_checks(handler);
+        }
+    }
+
+    if (stream) {
+        pj_grp_lock_release(lock);
+        deref(stream);
+    }
+
+    return rc;
+}
+
 static int ice_session_apply_remote_sdp(ElaSession *base,
                                         const char *sdp, size_t len)
 {
@@ -1249,12 +1921,15 @@ static int ice_session_apply_remote_sdp(ElaSession *base,
     pj_str_t ufrag = { NULL, 0 };
     pj_str_t pwd = { NULL, 0 };
     pj_str_t nonce = { NULL, 0 };
+    pj_str_t ciphers = { NULL, 0 };
+    const char *local_ciphers;
     pj_status_t status;
     list_iterator_t iterator;
     int media_index;
     int i;
     int rc;
     int fmt, ops = 0;
+    int trickle = 0;
 
     assert(base && sdp && len);
 
@@ -1290,17 +1965,39 @@ static int ice_session_apply_remote_sdp(ElaSession *base,
             pwd = p_sdp->attr[i]->value;
         else if (pj_strcmp2(&p_sdp->attr[i]->name, "nonce") == 0)
             nonce = p_sdp->attr[i]->value;
+        else if (pj_strcmp2(&p_sdp->attr[i]->name, CRYPTO_CIPHER_ATTRIBUTE) == 0)
+            ciphers = p_sdp->attr[i]->value;
+        else if (pj_strcmp2(&p_sdp->attr[i]->name, "ice-options") == 0 &&
+                 pj_strcmp2(&p_sdp->attr[i]->value, "trickle") == 0)
+            trickle = 1;
+    }
+
+    if (trickle && ufrag.ptr && ufrag.slen < (pj_ssize_t)sizeof(base->trickle.peer_ufrag)) {
+        memcpy(base->trickle.peer_ufrag, ufrag.ptr, ufrag.slen);
+        base->trickle.peer_ufrag[ufrag.slen] = 0;
+    } else {
+        trickle = 0;
+        base->trickle.peer_ufrag[0] = 0;
     }
 
     if (nonce.ptr && session->role != PJ_ICE_SESS_ROLE_CONTROLLING)
         crypto_nonce_from_str(base->nonce, nonce.ptr, nonce.slen);
 
+    local_ciphers = crypto_cipher_list();
+    if (base->offerer)
+        base->crypto.cipher = crypto_cipher_select(local_ciphers,
+                                    strlen(local_ciphers),
+                                    ciphers.ptr, (size_t)ciphers.slen);
+    else
+        base->crypto.cipher = crypto_cipher_select(ciphers.ptr,
+                                    (size_t)ciphers.slen,
+                                    local_ciphers, strlen(local_ciphers));
+
 rescan:
     media_index = 0;
     list_iterate(base->streams, &iterator);
     while (list_iterator_has_next(&iterator)) {
         int af;
-        int cand_index = 0;
         IceStream *stream;
         IceHandler *handler;
 
@@ -1321,6 +2018,8 @@ rescan:
         }
 
         memset(&handler->remote, 0, sizeof(handler->remote));
+        handler->remote.mid = media_index;
+        handler->trickle.remote_done = !trickle;
 
         pjmedia_sdp_media *media = p_sdp->media[media_index];
         pjmedia_sdp_conn *conn = media->conn;
@@ -1340,6 +2039,10 @@ rescan:
 
         fmt = atoi(media->desc.fmt[0].ptr);
 
+        if (stream->base.compress)
+            ops |= ELA_STREAM_COMPRESS;
+        if (stream->base.fec)
+            ops |= ELA_STREAM_FEC;
         if (stream->base.unencrypt)
             ops |= ELA_STREAM_PLAIN;
         if (stream->base.multiplexing)
@@ -1359,65 +2062,15 @@ rescan:
 
         for (i = 0; i < (int)media->attr_count; i++) {
             if (pj_strcmp2(&media->attr[i]->name, "candidate") == 0) {
-                int comp_id, prio, port, rport;
-                int cnt;
-                char foundation[32], transport[12], ipaddr[80], type[32], raddr[80];
-                pj_ice_sess_cand *cand = &handler->remote.cand[cand_index];
-
-                cnt = sscanf(media->attr[i]->value.ptr,
-                             "%32s %d %12s %d %80s %d typ %32s raddr %80s rport %d",
-                             foundation,
-                             &comp_id,
-                             transport,
-                             &prio,
-                             ipaddr,
-                             &port,
-                             type,
-                             raddr,
-                             &rport);
-                if (cnt != 7 && cnt != 9) {
-                    memset(&handler->remote, 0, sizeof(handler->remote));
-                    pj_pool_release(pool);
-                    deref(stream);
-                    return ELA_GENERAL_ERROR(ELAERR_INVALID_SDP);
-                }
-
-                if (strcmp(type, "host")==0)
-                    cand->type = PJ_ICE_CAND_TYPE_HOST;
-                else if (strcmp(type, "srflx")==0)
-                    cand->type = PJ_ICE_CAND_TYPE_SRFLX;
-                else if (strcmp(type, "relay")==0)
-                    cand->type = PJ_ICE_CAND_TYPE_RELAYED;
-                else if (strcmp(type, "prflx")==0)
-                    cand->type = PJ_ICE_CAND_TYPE_PRFLX;
-                else {
+                rc = parse_candidate(handler, media->attr[i]->value.ptr);
+                if (rc < 0) {
                     memset(&handler->remote, 0, sizeof(handler->remote));
                     pj_pool_release(pool);
                     deref(stream);
-                    return ELA_GENERAL_ERROR(ELAERR_INVALID_SDP);
-                }
-
-                cand->comp_id = (pj_uint8_t)comp_id;
-                cand->foundation = pj_str(foundation);
-                cand->prio = (pj_uint32_t)prio;
-
-                if (strchr(ipaddr, ':'))
-                    af = pj_AF_INET6();
-                else
-                    af = pj_AF_INET();
-
-                pj_str_t str_ipaddr = pj_str(ipaddr);
-                pj_sockaddr_init(af, &cand->addr, &str_ipaddr, (pj_uint16_t)port);
-                if (cnt == 9) {
-                    pj_str_t str_rpaddr = pj_str(raddr);
-                    pj_sockaddr_init(af, &cand->rel_addr, &str_rpaddr, (pj_uint16_t)rport);
-                }
-
-                if (comp_id > (int)handler->remote.comp_cnt) {
-                    handler->remote.comp_cnt = comp_id;
+                    return rc;
                 }
-
-                handler->remote.cand_cnt = ++cand_index;
+            } else if (pj_strcmp2(&media->attr[i]->name, "end-of-candidates") == 0) {
+                handler->trickle.remote_done = 1;
             }
         }
         media_index++;
@@ -1457,6 +2110,9 @@ static int ice_session_encode_local_sdp(ElaSession *base,
     pjmedia_sdp_attr ufrag_attr;
     pjmedia_sdp_attr pwd_attr;
     pjmedia_sdp_attr nonce_attr;
+    pjmedia_sdp_attr cipher_attr;
+    pjmedia_sdp_attr trickle_attr;
+    pjmedia_sdp_attr compact_attr;
     list_iterator_t iterator;
     int index = 0;
     int rc;
@@ -1526,6 +2182,36 @@ static int ice_session_encode_local_sdp(ElaSession *base,
             pj_pool_release(pool);
             return ELA_ICE_ERROR(status);
         }
+
+        cipher_attr.name = pj_str(CRYPTO_CIPHER_ATTRIBUTE);
+        cipher_attr.value = pj_str((char *)crypto_cipher_list());
+
+        status = pjmedia_sdp_session_add_attr(&sdp_session, &cipher_attr);
+        if (status != PJ_SUCCESS) {
+            pj_pool_release(pool);
+            return ELA_ICE_ERROR(status);
+        }
+    }
+
+    if (base->trickle.enabled) {
+        trickle_attr.name = pj_str("ice-options");
+        trickle_attr.value = pj_str("trickle");
+
+        status = pjmedia_sdp_session_add_attr(&sdp_session, &trickle_attr);
+        if (status != PJ_SUCCESS) {
+            pj_pool_release(pool);
+            return ELA_ICE_ERROR(status);
+        }
+    }
+
+    // Let the peer know compact SDP can be used in reply.
+    compact_attr.name = pj_str(SDP_COMPACT_ATTRIBUTE);
+    compact_attr.value = pj_str("");
+
+    status = pjmedia_sdp_session_add_attr(&sdp_session, &compact_attr);
+    if (status != PJ_SUCCESS) {
+        pj_pool_release(pool);
+        return ELA_ICE_ERROR(status);
     }
 
 rescan:
@@ -1536,7 +2222,9 @@ rescan:
         pjmedia_sdp_media *media;
         pjmedia_sdp_conn *conn;
         pj_ice_sess_cand cand[PJ_ICE_ST_MAX_CAND];
+        pj_grp_lock_t *lock;
         unsigned ncomps;
+        int partial = 0;
         int i;
 
         rc = list_iterator_next(&iterator, (void **)&stream);
@@ -1561,6 +2249,13 @@ rescan:
             return ELA_GENERAL_ERROR(ELAERR_WRONG_STATE);
         }
 
+        lock = pj_ice_strans_get_grp_lock(handler->st);
+        pj_grp_lock_acquire(lock);
+        handler->trickle.mid = index;
+        if (handler->trickle.enabled && !handler->trickle.gathered)
+            partial = handler->trickle.partial = 1;
+        pj_grp_lock_release(lock);
+
         media = pj_pool_calloc(pool, 1, sizeof(pjmedia_sdp_media));
 
         // Media descriptions (m=)
@@ -1577,6 +2272,10 @@ rescan:
         media->desc.transport = pj_str("UDP");
         media->desc.fmt_count = 1;
 
+        if (stream->base.compress)
+            ops |= ELA_STREAM_COMPRESS;
+        if (stream->base.fec)
+            ops |= ELA_STREAM_FEC;
         if (stream->base.unencrypt)
             ops |= ELA_STREAM_PLAIN;
         if (stream->base.multiplexing)
@@ -1615,30 +2314,8 @@ rescan:
             for (j = 0, candidate = cand; j < (int)cand_cnt; j++, candidate++) {
                 char buf[128];
 
-                if (candidate->type == PJ_ICE_CAND_TYPE_HOST) {
-                    snprintf(buf, sizeof(buf), "%.*s %u UDP %u %s %u typ %s",
-                             (int)candidate->foundation.slen,
-                             candidate->foundation.ptr,
-                             (unsigned)candidate->comp_id,
-                             candidate->prio,
-                             pj_sockaddr_print(&candidate->addr, str_addr, sizeof(str_addr), 0),
-                             (unsigned)pj_sockaddr_get_port(&candidate->addr),
-                             pj_ice_get_cand_type_name(candidate->type));
-                } else if ((candidate->type == PJ_ICE_CAND_TYPE_SRFLX)
-                           || (candidate->type == PJ_ICE_CAND_TYPE_RELAYED)) {
-                    char str_rel_addr[PJ_INET6_ADDRSTRLEN];
-
-                    snprintf(buf, sizeof(buf), "%.*s %u UDP %u %s %u typ %s raddr %s rport %u",
-                             (int)candidate->foundation.slen,
-                             candidate->foundation.ptr,
-                             (unsigned)candidate->comp_id,
-                             candidate->prio,
-                             pj_sockaddr_print(&candidate->addr, str_addr, sizeof(str_addr), 0),
-                             (unsigned)pj_sockaddr_get_port(&candidate->addr),
-                             pj_ice_get_cand_type_name(candidate->type),
-                             pj_sockaddr_print(&candidate->rel_addr, str_rel_addr, sizeof(str_rel_addr), 0),
-                             (unsigned)pj_sockaddr_get_port(&candidate->rel_addr));
-                }
+                if (format_candidate(candidate, buf, sizeof(buf)) <= 0)
+                    continue;
 
                 cand_attr = pj_pool_calloc(pool, 1, sizeof(pjmedia_sdp_attr));
                 cand_attr->name = pj_str("candidate");
@@ -1653,6 +2330,20 @@ rescan:
             }
         }
 
+        if (base->trickle.enabled && !partial) {
+            pjmedia_sdp_attr *eoc_attr;
+
+            eoc_attr = pj_pool_calloc(pool, 1, sizeof(pjmedia_sdp_attr));
+            eoc_attr->name = pj_str("end-of-candidates");
+
+            status = pjmedia_sdp_media_add_attr(media, eoc_attr);
+            if (status != PJ_SUCCESS) {
+                pj_pool_release(pool);
+                deref(stream);
+                return ELA_ICE_ERROR(status);
+            }
+        }
+
         sdp_session.media[index] = media;
         sdp_session.media_count++;
         index++;
@@ -1741,6 +2432,7 @@ static int ice_transport_create_session(ElaTransport *base, ElaSession **session
     s->base.set_offer = ice_session_set_offer;
     s->base.encode_local_sdp = ice_session_encode_local_sdp;
     s->base.apply_remote_sdp = ice_session_apply_remote_sdp;
+    s->base.apply_remote_candidates = ice_session_apply_remote_candidates;
 
 
     vlogD("Session: ICE session created");
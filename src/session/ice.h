@@ -91,8 +91,21 @@ typedef struct IceWorker {
 typedef struct IceTransport {
     ElaTransport        base;
     pthread_key_t       pj_thread_ctx;
+    hashtable_t         *pairs;
 } IceTransport;
 
+/*
+ * The last nominated candidate pair with a friend, used to probe that
+ * pair first when a new session to the same friend is started.
+ */
+typedef struct IcePair {
+    hash_entry_t        he;
+    pj_sockaddr         local_base;
+    pj_sockaddr         remote_addr;
+    pj_ice_cand_type    remote_type;
+    char                friendid[ELA_MAX_ID_LEN + 1];
+} IcePair;
+
 typedef struct IceSession {
     ElaSession          base;
 
@@ -117,13 +130,34 @@ typedef struct IceHandler {
 
     int                 stopping;
 
+    struct {
+        int             enabled;
+        int             early;
+        int             gathered;
+        int             partial;
+        int             remote_done;
+        int             pending;
+        int             started;
+        int             mid;
+        Timer           *timer;
+    } trickle;
+
+    struct {
+        int             active;
+        int             index;
+        int             injected;
+        pj_uint32_t     prio;
+    } resume;
+
     struct {
         char            ufrag[80];
         char            pwd[80];
+        int             mid;
         unsigned int    comp_cnt;
         pj_sockaddr     def_addr[PJ_ICE_MAX_COMP];
         unsigned int    cand_cnt;
         pj_ice_sess_cand    cand[PJ_ICE_ST_MAX_CAND];
+        char            foundation[PJ_ICE_ST_MAX_CAND][33];
     } remote;
 } IceHandler;
 
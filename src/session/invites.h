@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __INVITES_H__
+#define __INVITES_H__
+
+#include <string.h>
+#include <stdint.h>
+#include <crystal.h>
+
+#include "ela_session.h"
+
+/*
+ * Arrival time of the latest session invite from each friend. The answerer
+ * creates its session only after the invite, so its signaling phase starts
+ * from here.
+ */
+typedef struct Invite {
+    hash_entry_t        he;
+    int64_t             received;
+    char                friendid[ELA_MAX_ID_LEN + 1];
+} Invite;
+
+static inline
+int invites_key_compare(const void *key1, size_t len1,
+                        const void *key2, size_t len2)
+{
+    return strcmp(key1, key2);
+}
+
+static inline
+hashtable_t *invites_create(int capacity)
+{
+    return hashtable_create(capacity, 1, NULL, invites_key_compare);
+}
+
+static inline
+void invites_put(hashtable_t *htab, Invite *invite)
+{
+    invite->he.data = invite;
+    invite->he.key = (void *)invite->friendid;
+    invite->he.keylen = strlen(invite->friendid);
+
+    hashtable_put(htab, &invite->he);
+}
+
+static inline
+Invite *invites_remove(hashtable_t *htab, const char *friendid)
+{
+    return (Invite *)hashtable_remove(htab, (void *)friendid, strlen(friendid));
+}
+
+#endif /* __INVITES_H__ */
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "lz_codec.h"
+
+#define MIN_MATCH           4
+#define LAST_LITERALS       5       /* The block ends with literals */
+#define MF_LIMIT            12      /* No match starts this close to the end */
+#define HASH_BITS           12
+#define SKIP_TRIGGER        5       /* Probe less often after 32 misses */
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+
+    return op;
+}
+
+/*
+ * A sequence is a token (literal length << 4 | match length - 4),
+ * extra literal length bytes, the literals, a little endian 16 bit
+ * offset and extra match length bytes. The last one has literals only.
+ */
+static int put_sequence(uint8_t **opp, uint8_t *oend, const uint8_t *literals,
+                        size_t lit_len, size_t offset, size_t match_len)
+{
+    uint8_t *op = *opp;
+    uint8_t *token;
+    size_t need;
+
+    need = 1 + lit_len + lit_len / 255 + 1;
+    if (offset)
+        need += 2 + match_len / 255 + 1;
+    if (need > (size_t)(oend - op))
+        return -1;
+
+    token = op++;
+    if (lit_len >= 15) {
+        *token = 15 << 4;
+        op = put_length(op, lit_len - 15);
+    } else {
+        *token = (uint8_t)(lit_len << 4);
+    }
+
+    memcpy(op, literals, lit_len);
+    op += lit_len;
+
+    if (offset) {
+        *op++ = (uint8_t)(offset & 0xFF);
+        *op++ = (uint8_t)(offset >> 8);
+
+        if (match_len >= 15) {
+            *token |= 15;
+            op = put_length(op, match_len - 15);
+        } else {
+            *token |= (uint8_t)match_len;
+        }
+    }
+
+    *opp = op;
+    return 0;
+}
+
+ssize_t lz_compress(const void *src, size_t len, void *dst, size_t size)
+{
+    uint16_t table[1 << HASH_BITS];
+    const uint8_t *base = (const uint8_t *)src;
+    const uint8_t *ip = base;
+    const uint8_t *anchor = base;
+    const uint8_t *end = base + len;
+    uint8_t *op = (uint8_t *)dst;
+    uint8_t *oend = op + size;
+
+    if (len > LZ_MAX_INPUT_LEN)
+        return -1;
+
+    if (len > MF_LIMIT) {
+        const uint8_t *mflimit = end - MF_LIMIT;
+        const uint8_t *matchlimit = end - LAST_LITERALS;
+        unsigned misses = 1 << SKIP_TRIGGER;
+
+        memset(table, 0, sizeof(table));
+        ip++;
+
+        while (ip < mflimit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = hash32(seq);
+            const uint8_t *ref = base + table[h];
+            const uint8_t *mp;
+
+            table[h] = (uint16_t)(ip - base);
+
+            if (ref >= ip || read32(ref) != seq) {
+                ip += misses++ >> SKIP_TRIGGER;
+                continue;
+            }
+
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            mp = ip + MIN_MATCH;
+            while (mp < matchlimit && *mp == ref[mp - ip])
+                mp++;
+
+            if (put_sequence(&op, oend, anchor, (size_t)(ip - anchor),
+                             (size_t)(ip - ref),
+                             (size_t)(mp - ip) - MIN_MATCH) < 0)
+                return -1;
+
+            ip = anchor = mp;
+            misses = 1 << SKIP_TRIGGER;
+        }
+    }
+
+    if (put_sequence(&op, oend, anchor, (size_t)(end - anchor), 0, 0) < 0)
+        return -1;
+
+    return (ssize_t)(op - (uint8_t *)dst);
+}
+
+static int get_length(const uint8_t **ipp, const uint8_t *iend, size_t *len)
+{
+    const uint8_t *ip = *ipp;
+    unsigned b;
+
+    do {
+        if (ip >= iend)
+            return -1;
+        b = *ip++;
+        *len += b;
+    } while (b == 255);
+
+    *ipp = ip;
+    return 0;
+}
+
+ssize_t lz_decompress(const void *src, size_t len, void *dst, size_t size)
+{
+    const uint8_t *ip = (const uint8_t *)src;
+    const uint8_t *iend = ip + len;
+    uint8_t *base = (uint8_t *)dst;
+    uint8_t *op = base;
+    uint8_t *oend = op + size;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t lit_len = token >> 4;
+        size_t match_len = token & 15;
+        size_t offset;
+        const uint8_t *ref;
+
+        if (lit_len == 15 && get_length(&ip, iend, &lit_len) < 0)
+            return -1;
+
+        if (lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op))
+            return -1;
+
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        // The last sequence has no match.
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+
+        offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+
+        if (offset == 0 || offset > (size_t)(op - base))
+            return -1;
+
+        if (match_len == 15 && get_length(&ip, iend, &match_len) < 0)
+            return -1;
+
+        match_len += MIN_MATCH;
+        if (match_len > (size_t)(oend - op))
+            return -1;
+
+        ref = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, ref, match_len);
+            op += match_len;
+        } else {
+            // Overlapping match repeats the last offset bytes.
+            while (match_len--)
+                *op++ = *ref++;
+        }
+    }
+
+    return (ssize_t)(op - base);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __LZ_CODEC_H__
+#define __LZ_CODEC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Small LZ77 codec for single packets, producing the LZ4 block format.
+ * The compressor is a greedy single probe matcher that gives up quickly
+ * on data that does not compress, the decompressor checks every length
+ * and offset against its input and output.
+ */
+#define LZ_MAX_INPUT_LEN            65535
+
+/*
+ * Returns the compressed length, or -1 if the input is too long or the
+ * result does not fit in size bytes.
+ */
+ssize_t lz_compress(const void *src, size_t len, void *dst, size_t size);
+
+/*
+ * Returns the decompressed length, or -1 if the input is malformed or
+ * the result does not fit in size bytes.
+ */
+ssize_t lz_decompress(const void *src, size_t len, void *dst, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LZ_CODEC_H__ */
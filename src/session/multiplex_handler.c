@@ -191,7 +191,22 @@ bool user_channel_data(Channel *ch, FlexBuffer *buf, void *context)
     assert(s);
     assert(ch);
 
-    if (s->callbacks.channel_data)
+    if (s->callbacks.channel_buffer) {
+        ElaStreamBuffer *pbuf;
+        bool ok;
+
+        pbuf = stream_rx_buffer(s, buf);
+        if (!pbuf) {
+            vlogE("Stream: %d channel %d out of memory, drop %zu bytes data.",
+                  s->id, ch->id, flex_buffer_size(buf));
+            return true;
+        }
+
+        ok = s->callbacks.channel_buffer(s->session, s->id, ch->id, pbuf,
+                                         s->context);
+        buffer_release(pbuf);
+        return ok;
+    } else if (s->callbacks.channel_data)
         return s->callbacks.channel_data(s->session, s->id, ch->id,
                                          flex_buffer_ptr(buf),
                                          flex_buffer_size(buf),
@@ -572,6 +587,36 @@ void multiplex_handler_notify_packet(MultiplexHandler *handler, FlexBuffer *buf)
     }
 }
 
+/*
+ * When the application takes pooled buffers, packets are reassembled
+ * straight into one, and a complete packet is handed off as is. A fresh
+ * buffer is taken for the next packet, since the application may keep
+ * the previous one.
+ */
+static
+void multiplex_handler_reset_incomplete(MultiplexHandler *handler)
+{
+    ElaStream *s = handler->base.stream;
+    ElaStreamBuffer *pbuf;
+
+    pbuf = flex_buffer_owner(&handler->incomplete_buf);
+    if (pbuf)
+        buffer_release(pbuf);
+
+    pbuf = NULL;
+    if (stream_wants_rx_buffers(s))
+        pbuf = buffer_pool_get(stream_get_buffer_pool(s), FLEX_PADDING_LEN);
+
+    if (pbuf) {
+        flex_buffer_init(&handler->incomplete_buf, pbuf->flex.buffer,
+                         pbuf->flex.capacity, FLEX_PADDING_LEN);
+        handler->incomplete_buf.owner = pbuf;
+    } else {
+        flex_buffer_init(&handler->incomplete_buf, handler->__buffer,
+                         FLEX_BUFFER_MAX_LEN, FLEX_PADDING_LEN);
+    }
+}
+
 /* For stream mode underlying transport */
 static
 void multiplex_handler_notify_data(MultiplexHandler *handler, FlexBuffer *buf)
@@ -584,6 +629,25 @@ void multiplex_handler_notify_data(MultiplexHandler *handler, FlexBuffer *buf)
     assert(buf && flex_buffer_size(buf));
 
     while (flex_buffer_size(buf) != 0) {
+        /* Complete packets with nothing pending are handled in place. */
+        if (flex_buffer_size(&handler->incomplete_buf) == 0 &&
+                flex_buffer_size(buf) >= PROTOCOL_HEAD_LEN) {
+            FlexBuffer packet;
+            size_t packet_len;
+
+            pb = (ProtocolBuffer *)flex_buffer_mutable_ptr(buf);
+            packet_len = (size_t)ntohs(pb->payload_len) + PROTOCOL_HEAD_LEN;
+
+            if (packet_len <= flex_buffer_size(buf)) {
+                flex_buffer_init(&packet, pb, packet_len, 0);
+                flex_buffer_set_size(&packet, packet_len);
+                flex_buffer_forward_offset(buf, packet_len);
+
+                multiplex_handler_notify_packet(handler, &packet);
+                continue;
+            }
+        }
+
         if (flex_buffer_size(&handler->incomplete_buf) + flex_buffer_size(buf) < PROTOCOL_HEAD_LEN) {
             flex_buffer_append(&handler->incomplete_buf, buf);
             return;
@@ -611,7 +675,11 @@ void multiplex_handler_notify_data(MultiplexHandler *handler, FlexBuffer *buf)
         }
 
         multiplex_handler_notify_packet(handler, &handler->incomplete_buf);
-        flex_buffer_reset(&handler->incomplete_buf, FLEX_PADDING_LEN);
+
+        if (flex_buffer_owner(&handler->incomplete_buf))
+            multiplex_handler_reset_incomplete(handler);
+        else
+            flex_buffer_reset(&handler->incomplete_buf, FLEX_PADDING_LEN);
     }
 }
 
@@ -1013,6 +1081,9 @@ void multiplex_handler_destroy(void *p)
     if (handler->channels)
         deref(handler->channels);
 
+    if (flex_buffer_owner(&handler->incomplete_buf))
+        buffer_release(flex_buffer_owner(&handler->incomplete_buf));
+
     ids_heap_destroy(IDS(handler->channel_ids));
 
     if (handler->base.next)
@@ -1054,8 +1125,7 @@ int multiplex_handler_create(ElaStream *s, MultiplexHandler **handler)
     _handler->mux.channel.write = multiplex_handler_write_channel;
 
     if (stream_is_reliable(s))
-        flex_buffer_init(&_handler->incomplete_buf, _handler->__buffer,
-                         FLEX_BUFFER_MAX_LEN, FLEX_PADDING_LEN);
+        multiplex_handler_reset_incomplete(_handler);
 
     _handler->channels = channels_create(256);
     if (!_handler->channels) {
@@ -148,6 +148,10 @@ const guint16 PACKET_MAXIMUMS[] = {
 // 24 |                             data                              |
 //    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 //
+// Once both ends have sent TCP_OPT_SACK, the Control octet of a pure ACK
+// counts the SACK blocks that follow the header, each a pair of 32-bit
+// sequence numbers (left edge, right edge). Older peers always send 0 there.
+//
 //////////////////////////////////////////////////////////////////////
 
 #define MAX_SEQ 0xFFFFFFFF
@@ -156,16 +160,48 @@ const guint16 PACKET_MAXIMUMS[] = {
 #define PACKET_OVERHEAD (HEADER_SIZE + UDP_HEADER_SIZE + \
       IP_HEADER_SIZE + JINGLE_HEADER_SIZE)
 
-// MIN_RTO = 1 second (RFC6298, Sec 2.4)
-#define MIN_RTO     1000
+// Default RTO floor. RFC 6298 §2.4 asks for 1 second, which stalls a low
+// RTT path for a whole second on a tail loss; 200 ms like Linux.
+#define MIN_RTO      200
 #define DEF_RTO     1000 /* 1 seconds (RFC 6298 sect 2.1) */
 #define MAX_RTO    60000 /* 60 seconds */
 #define DEFAULT_ACK_DELAY    100 /* 100 milliseconds */
+
+// Tail loss probe timeout floor. A flight of one segment also waits out
+// the peer's delayed ACK (RFC 8985, §7.2).
+#define TLP_MIN_TIMEOUT 10
+#define TLP_ACK_DELAY DEFAULT_ACK_DELAY
 #define DEFAULT_NO_DELAY     FALSE
+#define DEFAULT_ACK_FREQUENCY 2
+
+// Adaptive ACK decimation: most segments left unacknowledged. The delayed
+// ACK timer is cut to a quarter of the receive side RTT meanwhile, so the
+// sender isn't stalled waiting for it.
+#define ACK_DECIMATION_MAX 10
 
 #define DEFAULT_RCV_BUF_SIZE (60 * 1024)
 #define DEFAULT_SND_BUF_SIZE (90 * 1024)
 
+/* Ceilings for buffer autotuning, enough for ~80 Mbps at 200 ms RTT. */
+#define DEFAULT_RCV_BUF_MAX (2 * 1024 * 1024)
+#define DEFAULT_SND_BUF_MAX (2 * 1024 * 1024)
+
+// SACK blocks per ACK; the first one always covers the latest arrival
+#define MAX_SACK_BLOCKS 4
+#define SACK_BLOCK_SIZE 8
+// Duplicate ACKs, or segments SACKed above a hole, before it counts as lost
+#define DUP_THRESH 3
+
+// Packetization layer path MTU discovery (RFC 4821): the MTU to fall back
+// to once full sized segments stop getting through, the search ends when
+// the largest MTU that worked and the smallest one that failed are a step
+// apart, and starts over after the interval in case the path changed.
+#define MTU_PROBE_BASE 1200
+#define MTU_PROBE_STEP 16
+#define MTU_PROBE_INTERVAL 600000 /* 10 minutes */
+// Transmissions of the oldest segment before the path counts as a black hole
+#define MTU_BLACK_HOLE_XMITS 3
+
 /* NOTE: This must fit in 8 bits. This is used on the wire. */
 typedef enum {
   /* Google-provided options: */
@@ -173,7 +209,9 @@ typedef enum {
   TCP_OPT_NOOP = 1,  /* no-op */
   TCP_OPT_MSS = 2,  /* maximum segment size */
   TCP_OPT_WND_SCALE = 3,  /* window scale factor */
+  TCP_OPT_SACK = 4,  /* selective acknowledgements (RFC 2018) */
   /* libnice extensions: */
+  TCP_OPT_ACK_DECIMATION = 253,  /* the sender counts bytes acked */
   TCP_OPT_FIN_ACK = 254,  /* FIN-ACK support */
 } TcpOption;
 
@@ -301,9 +339,11 @@ pseudo_tcp_fifo_set_capacity (PseudoTcpFifo *b, gsize size)
   if (b->data_length > size)
     return FALSE;
 
-  if (size != b->data_length) {
+  if (size != b->buffer_length) {
     guint8 *buffer = g_slice_alloc (size);
-    gsize copy = b->data_length;
+    /* When growing keep the whole ring, segments received out of order are
+     * stored past data_length by pseudo_tcp_fifo_write_offset(). */
+    gsize copy = size > b->buffer_length ? b->buffer_length : b->data_length;
     gsize tail_copy = min (copy, b->buffer_length - b->read_position);
 
     memcpy (buffer, &b->buffer[b->read_position], tail_copy);
@@ -392,6 +432,15 @@ pseudo_tcp_fifo_read (PseudoTcpFifo *b, guint8 *buffer, gsize bytes)
   return copy;
 }
 
+/* The buffered data up to the end of the ring, read in place. */
+static gsize
+pseudo_tcp_fifo_peek (PseudoTcpFifo *b, const guint8 **buffer)
+{
+  *buffer = &b->buffer[b->read_position];
+
+  return min (b->data_length, b->buffer_length - b->read_position);
+}
+
 static gsize
 pseudo_tcp_fifo_write (PseudoTcpFifo *b, const guint8 *buffer, gsize bytes)
 {
@@ -431,18 +480,77 @@ typedef struct {
   const gchar * data;
   guint32 len;
   guint32 tsval, tsecr;
+  struct {
+    guint32 left, right;
+  } sack[MAX_SACK_BLOCKS];
+  guint8 sack_blocks;
 } Segment;
 
+/* Segments carry their own links into the send queues, so queueing,
+ * splitting and dropping one never allocates a list node or searches a
+ * queue for it. The data of every link points back at the segment. */
 typedef struct {
+  GList link;  /* in slist */
+  GList unsent_link;  /* in unsent_slist while xmit == 0 */
+  GList tsorted_link;  /* in tsorted while sent and not SACKed or lost */
   guint32 seq, len;
   guint8 xmit;
+  guint8 sacked;  /* received out of order by the peer */
+  guint8 lost;  /* marked lost by RACK, not retransmitted yet */
+  guint8 tsorted;  /* tsorted_link is queued */
   TcpFlags flags;
+  guint32 xmit_time;  /* time of the last transmission */
 } SSegment;
 
+/* A range of out of order data, merged with its neighbours on insert so
+ * rlist holds one entry per hole rather than one per segment. */
 typedef struct {
+  GList link;
   guint32 seq, len;
 } RSegment;
 
+/* Congestion controller hooks. The core keeps NewReno's recovery mechanics,
+ * retransmissions and window inflation on duplicate ACKs, controllers only
+ * decide cwnd (and ssthresh) at these points. */
+typedef struct {
+  const gchar *name;
+  void (*init) (PseudoTcpSocket *self);
+  // Every ACK of new data, before any of the hooks below. Optional.
+  void (*on_sample) (PseudoTcpSocket *self, guint32 acked, glong rtt,
+      guint32 now);
+  // ACK of new data outside fast recovery
+  void (*on_ack) (PseudoTcpSocket *self, guint32 acked, guint32 now);
+  void (*on_recovery) (PseudoTcpSocket *self, guint32 in_flight);
+  void (*on_recovery_exit) (PseudoTcpSocket *self, guint32 in_flight);
+  void (*on_timeout) (PseudoTcpSocket *self, guint32 in_flight);
+  // Sending resumes after being idle for longer than the RTO
+  void (*on_idle) (PseudoTcpSocket *self);
+  // Rate to pace new data at, in bytes/s, 0 for the cwnd/srtt default.
+  // Optional.
+  guint32 (*pacing_rate) (PseudoTcpSocket *self);
+} CongestionOps;
+
+typedef enum {
+  BBR_STARTUP,
+  BBR_DRAIN,
+  BBR_PROBE_BW,
+  BBR_PROBE_RTT,
+} BbrMode;
+
+#define BBR_BW_ROUNDS 10
+
+typedef struct {
+  BbrMode mode;
+  guint32 bw[BBR_BW_ROUNDS];  /* per round delivery rate, bytes/s */
+  guint32 min_rtt, min_rtt_stamp;
+  guint32 delivered;
+  guint32 round_count, round_seq, round_delivered, round_stamp;
+  guint32 full_bw, full_bw_rounds;
+  guint32 cycle_index, cycle_stamp;
+  guint32 probe_rtt_done;
+  guint32 prior_cwnd;
+} BbrState;
+
 /**
  * ClosedownSource:
  * @CLOSEDOWN_LOCAL: Error detected locally, or connection forcefully closed
@@ -474,20 +582,38 @@ struct _PseudoTcpSocketPrivate {
   guint32 last_traffic;
 
   // Incoming data
-  GList *rlist;
+  GQueue rlist;
   guint32 rbuf_len, rcv_nxt, rcv_wnd, lastrecv;
   guint8 rwnd_scale; // Window scale factor
   PseudoTcpFifo rbuf;
+  /* Data handed out by pseudo_tcp_socket_peek() and not consumed yet. The
+   * reader may drop the lock meanwhile, so rbuf must not move. */
+  gboolean rbuf_peeked;
   guint32 rcv_fin;  /* sequence number of the received FIN octet, or 0 */
+  guint32 rcv_sack;  /* start of the latest out of order segment */
 
   // Outgoing data
   GQueue slist;
   GQueue unsent_slist;
+  // Sent segments by time of their last transmission, oldest first, for
+  // RACK to stop at the first one sent after the newest delivered
+  GQueue tsorted;
+  // Freed segments, chained through link.next, for reuse
+  GList *sseg_pool;
+  GList *rseg_pool;
   guint32 sbuf_len, snd_nxt, snd_wnd, lastsend;
   guint32 snd_una;  /* oldest unacknowledged sequence number */
   guint8 swnd_scale; // Window scale factor
   PseudoTcpFifo sbuf;
 
+  // Buffer autotuning, disabled in a direction when the ceiling is not
+  // above the current buffer size
+  guint32 rbuf_max, sbuf_max;
+  guint32 rcv_rtt;  /* receive side RTT, time to receive one window */
+  guint32 rcv_rtt_seq, rcv_rtt_time;
+  guint32 rcv_space;  /* most bytes the application read in one RTT */
+  guint32 rcv_space_copied, rcv_space_time;
+
   // Maximum segment size, estimated protocol level, largest segment sent
   guint32 mss, msslevel, largest, mtu_advise;
   // Retransmit timer
@@ -498,17 +624,57 @@ struct _PseudoTcpSocketPrivate {
 
   // Round-trip calculation
   guint32 rx_rttvar, rx_srtt, rx_rto;
+  guint32 rx_rtt_min;  /* smallest sample, 0 until the first one */
+  guint32 rto_min;
 
   // Congestion avoidance, Fast retransmit/recovery, Delayed ACKs
   guint32 ssthresh, cwnd;
   guint8 dup_acks;
   guint32 recover;
   gboolean fast_recovery;
+  // SACK scoreboard: bytes above snd_una the peer has, and the end of the
+  // last hole retransmitted since loss recovery started
+  guint32 sacked_bytes;
+  guint32 high_rxt;
+  // SACK blocks of the previous ACK, the peer repeats most of them
+  struct {
+    guint32 left, right;
+  } sack_seen[MAX_SACK_BLOCKS];
+  guint8 sack_seen_blocks;
+  // RACK: send time, end and RTT of the most recently sent segment that was
+  // delivered, and when the next segment sent before it times out
+  guint32 rack_xmit_time, rack_end, rack_rtt;
+  guint32 rack_timeout;
+  // A tail loss probe is out, cleared when new data is acknowledged
+  gboolean tlp_out;
+  // Pacing: bytes that may be sent now, refilled at the pacing rate since
+  // pace_time. New data is held back while it is negative, and pace_wait
+  // asks the clock to resume sending.
+  gboolean pacing;
+  gint32 pace_credit;
+  guint32 pace_time;
+  gboolean pace_wait;
+  // Path MTU probing, off while mtu_probe_max is 0: the largest MTU known
+  // to work, the smallest one that failed, and the MTU, sequence range and
+  // completion time of the last probe; mtu_probe is 0 unless one is out.
+  guint32 mtu_probe_max;
+  guint32 mtu_ok, mtu_fail;
+  guint32 mtu_probe, mtu_probe_seq, mtu_probe_end, mtu_probe_time;
+  PseudoTcpStats stats;
+  const CongestionOps *cc;
+  PseudoTcpCongestionControl cc_type;
+  BbrState bbr;
   guint32 t_ack;  /* time a delayed ack was scheduled; 0 if no acks scheduled */
   guint32 last_acked_ts;
 
   gboolean use_nagling;
   guint32 ack_delay;
+  // ACK frequency, 0 for adaptive; data segments received but not yet
+  // acknowledged; segments received in order since ack_time, and in the
+  // last receive side RTT before that
+  guint32 ack_freq;
+  guint32 ack_pending;
+  guint32 ack_segs, ack_time, ack_flight;
 
   // This is used by unit tests to test backward compatibility of
   // PseudoTcp implementations that don't support window scaling.
@@ -522,6 +688,17 @@ struct _PseudoTcpSocketPrivate {
    * option) to enable correct FIN-ACK connection termination. Defaults to
    * TRUE unless no compatible option is received. */
   gboolean support_fin_ack;
+
+  /* Selective acknowledgements, negotiated like support_fin_ack with the
+   * TCP_OPT_SACK option. The receiver never reneges on data it SACKed, it
+   * stays in rbuf until read. */
+  gboolean support_sack;
+
+  /* Set when the peer advertises TCP_OPT_ACK_DECIMATION. Its congestion
+   * window grows with the bytes acknowledged, not the number of ACKs, so
+   * it can be sent fewer ACKs than one every other segment. Older peers
+   * grow per ACK and would slow down. */
+  gboolean support_ack_decimation;
 };
 
 typedef struct _PseudoTcpSocketPrivate PseudoTcpSocketPrivate;
@@ -549,6 +726,37 @@ static void parse_options (PseudoTcpSocket *self, const guint8 *data,
     guint32 len);
 static void resize_send_buffer (PseudoTcpSocket *self, guint32 new_size);
 static void resize_receive_buffer (PseudoTcpSocket *self, guint32 new_size);
+static void rcv_space_adjust (PseudoTcpSocket *self, guint32 copied);
+static guint8 sack_build (PseudoTcpSocket *self, guint32 *blocks);
+static guint32 sack_update (PseudoTcpSocket *self, Segment *seg, guint32 now);
+static void rack_update (PseudoTcpSocket *self, SSegment *sseg, guint32 now);
+static guint32 rack_detect (PseudoTcpSocket *self, guint32 now);
+static guint32 tlp_timeout (PseudoTcpSocket *self);
+static gboolean pace_allow (PseudoTcpSocket *self, guint32 now);
+static guint32 pace_resume_time (PseudoTcpSocket *self);
+static void ack_count (PseudoTcpSocket *self, guint32 now);
+static guint32 ack_threshold (PseudoTcpSocket *self);
+static guint32 ack_timeout (PseudoTcpSocket *self);
+static guint32 mtu_probe_start (PseudoTcpSocket *self, SSegment *sseg,
+    guint32 nUseable, guint32 now);
+static void mtu_probe_acked (PseudoTcpSocket *self, guint32 now);
+static void mtu_probe_lost (PseudoTcpSocket *self, guint32 now);
+static void mtu_black_hole (PseudoTcpSocket *self, guint32 now);
+static int tail_loss_probe (PseudoTcpSocket *self, guint32 now);
+static int enter_recovery (PseudoTcpSocket *self, guint32 now);
+static int sack_retransmit (PseudoTcpSocket *self, guint32 budget,
+    guint32 now, guint32 *sent);
+static SSegment *sseg_new (PseudoTcpSocketPrivate *priv);
+static void sseg_free (PseudoTcpSocketPrivate *priv, SSegment *sseg);
+static void sseg_split (PseudoTcpSocketPrivate *priv, SSegment *sseg,
+    guint32 len);
+static void tsorted_remove (PseudoTcpSocketPrivate *priv, SSegment *sseg);
+static RSegment *rseg_new (PseudoTcpSocketPrivate *priv);
+static void rseg_free (PseudoTcpSocketPrivate *priv, RSegment *rseg);
+static void rlist_insert (PseudoTcpSocketPrivate *priv, guint32 seq,
+    guint32 len);
+static void snd_space_adjust (PseudoTcpSocket *self);
+static const CongestionOps *congestion_ops (PseudoTcpCongestionControl type);
 static void set_state (PseudoTcpSocket *self, PseudoTcpState new_state);
 static void set_state_established (PseudoTcpSocket *self);
 static void set_state_closed (PseudoTcpSocket *self, guint32 err);
@@ -623,6 +831,33 @@ pseudo_tcp_socket_get_property (PseudoTcpSocket *object,
     case PROP_SUPPORT_FIN_ACK:
       *(gboolean *)value = self->priv->support_fin_ack;
       break;
+    case PROP_SUPPORT_SACK:
+      *(gboolean *)value = self->priv->support_sack;
+      break;
+    case PROP_SUPPORT_ACK_DECIMATION:
+      *(gboolean *)value = self->priv->support_ack_decimation;
+      break;
+    case PROP_RTO_MIN:
+      *(guint32 *)value = self->priv->rto_min;
+      break;
+    case PROP_PACING:
+      *(gboolean *)value = self->priv->pacing;
+      break;
+    case PROP_MTU_PROBE_MAX:
+      *(guint32 *)value = self->priv->mtu_probe_max;
+      break;
+    case PROP_ACK_FREQUENCY:
+      *(guint32 *)value = self->priv->ack_freq;
+      break;
+    case PROP_RCV_BUF_MAX:
+      *(guint32 *)value = self->priv->rbuf_max;
+      break;
+    case PROP_SND_BUF_MAX:
+      *(guint32 *)value = self->priv->sbuf_max;
+      break;
+    case PROP_CONGESTION_CONTROL:
+      *(PseudoTcpCongestionControl *)value = self->priv->cc_type;
+      break;
     default:
       break;
   }
@@ -659,6 +894,43 @@ pseudo_tcp_socket_set_property (PseudoTcpSocket *object,
     case PROP_SUPPORT_FIN_ACK:
       self->priv->support_fin_ack = *(gboolean *)value;
       break;
+    case PROP_SUPPORT_SACK:
+      g_return_if_fail (self->priv->state == TCP_LISTEN);
+      self->priv->support_sack = *(gboolean *)value;
+      break;
+    case PROP_SUPPORT_ACK_DECIMATION:
+      g_return_if_fail (self->priv->state == TCP_LISTEN);
+      self->priv->support_ack_decimation = *(gboolean *)value;
+      break;
+    case PROP_RTO_MIN:
+      self->priv->rto_min = bound (1, *(guint32 *)value, MAX_RTO);
+      break;
+    case PROP_PACING:
+      self->priv->pacing = *(gboolean *)value;
+      self->priv->pace_wait = FALSE;
+      break;
+    case PROP_MTU_PROBE_MAX:
+      self->priv->mtu_probe_max = *(guint32 *)value;
+      self->priv->mtu_ok = self->priv->mtu_advise;
+      self->priv->mtu_fail = self->priv->mtu_probe_max + 1;
+      break;
+    case PROP_ACK_FREQUENCY:
+      self->priv->ack_freq = *(guint32 *)value;
+      break;
+    case PROP_RCV_BUF_MAX:
+      g_return_if_fail (self->priv->state == TCP_LISTEN);
+      self->priv->rbuf_max = *(guint32 *)value;
+      break;
+    case PROP_SND_BUF_MAX:
+      g_return_if_fail (self->priv->state == TCP_LISTEN);
+      self->priv->sbuf_max = *(guint32 *)value;
+      break;
+    case PROP_CONGESTION_CONTROL:
+      g_return_if_fail (self->priv->state == TCP_LISTEN);
+      self->priv->cc_type = *(PseudoTcpCongestionControl *)value;
+      self->priv->cc = congestion_ops (self->priv->cc_type);
+      self->priv->cc->init (self);
+      break;
     default:
       break;
   }
@@ -669,21 +941,26 @@ pseudo_tcp_socket_finalize (void *object)
 {
   PseudoTcpSocket *self = (PseudoTcpSocket *)object;
   PseudoTcpSocketPrivate *priv = self->priv;
-  GList *i;
-  SSegment *sseg;
+  GList *link;
 
   if (priv == NULL)
     return;
 
-  while ((sseg = g_queue_pop_head (&priv->slist)))
-    g_slice_free (SSegment, sseg);
-  g_queue_clear (&priv->unsent_slist);
-  for (i = priv->rlist; i; i = i->next) {
-    RSegment *rseg = i->data;
-    g_slice_free (RSegment, rseg);
+  // The queues link the segments themselves, there are no nodes to free
+  g_queue_init (&priv->unsent_slist);
+  g_queue_init (&priv->tsorted);
+  while ((link = g_queue_pop_head_link (&priv->slist)))
+    g_slice_free (SSegment, link->data);
+  while ((link = priv->sseg_pool)) {
+    priv->sseg_pool = link->next;
+    g_slice_free (SSegment, link->data);
+  }
+  while ((link = g_queue_pop_head_link (&priv->rlist)))
+    g_slice_free (RSegment, link->data);
+  while ((link = priv->rseg_pool)) {
+    priv->rseg_pool = link->next;
+    g_slice_free (RSegment, link->data);
   }
-  g_list_free (priv->rlist);
-  priv->rlist = NULL;
 
   pseudo_tcp_fifo_clear (&priv->rbuf);
   pseudo_tcp_fifo_clear (&priv->sbuf);
@@ -709,10 +986,17 @@ pseudo_tcp_socket_init (PseudoTcpSocket *obj)
   priv->sbuf_len = DEFAULT_SND_BUF_SIZE;
   pseudo_tcp_fifo_init (&priv->sbuf, priv->sbuf_len);
 
+  priv->rbuf_max = DEFAULT_RCV_BUF_MAX;
+  priv->sbuf_max = DEFAULT_SND_BUF_MAX;
+  priv->rcv_rtt = priv->rcv_rtt_seq = priv->rcv_rtt_time = 0;
+  priv->rcv_space = priv->rcv_space_copied = priv->rcv_space_time = 0;
+
   priv->state = TCP_LISTEN;
   priv->conv = 0;
   g_queue_init (&priv->slist);
   g_queue_init (&priv->unsent_slist);
+  g_queue_init (&priv->tsorted);
+  g_queue_init (&priv->rlist);
   priv->rcv_wnd = priv->rbuf_len;
   priv->rwnd_scale = priv->swnd_scale = 0;
   priv->snd_nxt = 0;
@@ -721,6 +1005,7 @@ pseudo_tcp_socket_init (PseudoTcpSocket *obj)
   priv->bReadEnable = TRUE;
   priv->bWriteEnable = FALSE;
   priv->rcv_fin = 0;
+  priv->rcv_sack = 0;
 
   priv->t_ack = 0;
 
@@ -739,17 +1024,41 @@ pseudo_tcp_socket_init (PseudoTcpSocket *obj)
   priv->dup_acks = 0;
   priv->recover = 0;
   priv->last_acked_ts = 0;
+  priv->sacked_bytes = priv->high_rxt = 0;
+  priv->sack_seen_blocks = 0;
+  priv->rack_xmit_time = priv->rack_end = priv->rack_rtt = 0;
+  priv->rack_timeout = 0;
+  priv->tlp_out = FALSE;
+  priv->pacing = priv->pace_wait = FALSE;
+  priv->pace_credit = 0;
+  priv->pace_time = 0;
+  priv->mtu_probe_max = 0;
+  priv->mtu_ok = priv->mtu_fail = DEF_MTU;
+  priv->mtu_probe = priv->mtu_probe_seq = priv->mtu_probe_end = 0;
+  priv->mtu_probe_time = 0;
+  memset (&priv->stats, 0, sizeof(priv->stats));
+
+  priv->cc_type = PSEUDO_TCP_CC_RENO;
+  priv->cc = congestion_ops (priv->cc_type);
+  priv->cc->init (obj);
 
   priv->ts_recent = priv->ts_lastack = 0;
 
   priv->rx_rto = DEF_RTO;
   priv->rx_srtt = priv->rx_rttvar = 0;
+  priv->rx_rtt_min = 0;
+  priv->rto_min = MIN_RTO;
 
   priv->ack_delay = DEFAULT_ACK_DELAY;
   priv->use_nagling = !DEFAULT_NO_DELAY;
+  priv->ack_freq = DEFAULT_ACK_FREQUENCY;
+  priv->ack_pending = 0;
+  priv->ack_segs = priv->ack_time = priv->ack_flight = 0;
 
   priv->support_wnd_scale = TRUE;
   priv->support_fin_ack = TRUE;
+  priv->support_sack = TRUE;
+  priv->support_ack_decimation = TRUE;
 }
 
 PseudoTcpSocket *pseudo_tcp_socket_new (guint32 conversation,
@@ -768,16 +1077,40 @@ PseudoTcpSocket *pseudo_tcp_socket_new (guint32 conversation,
   return sock;
 }
 
+// Determine the scale factor such that the scaled window size can fit
+// in a 16-bit unsigned integer.
+static guint8
+window_scale_factor (guint32 size)
+{
+  guint8 scale_factor = 0;
+
+  while (size > 0xFFFF) {
+    ++scale_factor;
+    size >>= 1;
+  }
+
+  return scale_factor;
+}
+
 static void
 queue_connect_message (PseudoTcpSocket *self)
 {
   PseudoTcpSocketPrivate *priv = self->priv;
-  guint8 buf[8];
+  guint8 buf[16];
   gsize size = 0;
 
   buf[size++] = CTL_CONNECT;
 
   if (priv->support_wnd_scale) {
+    /* The scale factor can't change once connected, so advertise one wide
+     * enough for the autotuning ceiling, and don't let the initial ssthresh
+     * cap slow start below what that window allows. */
+    if (priv->rbuf_max > priv->rbuf_len) {
+      priv->rwnd_scale = max (priv->rwnd_scale,
+          window_scale_factor (priv->rbuf_max));
+      priv->ssthresh = max (priv->ssthresh, priv->rbuf_max);
+    }
+
     buf[size++] = TCP_OPT_WND_SCALE;
     buf[size++] = 1;
     buf[size++] = priv->rwnd_scale;
@@ -789,6 +1122,18 @@ queue_connect_message (PseudoTcpSocket *self)
     buf[size++] = 0;  /* currently unused */
   }
 
+  if (priv->support_sack) {
+    buf[size++] = TCP_OPT_SACK;
+    buf[size++] = 1;
+    buf[size++] = 0;  /* currently unused */
+  }
+
+  if (priv->support_ack_decimation) {
+    buf[size++] = TCP_OPT_ACK_DECIMATION;
+    buf[size++] = 1;
+    buf[size++] = 0;  /* currently unused */
+  }
+
   priv->snd_wnd = size;
 
   queue (self, (char *) buf, size, FLAG_CTL);
@@ -835,6 +1180,10 @@ pseudo_tcp_socket_notify_mtu(PseudoTcpSocket *self, guint16 mtu)
 {
   PseudoTcpSocketPrivate *priv = self->priv;
   priv->mtu_advise = mtu;
+  // Search above the new MTU from scratch
+  priv->mtu_ok = mtu;
+  priv->mtu_fail = priv->mtu_probe_max + 1;
+  priv->mtu_probe = 0;
   if (priv->state == TCP_ESTABLISHED) {
     adjustMTU(self);
   }
@@ -869,6 +1218,37 @@ pseudo_tcp_socket_notify_clock(PseudoTcpSocket *self)
     attempt_send (self, sfFin);
   }
 
+  // Segments sent before a delivered one whose reordering window expired
+  if (priv->rack_timeout && time_diff (priv->rack_timeout, now) <= 0 &&
+      rack_detect (self, now)) {
+    int transmit_status;
+    guint32 sent;
+
+    if (!priv->fast_recovery && LARGER_OR_EQUAL (priv->snd_una, priv->recover))
+      transmit_status = enter_recovery (self, now);
+    else
+      transmit_status = sack_retransmit (self, priv->mss, now, &sent);
+    if (transmit_status != 0) {
+      DEBUG (PSEUDO_TCP_DEBUG_NORMAL,
+          "Error transmitting RACK retransmit segment. Closing down.");
+      closedown (self, transmit_status, CLOSEDOWN_LOCAL);
+      return;
+    }
+  }
+
+  // Probe for a lost tail before it takes a retransmit timeout
+  if (priv->rto_base && tlp_timeout (self) &&
+      time_diff (priv->rto_base + tlp_timeout (self), now) <= 0) {
+    int transmit_status = tail_loss_probe (self, now);
+
+    if (transmit_status != 0) {
+      DEBUG (PSEUDO_TCP_DEBUG_NORMAL,
+          "Error transmitting tail loss probe. Closing down.");
+      closedown (self, transmit_status, CLOSEDOWN_LOCAL);
+      return;
+    }
+  }
+
   // Check if it's time to retransmit a segment
   if (priv->rto_base &&
       (time_diff(priv->rto_base + priv->rx_rto, now) <= 0)) {
@@ -877,6 +1257,7 @@ pseudo_tcp_socket_notify_clock(PseudoTcpSocket *self)
     } else {
       // Note: (priv->slist.front().xmit == 0)) {
       // retransmit segments
+      SSegment *sseg;
       guint32 nInFlight;
       guint32 rto_limit;
       int transmit_status;
@@ -885,20 +1266,26 @@ pseudo_tcp_socket_notify_clock(PseudoTcpSocket *self)
           "(rto_base: %u) (now: %u) (dup_acks: %u)",
           priv->rx_rto, priv->rto_base, now, (guint) priv->dup_acks);
 
-      transmit_status = transmit(self, g_queue_peek_head (&priv->slist), now);
+      sseg = g_queue_peek_head (&priv->slist);
+
+      // Full sized segments may be dropped for being too large
+      if (sseg->xmit >= MTU_BLACK_HOLE_XMITS && priv->mtu_probe_max &&
+          priv->mtu_advise > MTU_PROBE_BASE &&
+          sseg->len > MTU_PROBE_BASE - PACKET_OVERHEAD)
+        mtu_black_hole (self, now);
+
+      transmit_status = transmit(self, sseg, now);
       if (transmit_status != 0) {
         DEBUG (PSEUDO_TCP_DEBUG_NORMAL,
             "Error transmitting segment. Closing down.");
         closedown (self, transmit_status, CLOSEDOWN_LOCAL);
         return;
       }
+      priv->high_rxt = sseg->seq + sseg->len;
 
       nInFlight = priv->snd_nxt - priv->snd_una;
-      priv->ssthresh = max(nInFlight / 2, 2 * priv->mss);
-      DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "ssthresh: %u = (nInFlight: %u / 2) + "
-          "2 * mss: %u", priv->ssthresh, nInFlight, priv->mss);
-      //LOG(LS_INFO) << "priv->ssthresh: " << priv->ssthresh << "  nInFlight: " << nInFlight << "  priv->mss: " << priv->mss;
-      priv->cwnd = priv->mss;
+      priv->cc->on_timeout (self, nInFlight);
+      priv->stats.timeouts++;
 
       // Back off retransmit timer.  Note: the limit is lower when connecting.
       rto_limit = (priv->state < TCP_ESTABLISHED) ? DEF_RTO : MAX_RTO;
@@ -932,10 +1319,16 @@ pseudo_tcp_socket_notify_clock(PseudoTcpSocket *self)
   }
 
   // Check if it's time to send delayed acks
-  if (priv->t_ack && (time_diff(priv->t_ack + priv->ack_delay, now) <= 0)) {
+  if (priv->t_ack && (time_diff(ack_timeout (self), now) <= 0)) {
     packet(self, priv->snd_nxt, 0, 0, 0, now);
   }
 
+  // Send what pacing held back
+  if (priv->pace_wait && time_diff (pace_resume_time (self), now) <= 0) {
+    priv->pace_wait = FALSE;
+    attempt_send (self, sfNone);
+  }
+
 }
 
 gboolean
@@ -1066,10 +1459,18 @@ pseudo_tcp_socket_get_next_clock(PseudoTcpSocket *self, guint64 *timeout)
   *timeout = min (*timeout, now + DEFAULT_TIMEOUT);
 
   if (priv->t_ack) {
-    *timeout = min(*timeout, priv->t_ack + priv->ack_delay);
+    *timeout = min(*timeout, ack_timeout (self));
   }
   if (priv->rto_base) {
-    *timeout = min(*timeout, priv->rto_base + priv->rx_rto);
+    guint32 pto = tlp_timeout (self);
+
+    *timeout = min(*timeout, priv->rto_base + (pto ? pto : priv->rx_rto));
+  }
+  if (priv->rack_timeout) {
+    *timeout = min(*timeout, priv->rack_timeout);
+  }
+  if (priv->pace_wait) {
+    *timeout = min(*timeout, pace_resume_time (self));
   }
   if (priv->snd_wnd == 0) {
     *timeout = min(*timeout, priv->lastsend + priv->rx_rto);
@@ -1079,12 +1480,12 @@ pseudo_tcp_socket_get_next_clock(PseudoTcpSocket *self, guint64 *timeout)
 }
 
 
-gint
-pseudo_tcp_socket_recv(PseudoTcpSocket *self, char * buffer, size_t len)
+/* Whether the application may read: 1 if so, 0 at the end of the stream,
+ * -1 with the error set otherwise. */
+static gint
+recv_check (PseudoTcpSocket *self)
 {
   PseudoTcpSocketPrivate *priv = self->priv;
-  gsize bytesread;
-  gsize available_space;
 
   /* Received a FIN from the peer, so return 0. RFC 793, §3.5, Case 2. */
   if (priv->support_fin_ack && priv->shutdown_reads) {
@@ -1103,20 +1504,35 @@ pseudo_tcp_socket_recv(PseudoTcpSocket *self, char * buffer, size_t len)
     return -1;
   }
 
-  if (len == 0)
-    return 0;
+  return 1;
+}
 
-  bytesread = pseudo_tcp_fifo_read (&priv->rbuf, (guint8 *) buffer, len);
+/* Nothing was read: fails with EWOULDBLOCK unless the peer has closed. */
+static gint
+recv_empty (PseudoTcpSocket *self)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
 
  // If there's no data in |m_rbuf|.
-  if (bytesread == 0 &&
-      !(pseudo_tcp_state_has_received_fin (priv->state) ||
+  if (!(pseudo_tcp_state_has_received_fin (priv->state) ||
         pseudo_tcp_state_has_received_fin_ack (priv->state))) {
     priv->bReadEnable = TRUE;
     priv->error = EWOULDBLOCK;
     return -1;
   }
 
+  return 0;
+}
+
+/* Reopens the receive window for @bytesread bytes the application read. */
+static void
+recv_done (PseudoTcpSocket *self, gsize bytesread)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  gsize available_space;
+
+  rcv_space_adjust (self, bytesread);
+
   available_space = pseudo_tcp_fifo_get_write_remaining (&priv->rbuf);
 
   if (available_space - priv->rcv_wnd >=
@@ -1130,10 +1546,65 @@ pseudo_tcp_socket_recv(PseudoTcpSocket *self, char * buffer, size_t len)
       attempt_send(self, sfImmediateAck);
     }
   }
+}
+
+gint
+pseudo_tcp_socket_recv(PseudoTcpSocket *self, char * buffer, size_t len)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  gsize bytesread;
+  gint rc;
+
+  rc = recv_check (self);
+  if (rc <= 0)
+    return rc;
+
+  if (len == 0)
+    return 0;
+
+  bytesread = pseudo_tcp_fifo_read (&priv->rbuf, (guint8 *) buffer, len);
+  if (bytesread == 0)
+    return recv_empty (self);
+
+  recv_done (self, bytesread);
 
   return bytesread;
 }
 
+gint
+pseudo_tcp_socket_peek(PseudoTcpSocket *self, const char **buffer)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  gsize available;
+  gint rc;
+
+  rc = recv_check (self);
+  if (rc <= 0)
+    return rc;
+
+  available = pseudo_tcp_fifo_peek (&priv->rbuf, (const guint8 **) buffer);
+  if (available == 0)
+    return recv_empty (self);
+
+  priv->rbuf_peeked = TRUE;
+
+  return (gint) min (available, (gsize) INT32_MAX);
+}
+
+void
+pseudo_tcp_socket_consume(PseudoTcpSocket *self, size_t len)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  priv->rbuf_peeked = FALSE;
+
+  if (len == 0)
+    return;
+
+  pseudo_tcp_fifo_consume_read_data (&priv->rbuf, len);
+  recv_done (self, len);
+}
+
 gint
 pseudo_tcp_socket_send(PseudoTcpSocket *self, const char * buffer, guint32 len)
 {
@@ -1288,14 +1759,14 @@ queue (PseudoTcpSocket *self, const gchar * data, guint32 len, TcpFlags flags)
       (((SSegment *)g_queue_peek_tail (&priv->slist))->xmit == 0)) {
     ((SSegment *)g_queue_peek_tail (&priv->slist))->len += len;
   } else {
-    SSegment *sseg = g_slice_new0 (SSegment);
+    SSegment *sseg = sseg_new (priv);
     gsize snd_buffered = pseudo_tcp_fifo_get_buffered (&priv->sbuf);
 
     sseg->seq = priv->snd_una + snd_buffered;
     sseg->len = len;
     sseg->flags = flags;
-    g_queue_push_tail (&priv->slist, sseg);
-    g_queue_push_tail (&priv->unsent_slist, sseg);
+    g_queue_push_tail_link (&priv->slist, &sseg->link);
+    g_queue_push_tail_link (&priv->unsent_slist, &sseg->unsent_link);
   }
 
   //LOG(LS_INFO) << "PseudoTcp::queue - priv->slen = " << priv->slen;
@@ -1322,13 +1793,19 @@ packet(PseudoTcpSocket *self, guint32 seq, TcpFlags flags,
     guint32 u32[MAX_PACKET / 4];
   } buffer;
   PseudoTcpWriteResult wres = WR_SUCCESS;
+  guint8 sack_blocks = 0;
 
   g_assert(HEADER_SIZE + len <= MAX_PACKET);
 
+  // Only pure ACKs carry SACK blocks, so data segments keep to the MSS
+  if (len == 0 && flags == FLAG_NONE && priv->support_sack &&
+      !g_queue_is_empty (&priv->rlist))
+    sack_blocks = sack_build (self, buffer.u32 + HEADER_SIZE / 4);
+
   *buffer.u32 = htonl(priv->conv);
   *(buffer.u32 + 1) = htonl(seq);
   *(buffer.u32 + 2) = htonl(priv->rcv_nxt);
-  buffer.u8[12] = 0;
+  buffer.u8[12] = sack_blocks;
   buffer.u8[13] = flags;
   *(buffer.u16 + 7) = htons((guint16)(priv->rcv_wnd >> priv->rwnd_scale));
 
@@ -1350,8 +1827,9 @@ packet(PseudoTcpSocket *self, guint32 seq, TcpFlags flags,
       priv->conv, (unsigned)flags, seq, seq + len, priv->rcv_nxt, priv->rcv_wnd,
       now % 10000, priv->ts_recent % 10000, len);
 
-  wres = priv->callbacks.WritePacket(self, (gchar *) buffer.u8, len + HEADER_SIZE,
-                                     priv->callbacks.user_data);
+  wres = priv->callbacks.WritePacket(self, (gchar *) buffer.u8,
+      len + HEADER_SIZE + sack_blocks * SACK_BLOCK_SIZE,
+      priv->callbacks.user_data);
   /* Note: When len is 0, this is an ACK packet.  We don't read the
      return value for those, and thus we won't retry.  So go ahead and treat
      the packet as a success (basically simulate as if it were dropped),
@@ -1360,6 +1838,7 @@ packet(PseudoTcpSocket *self, guint32 seq, TcpFlags flags,
     return wres;
 
   priv->t_ack = 0;
+  priv->ack_pending = 0;
   if (len > 0) {
     priv->lastsend = now;
   }
@@ -1395,6 +1874,28 @@ parse (PseudoTcpSocket *self, const guint8 *_header_buf, gsize header_buf_len,
   seg.tsval = ntohl(*(header_buf.u32 + 4));
   seg.tsecr = ntohl(*(header_buf.u32 + 5));
 
+  seg.sack_blocks = (seg.flags & FLAG_CTL) ? 0 : header_buf.u8[12];
+  if (seg.sack_blocks) {
+    guint32 edges[MAX_SACK_BLOCKS * 2];
+    guint8 i;
+
+    if (seg.sack_blocks > MAX_SACK_BLOCKS ||
+        data_buf_len < seg.sack_blocks * SACK_BLOCK_SIZE) {
+      DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Invalid SACK blocks: %u",
+          seg.sack_blocks);
+      return FALSE;
+    }
+
+    memcpy (edges, data_buf, seg.sack_blocks * SACK_BLOCK_SIZE);
+    for (i = 0; i < seg.sack_blocks; i++) {
+      seg.sack[i].left = ntohl (edges[2 * i]);
+      seg.sack[i].right = ntohl (edges[2 * i + 1]);
+    }
+
+    data_buf += seg.sack_blocks * SACK_BLOCK_SIZE;
+    data_buf_len -= seg.sack_blocks * SACK_BLOCK_SIZE;
+  }
+
   seg.data = (const gchar *) data_buf;
   seg.len = data_buf_len;
 
@@ -1493,6 +1994,7 @@ process(PseudoTcpSocket *self, Segment *seg)
   guint32 kIdealRefillSize;
   gboolean is_valuable_ack, is_duplicate_ack, is_fin_ack = FALSE;
   gboolean received_fin = FALSE;
+  guint32 nLost = 0;
 
   /* If this is the wrong conversation, send a reset!?!
      (with the correct conversation?) */
@@ -1567,10 +2069,12 @@ process(PseudoTcpSocket *self, Segment *seg)
   if (is_valuable_ack) {
     guint32 nAcked;
     guint32 nFree;
+    guint32 nDelivered;
+    glong rtt = -1;
 
     // Calculate round-trip time
     if (seg->tsecr) {
-      long rtt = time_diff(now, seg->tsecr);
+      rtt = time_diff(now, seg->tsecr);
       if (rtt >= 0) {
         if (priv->rx_srtt == 0) {
           priv->rx_srtt = rtt;
@@ -1580,8 +2084,12 @@ process(PseudoTcpSocket *self, Segment *seg)
               labs((long)(rtt - priv->rx_srtt))) / 4;
           priv->rx_srtt = (7 * priv->rx_srtt + rtt) / 8;
         }
-        priv->rx_rto = bound(MIN_RTO,
-            priv->rx_srtt + max(1LU, 4 * priv->rx_rttvar), MAX_RTO);
+        // The floor bounds the variance term like Linux does, so a queue
+        // building up on a path with a steady RTT can't fire the timer
+        priv->rx_rto = min(priv->rx_srtt +
+            max(4 * priv->rx_rttvar, priv->rto_min), MAX_RTO);
+        if (priv->rx_rtt_min == 0 || rtt < priv->rx_rtt_min)
+          priv->rx_rtt_min = max (1, rtt);
 
         DEBUG (PSEUDO_TCP_DEBUG_VERBOSE, "rtt: %ld srtt: %u rttvar: %u rto: %u",
             rtt, priv->rx_srtt, priv->rx_rttvar, priv->rx_rto);
@@ -1594,10 +2102,15 @@ process(PseudoTcpSocket *self, Segment *seg)
     }
 
     priv->snd_wnd = seg->wnd << priv->swnd_scale;
+    priv->tlp_out = FALSE;
 
     nAcked = seg->ack - priv->snd_una;
     priv->snd_una = seg->ack;
 
+    if (priv->mtu_probe &&
+        LARGER_OR_EQUAL (priv->snd_una, priv->mtu_probe_end))
+      mtu_probe_acked (self, now);
+
     priv->rto_base = (priv->snd_una == priv->snd_nxt) ? 0 : now;
 
     /* ACKs for FIN segments give an increment on nAcked, but there is no
@@ -1611,6 +2124,10 @@ process(PseudoTcpSocket *self, Segment *seg)
 
     pseudo_tcp_fifo_consume_read_data (&priv->sbuf, nAcked);
 
+    // Bytes that reached the peer with this ACK, SACKed ones were counted
+    // when they were SACKed
+    nDelivered = nAcked;
+
     for (nFree = nAcked; nFree > 0; ) {
       SSegment *data;
 
@@ -1618,6 +2135,12 @@ process(PseudoTcpSocket *self, Segment *seg)
       data = (SSegment *) g_queue_peek_head (&priv->slist);
 
       if (nFree < data->len) {
+        if (data->sacked) {
+          priv->sacked_bytes -= nFree;
+          nDelivered -= nFree;
+        } else {
+          rack_update (self, data, now);
+        }
         data->len -= nFree;
         data->seq += nFree;
         nFree = 0;
@@ -1625,26 +2148,44 @@ process(PseudoTcpSocket *self, Segment *seg)
         if (data->len > priv->largest) {
           priv->largest = data->len;
         }
+        if (data->sacked) {
+          priv->sacked_bytes -= data->len;
+          nDelivered -= data->len;
+        } else {
+          rack_update (self, data, now);
+        }
         nFree -= data->len;
-        g_slice_free (SSegment, data);
-        g_queue_pop_head (&priv->slist);
+        g_queue_pop_head_link (&priv->slist);
+        tsorted_remove (priv, data);
+        sseg_free (priv, data);
       }
     }
 
+    nDelivered += sack_update (self, seg, now);
+    nLost = rack_detect (self, now);
+
+    if (priv->cc->on_sample)
+      priv->cc->on_sample (self, nAcked, rtt, now);
+
     if (priv->dup_acks >= 3) {
       if (LARGER_OR_EQUAL (priv->snd_una, priv->recover)) { // NewReno
         guint32 nInFlight = priv->snd_nxt - priv->snd_una;
         // (Fast Retransmit)
-        priv->cwnd = min(priv->ssthresh,
-            max (nInFlight, priv->mss) + priv->mss);
+        priv->cc->on_recovery_exit (self, nInFlight);
         DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "exit recovery cwnd=%d ssthresh=%d nInFlight=%d mss: %d", priv->cwnd, priv->ssthresh, nInFlight, priv->mss);
         priv->fast_recovery = FALSE;
         priv->dup_acks = 0;
       } else {
         int transmit_status;
+        guint32 sent;
 
         DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "recovery retransmit");
-        transmit_status = transmit(self, g_queue_peek_head (&priv->slist), now);
+        if (priv->support_sack)
+          transmit_status = sack_retransmit (self, max (nDelivered, priv->mss),
+              now, &sent);
+        else
+          transmit_status = transmit(self, g_queue_peek_head (&priv->slist),
+              now);
         if (transmit_status != 0) {
           DEBUG (PSEUDO_TCP_DEBUG_NORMAL,
               "Error transmitting recovery retransmit segment. Closing down.");
@@ -1656,24 +2197,39 @@ process(PseudoTcpSocket *self, Segment *seg)
       }
     } else {
       priv->dup_acks = 0;
-      // Slow start, congestion avoidance
-      if (priv->cwnd < priv->ssthresh) {
-        priv->cwnd += priv->mss;
-      } else {
-        priv->cwnd += max(1LU, priv->mss * priv->mss / priv->cwnd);
+      priv->cc->on_ack (self, nAcked, now);
+
+      // After a timeout, resend the other holes the peer reported instead
+      // of waiting for a timeout each, growing like slow start.
+      if (priv->support_sack && SMALLER (priv->snd_una, priv->recover)) {
+        int transmit_status;
+        guint32 sent;
+
+        transmit_status = sack_retransmit (self, 2 * nDelivered, now, &sent);
+        if (transmit_status != 0) {
+          DEBUG (PSEUDO_TCP_DEBUG_NORMAL,
+              "Error transmitting SACK retransmit segment. Closing down.");
+          closedown (self, transmit_status, CLOSEDOWN_LOCAL);
+          return FALSE;
+        }
       }
     }
+
+    snd_space_adjust (self);
   } else if (is_duplicate_ack) {
+    guint32 nSacked;
+
     /* !?! Note, tcp says don't do this... but otherwise how does a
        closed window become open? */
     priv->snd_wnd = seg->wnd << priv->swnd_scale;
 
+    nSacked = sack_update (self, seg, now);
+    nLost = rack_detect (self, now);
+
     // Check duplicate acks
     if (seg->len > 0) {
       // it's a dup ack, but with a data payload, so don't modify priv->dup_acks
     } else if (priv->snd_una != priv->snd_nxt) {
-      guint32 nInFlight;
-
       priv->dup_acks += 1;
       DEBUG (PSEUDO_TCP_DEBUG_VERBOSE, "Received dup ack (dups: %u)",
           priv->dup_acks);
@@ -1684,11 +2240,7 @@ process(PseudoTcpSocket *self, Segment *seg)
         if (LARGER_OR_EQUAL (priv->snd_una, priv->recover) ||
             seg->tsecr == priv->last_acked_ts) { /* NewReno */
           /* Invoke fast retransmit  RFC3782 section 3 step 1A*/
-          DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "enter recovery");
-          DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "recovery retransmit");
-
-          transmit_status = transmit(self, g_queue_peek_head (&priv->slist),
-              now);
+          transmit_status = enter_recovery (self, now);
           if (transmit_status != 0) {
             DEBUG (PSEUDO_TCP_DEBUG_NORMAL,
                 "Error transmitting recovery retransmit segment. Closing down.");
@@ -1696,28 +2248,48 @@ process(PseudoTcpSocket *self, Segment *seg)
             closedown (self, transmit_status, CLOSEDOWN_LOCAL);
             return FALSE;
           }
-          priv->recover = priv->snd_nxt;
-          nInFlight = priv->snd_nxt - priv->snd_una;
-          priv->ssthresh = max(nInFlight / 2, 2 * priv->mss);
-          DEBUG (PSEUDO_TCP_DEBUG_NORMAL,
-              "ssthresh: %u = max((nInFlight: %u / 2), 2 * mss: %u)",
-              priv->ssthresh, nInFlight, priv->mss);
-          priv->cwnd = priv->ssthresh + 3 * priv->mss;
-          priv->fast_recovery = TRUE;
         } else {
           DEBUG (PSEUDO_TCP_DEBUG_VERBOSE,
               "Skipping fast recovery: recover: %u snd_una: %u", priv->recover,
               priv->snd_una);
         }
       } else if (priv->dup_acks > 3) {
-        if (priv->fast_recovery)
-          priv->cwnd += priv->mss;
+        if (priv->fast_recovery) {
+          guint32 sent = 0;
+
+          // Each duplicate lets one segment out, a retransmission first
+          if (priv->support_sack && nSacked) {
+            int transmit_status = sack_retransmit (self, nSacked, now, &sent);
+
+            if (transmit_status != 0) {
+              DEBUG (PSEUDO_TCP_DEBUG_NORMAL,
+                  "Error transmitting SACK retransmit segment. Closing down.");
+              closedown (self, transmit_status, CLOSEDOWN_LOCAL);
+              return FALSE;
+            }
+          }
+          if (sent < priv->mss)
+            priv->cwnd += priv->mss - sent;
+        }
       }
     } else {
       priv->dup_acks = 0;
     }
   }
 
+  // RACK found a hole before enough duplicate ACKs arrived
+  if (nLost && !priv->fast_recovery &&
+      LARGER_OR_EQUAL (priv->snd_una, priv->recover)) {
+    int transmit_status = enter_recovery (self, now);
+
+    if (transmit_status != 0) {
+      DEBUG (PSEUDO_TCP_DEBUG_NORMAL,
+          "Error transmitting recovery retransmit segment. Closing down.");
+      closedown (self, transmit_status, CLOSEDOWN_LOCAL);
+      return FALSE;
+    }
+  }
+
   // !?! A bit hacky
   if ((priv->state == TCP_SYN_RECEIVED) && !bConnect) {
     set_state_established (self);
@@ -1837,6 +2409,7 @@ process(PseudoTcpSocket *self, Segment *seg)
   if (seg->seq != priv->rcv_nxt) {
     sflags = sfDuplicateAck; // (Fast Recovery)
   } else if (seg->len != 0) {
+    ack_count (self, now);
     if (priv->ack_delay == 0) {
       sflags = sfImmediateAck;
     } else {
@@ -1906,8 +2479,23 @@ process(PseudoTcpSocket *self, Segment *seg)
         priv->rcv_wnd -= seg->len;
         bNewData = TRUE;
 
-        iter = priv->rlist;
-        while (iter &&
+        // Receive side RTT: data past the window we advertise now can't
+        // arrive before a round trip, so the time to fill it is an upper
+        // bound and the smallest sample is the estimate.
+        if (priv->rcv_rtt_time == 0) {
+          priv->rcv_rtt_seq = priv->rcv_nxt + priv->rcv_wnd;
+          priv->rcv_rtt_time = now;
+        } else if (LARGER_OR_EQUAL (priv->rcv_nxt, priv->rcv_rtt_seq)) {
+          guint32 rtt = max (1, time_diff (now, priv->rcv_rtt_time));
+
+          if (priv->rcv_rtt == 0 || rtt < priv->rcv_rtt)
+            priv->rcv_rtt = rtt;
+
+          priv->rcv_rtt_seq = priv->rcv_nxt + priv->rcv_wnd;
+          priv->rcv_rtt_time = now;
+        }
+
+        while ((iter = g_queue_peek_head_link (&priv->rlist)) &&
             SMALLER_OR_EQUAL(((RSegment *)iter->data)->seq, priv->rcv_nxt)) {
           RSegment *data = (RSegment *)(iter->data);
           if (LARGER (data->seq + data->len, priv->rcv_nxt)) {
@@ -1919,23 +2507,14 @@ process(PseudoTcpSocket *self, Segment *seg)
             priv->rcv_nxt += nAdjust;
             priv->rcv_wnd -= nAdjust;
           }
-          g_slice_free (RSegment, priv->rlist->data);
-          priv->rlist = g_list_delete_link (priv->rlist, priv->rlist);
-          iter = priv->rlist;
+          g_queue_pop_head_link (&priv->rlist);
+          rseg_free (priv, data);
         }
       } else {
-        GList *iter = NULL;
-        RSegment *rseg = g_slice_new0 (RSegment);
-
         DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Saving %u bytes (%u -> %u)",
             seg->len, seg->seq, seg->seq + seg->len);
-        rseg->seq = seg->seq;
-        rseg->len = seg->len;
-        iter = priv->rlist;
-        while (iter && SMALLER (((RSegment*)iter->data)->seq, rseg->seq)) {
-          iter = g_list_next (iter);
-        }
-        priv->rlist = g_list_insert_before(priv->rlist, iter, rseg);
+        priv->rcv_sack = seg->seq;
+        rlist_insert (priv, seg->seq, seg->len);
       }
     }
   }
@@ -1972,6 +2551,15 @@ transmit(PseudoTcpSocket *self, SSegment *segment, guint32 now)
     return ETIMEDOUT;
   }
 
+  // A probe goes out larger than the mss once; resending it means it was
+  // lost, and the data goes again in segments that are known to fit.
+  if (priv->mtu_probe && segment->seq == priv->mtu_probe_seq) {
+    if (segment->xmit == 0)
+      nTransmit = segment->len;
+    else
+      mtu_probe_lost (self, now);
+  }
+
   while (TRUE) {
     guint32 seq = segment->seq;
     guint8 flags = segment->flags;
@@ -2015,25 +2603,21 @@ transmit(PseudoTcpSocket *self, SSegment *segment, guint32 now)
   }
 
   if (nTransmit < segment->len) {
-    SSegment *subseg = g_slice_new0 (SSegment);
-    subseg->seq = segment->seq + nTransmit;
-    subseg->len = segment->len - nTransmit;
-    subseg->flags = segment->flags;
-    subseg->xmit = segment->xmit;
-
     DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "mss reduced to %u", priv->mss);
-
-    segment->len = nTransmit;
-    g_queue_insert_after (&priv->slist,
-        g_queue_find (&priv->slist, segment), subseg);
-    if (subseg->xmit == 0)
-      g_queue_insert_after (&priv->unsent_slist,
-          g_queue_find (&priv->unsent_slist, segment), subseg);
+    sseg_split (priv, segment, nTransmit);
   }
 
+  if (segment->xmit > 0)
+    priv->stats.retransmits++;
+  segment->xmit_time = now;
+  segment->lost = 0;
+  tsorted_remove (priv, segment);
+  g_queue_push_tail_link (&priv->tsorted, &segment->tsorted_link);
+  segment->tsorted = 1;
+
   if (segment->xmit == 0) {
     g_assert (g_queue_peek_head (&priv->unsent_slist) == segment);
-    g_queue_pop_head (&priv->unsent_slist);
+    g_queue_pop_head_link (&priv->unsent_slist);
     priv->snd_nxt += segment->len;
 
     /* FIN flags require acknowledgement. */
@@ -2049,6 +2633,71 @@ transmit(PseudoTcpSocket *self, SSegment *segment, guint32 now)
   return 0;
 }
 
+/* Pacing rate in bytes/s, as Linux sets it in tcp_update_pacing_rate():
+ * twice the congestion window per smoothed RTT in slow start and 1.2 times
+ * after, unless the congestion controller has a rate of its own. 0 until
+ * there is an RTT sample. */
+static guint32
+pacing_rate (PseudoTcpSocket *self)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  guint64 rate;
+
+  if (priv->cc->pacing_rate) {
+    rate = priv->cc->pacing_rate (self);
+    if (rate)
+      return (guint32)rate;
+  }
+
+  if (priv->rx_srtt == 0)
+    return 0;
+
+  rate = (guint64)priv->cwnd * 1000 / priv->rx_srtt;
+  rate = (priv->cwnd < priv->ssthresh) ? rate * 2 : rate * 6 / 5;
+
+  return (guint32)min (rate, (guint64)0xFFFFFFFF);
+}
+
+/* Whether new data may be sent now. The clock has a millisecond resolution,
+ * so up to a millisecond worth of data, and at least two segments, goes out
+ * back to back. */
+static gboolean
+pace_allow (PseudoTcpSocket *self, guint32 now)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  guint32 rate = priv->pacing ? pacing_rate (self) : 0;
+  gint64 credit, quantum;
+
+  if (rate == 0) {
+    priv->pace_credit = 0;
+    priv->pace_time = now;
+    return TRUE;
+  }
+
+  quantum = max (2 * priv->mss, rate / 1000);
+  credit = priv->pace_credit +
+      (gint64)rate * max (time_diff (now, priv->pace_time), 0) / 1000;
+
+  priv->pace_credit = (gint32)min (credit, quantum);
+  priv->pace_time = now;
+
+  return priv->pace_credit > 0;
+}
+
+/* When the credit used up by the last segments is back. */
+static guint32
+pace_resume_time (PseudoTcpSocket *self)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  guint32 rate = pacing_rate (self);
+  guint64 wait = 1;
+
+  if (rate && priv->pace_credit < 0)
+    wait = max (wait, ((guint64)-priv->pace_credit * 1000 + rate - 1) / rate);
+
+  return priv->pace_time + (guint32)min (wait, (guint64)MAX_RTO);
+}
+
 static void
 attempt_send(PseudoTcpSocket *self, SendFlags sflags)
 {
@@ -2059,7 +2708,7 @@ attempt_send(PseudoTcpSocket *self, SendFlags sflags)
   DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Attempting send with flags %u.", sflags);
 
   if (time_diff(now, priv->lastsend) > (long) priv->rx_rto) {
-    priv->cwnd = priv->mss;
+    priv->cc->on_idle (self);
   }
 
 
@@ -2096,6 +2745,13 @@ attempt_send(PseudoTcpSocket *self, SendFlags sflags)
       }
     }
 
+    // Pacing holds back new data, but not the ACKs below
+    if (nAvailable > 0 && sflags != sfFin && sflags != sfRst &&
+        !pace_allow (self, now)) {
+      nAvailable = 0;
+      priv->pace_wait = TRUE;
+    }
+
     if (bFirst) {
       gsize available_space = pseudo_tcp_fifo_get_write_remaining (&priv->sbuf);
 
@@ -2117,11 +2773,11 @@ attempt_send(PseudoTcpSocket *self, SendFlags sflags)
       if (sflags == sfNone)
         return;
 
-      // If this is an immediate ack, or the second delayed ack
+      // If this is an immediate ack, or enough delayed ones are due
       if ((sflags == sfImmediateAck || sflags == sfDuplicateAck) ||
-          priv->t_ack) {
+          priv->ack_pending >= ack_threshold (self)) {
         packet(self, priv->snd_nxt, 0, 0, 0, now);
-      } else {
+      } else if (!priv->t_ack) {
         priv->t_ack = now;
       }
       return;
@@ -2143,19 +2799,18 @@ attempt_send(PseudoTcpSocket *self, SendFlags sflags)
       return;
     sseg = iter->data;
 
-    // If the segment is too large, break it into two
-    if (sseg->len > nAvailable && sflags != sfFin && sflags != sfRst) {
-      SSegment *subseg = g_slice_new0 (SSegment);
-      subseg->seq = sseg->seq + nAvailable;
-      subseg->len = sseg->len - nAvailable;
-      subseg->flags = sseg->flags;
-
-      sseg->len = nAvailable;
-      g_queue_insert_after (&priv->unsent_slist, iter, subseg);
-      g_queue_insert_after (&priv->slist, g_queue_find (&priv->slist, sseg),
-          subseg);
+    // Now and then a larger segment finds out if the path takes it
+    if (nAvailable == priv->mss && sflags != sfFin && sflags != sfRst) {
+      guint32 nProbe = mtu_probe_start (self, sseg, nUseable, now);
+
+      if (nProbe > 0)
+        nAvailable = nProbe;
     }
 
+    // If the segment is too large, break it into two
+    if (sseg->len > nAvailable && sflags != sfFin && sflags != sfRst)
+      sseg_split (priv, sseg, nAvailable);
+
     transmit_status = transmit(self, sseg, now);
     if (transmit_status != 0) {
       DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "transmit failed");
@@ -2165,6 +2820,9 @@ attempt_send(PseudoTcpSocket *self, SendFlags sflags)
       return;
     }
 
+    if (priv->pacing)
+      priv->pace_credit -= sseg->len;
+
     if (sflags == sfImmediateAck || sflags == sfDelayedAck)
       sflags = sfNone;
   }
@@ -2239,21 +2897,448 @@ adjustMTU(PseudoTcpSocket *self)
   priv->cwnd = max(priv->cwnd, priv->mss);
 }
 
-static void
-apply_window_scale_option (PseudoTcpSocket *self, guint8 scale_factor)
+/* Returns the length of the probe to make of @sseg, the next unsent segment,
+ * or 0 when no probe is due. Probes take the upper bound first, as most
+ * paths carry a full Ethernet MTU, then halve the range left. Only a
+ * segment that is full of data and fits in the window is made a probe. */
+static guint32
+mtu_probe_start (PseudoTcpSocket *self, SSegment *sseg, guint32 nUseable,
+    guint32 now)
 {
-   PseudoTcpSocketPrivate *priv = self->priv;
+  PseudoTcpSocketPrivate *priv = self->priv;
+  guint32 mtu, len;
 
-   priv->swnd_scale = scale_factor;
-   DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Setting scale factor to %u", scale_factor);
+  if (!priv->mtu_probe_max || priv->mtu_probe ||
+      priv->state != TCP_ESTABLISHED || priv->fast_recovery ||
+      sseg->xmit > 0 || sseg->flags)
+    return 0;
+
+  if (priv->mtu_ok + MTU_PROBE_STEP >= priv->mtu_fail) {
+    if (time_diff (now, priv->mtu_probe_time) < MTU_PROBE_INTERVAL)
+      return 0;
+    // Search again in case the path changed
+    priv->mtu_probe_time = now;
+    priv->mtu_fail = priv->mtu_probe_max + 1;
+    if (priv->mtu_ok + MTU_PROBE_STEP >= priv->mtu_fail)
+      return 0;
+  }
+
+  if (priv->mtu_fail > priv->mtu_probe_max)
+    mtu = priv->mtu_probe_max;
+  else
+    mtu = (priv->mtu_ok + priv->mtu_fail) / 2;
+
+  len = mtu - PACKET_OVERHEAD;
+  if (sseg->len < len || nUseable < len)
+    return 0;
+
+  DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Probing MTU %u", mtu);
+  priv->mtu_probe = mtu;
+  priv->mtu_probe_seq = sseg->seq;
+  priv->mtu_probe_end = sseg->seq + len;
+  priv->stats.mtu_probes++;
+
+  return len;
 }
 
 static void
-apply_fin_ack_option (PseudoTcpSocket *self)
+mtu_probe_acked (PseudoTcpSocket *self, guint32 now)
 {
   PseudoTcpSocketPrivate *priv = self->priv;
 
-  priv->support_fin_ack = TRUE;
+  DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "MTU probe %u acknowledged",
+      priv->mtu_probe);
+  priv->mtu_ok = priv->mtu_advise = priv->mtu_probe;
+  priv->mtu_probe = 0;
+  priv->mtu_probe_time = now;
+  adjustMTU (self);
+}
+
+static void
+mtu_probe_lost (PseudoTcpSocket *self, guint32 now)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "MTU probe %u lost", priv->mtu_probe);
+  priv->mtu_fail = priv->mtu_probe;
+  priv->mtu_probe = 0;
+  priv->mtu_probe_time = now;
+}
+
+/* Falls back to the base MTU after repeated timeouts, when the path has
+ * started to drop segments of the size that used to work, and searches up
+ * from there. */
+static void
+mtu_black_hole (PseudoTcpSocket *self, guint32 now)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "MTU %u black holed, falling back to %u",
+      priv->mtu_advise, MTU_PROBE_BASE);
+  priv->mtu_fail = priv->mtu_advise;
+  priv->mtu_ok = priv->mtu_advise = MTU_PROBE_BASE;
+  priv->mtu_probe = 0;
+  priv->mtu_probe_time = now;
+  adjustMTU (self);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Congestion control
+//////////////////////////////////////////////////////////////////////
+
+static void
+reno_init (PseudoTcpSocket *self)
+{
+}
+
+static void
+reno_on_ack (PseudoTcpSocket *self, guint32 acked, guint32 now)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  // Slow start, congestion avoidance. Counted by the bytes acknowledged
+  // rather than by the ACKs (RFC 3465), which the peer may decimate.
+  if (priv->cwnd < priv->ssthresh) {
+    priv->cwnd += min(acked, priv->ssthresh - priv->cwnd);
+  } else {
+    priv->cwnd += max(1LU, (guint64)priv->mss * acked / priv->cwnd);
+  }
+}
+
+static void
+reno_on_recovery (PseudoTcpSocket *self, guint32 in_flight)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  priv->ssthresh = max(in_flight / 2, 2 * priv->mss);
+  DEBUG (PSEUDO_TCP_DEBUG_NORMAL,
+      "ssthresh: %u = max((nInFlight: %u / 2), 2 * mss: %u)",
+      priv->ssthresh, in_flight, priv->mss);
+  priv->cwnd = priv->ssthresh + 3 * priv->mss;
+}
+
+static void
+reno_on_recovery_exit (PseudoTcpSocket *self, guint32 in_flight)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  priv->cwnd = min(priv->ssthresh, max (in_flight, priv->mss) + priv->mss);
+}
+
+static void
+reno_on_timeout (PseudoTcpSocket *self, guint32 in_flight)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  priv->ssthresh = max(in_flight / 2, 2 * priv->mss);
+  DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "ssthresh: %u = (nInFlight: %u / 2) + "
+      "2 * mss: %u", priv->ssthresh, in_flight, priv->mss);
+  priv->cwnd = priv->mss;
+}
+
+static void
+reno_on_idle (PseudoTcpSocket *self)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  priv->cwnd = priv->mss;
+}
+
+static const CongestionOps reno_ops = {
+  "reno",
+  reno_init,
+  NULL,
+  reno_on_ack,
+  reno_on_recovery,
+  reno_on_recovery_exit,
+  reno_on_timeout,
+  reno_on_idle,
+  NULL
+};
+
+/* A simplified BBR (Cardwell et al., ACM Queue 2016). The bottleneck
+ * bandwidth is the max delivery rate over the last BBR_BW_ROUNDS round
+ * trips, the propagation delay the min RTT over BBR_MIN_RTT_WINDOW, and cwnd
+ * is their product times a gain. Pacing is optional, so the gain cycling of
+ * PROBE_BW is applied to cwnd as well as to the pacing rate. Losses don't
+ * shrink the model: recovery only conserves packets and restores the
+ * previous cwnd afterwards. */
+
+#define BBR_UNIT 256
+#define BBR_HIGH_GAIN (BBR_UNIT * 2885 / 1000 + 1)  /* 2/ln(2) */
+#define BBR_CWND_GAIN (BBR_UNIT * 2)
+#define BBR_MIN_RTT_WINDOW 10000  /* ms */
+#define BBR_PROBE_RTT_TIME 200  /* ms */
+#define BBR_MIN_CWND_SEGMENTS 4
+#define BBR_CYCLE_LEN 8
+
+static const guint32 bbr_cycle_gain[BBR_CYCLE_LEN] = {
+  BBR_UNIT * 5 / 4, BBR_UNIT * 3 / 4,
+  BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT
+};
+
+static void
+bbr_init (PseudoTcpSocket *self)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  memset (&priv->bbr, 0, sizeof(priv->bbr));
+  priv->bbr.mode = BBR_STARTUP;
+}
+
+static guint32
+bbr_max_bw (BbrState *bbr)
+{
+  guint32 bw = 0;
+  int i;
+
+  for (i = 0; i < BBR_BW_ROUNDS; i++)
+    bw = max (bw, bbr->bw[i]);
+
+  return bw;
+}
+
+/* Bandwidth-delay product scaled by gain, 0 while there is no model. */
+static guint32
+bbr_target_cwnd (BbrState *bbr, guint32 gain)
+{
+  return (guint32)((guint64)bbr_max_bw (bbr) * bbr->min_rtt / 1000 *
+      gain / BBR_UNIT);
+}
+
+static gboolean
+bbr_full_bw_reached (BbrState *bbr)
+{
+  return bbr->full_bw_rounds >= 3;
+}
+
+static void
+bbr_set_mode (PseudoTcpSocket *self, BbrMode mode, guint32 now)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  static const gchar *names[] = { "STARTUP", "DRAIN", "PROBE_BW", "PROBE_RTT" };
+
+  DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "BBR %s -> %s (bw: %u B/s, min_rtt: %u ms)",
+      names[priv->bbr.mode], names[mode], bbr_max_bw (&priv->bbr),
+      priv->bbr.min_rtt);
+
+  priv->bbr.mode = mode;
+  priv->bbr.cycle_index = 2;
+  priv->bbr.cycle_stamp = now;
+}
+
+static void
+bbr_on_sample (PseudoTcpSocket *self, guint32 acked, glong rtt, guint32 now)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  BbrState *bbr = &priv->bbr;
+  guint32 in_flight = priv->snd_nxt - priv->snd_una;
+  gboolean rtt_expired;
+
+  bbr->delivered += acked;
+
+  rtt_expired = bbr->min_rtt &&
+      time_diff (now, bbr->min_rtt_stamp) > BBR_MIN_RTT_WINDOW;
+  if (rtt >= 0 && (bbr->min_rtt == 0 || (guint32)rtt < bbr->min_rtt ||
+      rtt_expired)) {
+    bbr->min_rtt = max (1, rtt);
+    bbr->min_rtt_stamp = now;
+  }
+
+  // One delivery rate sample per round trip
+  if (LARGER_OR_EQUAL (priv->snd_una, bbr->round_seq)) {
+    glong interval = time_diff (now, bbr->round_stamp);
+
+    if (bbr->round_stamp && interval > 0) {
+      bbr->bw[bbr->round_count % BBR_BW_ROUNDS] = (guint32)
+          ((guint64)(bbr->delivered - bbr->round_delivered) * 1000 / interval);
+      bbr->round_count++;
+
+      if (!bbr_full_bw_reached (bbr)) {
+        guint32 bw = bbr_max_bw (bbr);
+
+        // Startup ends when the rate grew less than 25% in three rounds
+        if (bw >= (guint64)bbr->full_bw * 5 / 4) {
+          bbr->full_bw = bw;
+          bbr->full_bw_rounds = 0;
+        } else {
+          bbr->full_bw_rounds++;
+        }
+      }
+    }
+
+    bbr->round_seq = priv->snd_nxt;
+    bbr->round_delivered = bbr->delivered;
+    bbr->round_stamp = now;
+  }
+
+  switch (bbr->mode) {
+  case BBR_STARTUP:
+    if (bbr_full_bw_reached (bbr))
+      bbr_set_mode (self, BBR_DRAIN, now);
+    break;
+  case BBR_DRAIN:
+    if (in_flight <= bbr_target_cwnd (bbr, BBR_UNIT))
+      bbr_set_mode (self, BBR_PROBE_BW, now);
+    break;
+  case BBR_PROBE_BW:
+    if (time_diff (now, bbr->cycle_stamp) > (glong)bbr->min_rtt) {
+      bbr->cycle_index = (bbr->cycle_index + 1) % BBR_CYCLE_LEN;
+      bbr->cycle_stamp = now;
+    }
+    break;
+  case BBR_PROBE_RTT:
+    // Hold the small window for a while once the queue has drained
+    if (bbr->probe_rtt_done == 0 &&
+        in_flight <= BBR_MIN_CWND_SEGMENTS * priv->mss) {
+      bbr->probe_rtt_done = max (1, now + BBR_PROBE_RTT_TIME);
+    } else if (bbr->probe_rtt_done &&
+        time_diff (now, bbr->probe_rtt_done) >= 0) {
+      bbr->min_rtt_stamp = now;
+      priv->cwnd = max (priv->cwnd, bbr->prior_cwnd);
+      bbr_set_mode (self, bbr_full_bw_reached (bbr) ?
+          BBR_PROBE_BW : BBR_STARTUP, now);
+    }
+    break;
+  }
+
+  if (rtt_expired && bbr->mode != BBR_PROBE_RTT) {
+    bbr->prior_cwnd = priv->cwnd;
+    bbr->probe_rtt_done = 0;
+    bbr_set_mode (self, BBR_PROBE_RTT, now);
+  }
+}
+
+static void
+bbr_on_ack (PseudoTcpSocket *self, guint32 acked, guint32 now)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  BbrState *bbr = &priv->bbr;
+  guint32 min_cwnd = BBR_MIN_CWND_SEGMENTS * priv->mss;
+  guint32 gain, target;
+
+  switch (bbr->mode) {
+  case BBR_STARTUP:
+    gain = BBR_HIGH_GAIN;
+    break;
+  case BBR_DRAIN:
+    gain = BBR_UNIT;
+    break;
+  case BBR_PROBE_RTT:
+    priv->cwnd = min (priv->cwnd, min_cwnd);
+    return;
+  default:
+    gain = BBR_CWND_GAIN * bbr_cycle_gain[bbr->cycle_index] / BBR_UNIT;
+    break;
+  }
+
+  target = bbr_target_cwnd (bbr, gain);
+
+  if (bbr_full_bw_reached (bbr))
+    priv->cwnd = min (priv->cwnd + acked, max (target, min_cwnd));
+  else if (target == 0 || priv->cwnd < target)
+    priv->cwnd += acked;
+
+  priv->cwnd = max (priv->cwnd, min_cwnd);
+}
+
+static void
+bbr_on_recovery (PseudoTcpSocket *self, guint32 in_flight)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  // Packet conservation, window inflation sends one segment per dup ACK
+  priv->bbr.prior_cwnd = priv->cwnd;
+  priv->cwnd = max (in_flight, BBR_MIN_CWND_SEGMENTS * priv->mss);
+}
+
+static void
+bbr_on_recovery_exit (PseudoTcpSocket *self, guint32 in_flight)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  priv->cwnd = max (priv->cwnd, priv->bbr.prior_cwnd);
+}
+
+static void
+bbr_on_timeout (PseudoTcpSocket *self, guint32 in_flight)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  // bbr_on_ack() grows back towards the model by the bytes acked
+  priv->cwnd = priv->mss;
+}
+
+static void
+bbr_on_idle (PseudoTcpSocket *self)
+{
+  // The model stays valid across idle periods.
+}
+
+static guint32
+bbr_pacing_rate (PseudoTcpSocket *self)
+{
+  BbrState *bbr = &self->priv->bbr;
+  guint32 gain;
+
+  switch (bbr->mode) {
+  case BBR_STARTUP:
+    gain = BBR_HIGH_GAIN;
+    break;
+  case BBR_DRAIN:
+    gain = BBR_UNIT * BBR_UNIT / BBR_HIGH_GAIN;
+    break;
+  case BBR_PROBE_RTT:
+    gain = BBR_UNIT;
+    break;
+  default:
+    gain = bbr_cycle_gain[bbr->cycle_index];
+    break;
+  }
+
+  return (guint32)min ((guint64)bbr_max_bw (bbr) * gain / BBR_UNIT,
+      (guint64)0xFFFFFFFF);
+}
+
+static const CongestionOps bbr_ops = {
+  "bbr",
+  bbr_init,
+  bbr_on_sample,
+  bbr_on_ack,
+  bbr_on_recovery,
+  bbr_on_recovery_exit,
+  bbr_on_timeout,
+  bbr_on_idle,
+  bbr_pacing_rate
+};
+
+static const CongestionOps *
+congestion_ops (PseudoTcpCongestionControl type)
+{
+  switch (type) {
+  case PSEUDO_TCP_CC_BBR:
+    return &bbr_ops;
+  case PSEUDO_TCP_CC_RENO:
+  default:
+    return &reno_ops;
+  }
+}
+
+static void
+apply_window_scale_option (PseudoTcpSocket *self, guint8 scale_factor)
+{
+   PseudoTcpSocketPrivate *priv = self->priv;
+
+   priv->swnd_scale = scale_factor;
+   DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Setting scale factor to %u", scale_factor);
+}
+
+static void
+apply_fin_ack_option (PseudoTcpSocket *self)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  priv->support_fin_ack = TRUE;
 }
 
 static void
@@ -2280,6 +3365,14 @@ apply_option (PseudoTcpSocket *self, guint8 kind, const guint8 *data,
     DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "FIN-ACK support enabled.");
     apply_fin_ack_option (self);
     break;
+  case TCP_OPT_SACK:
+    // Only kept if we advertise it too, see queue_connect_message().
+    DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Peer supports SACK.");
+    break;
+  case TCP_OPT_ACK_DECIMATION:
+    // Only kept if we advertise it too, see queue_connect_message().
+    DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Peer supports ACK decimation.");
+    break;
   case TCP_OPT_EOL:
   case TCP_OPT_NOOP:
     /* Nothing to do. */
@@ -2297,6 +3390,8 @@ parse_options (PseudoTcpSocket *self, const guint8 *data, guint32 len)
   PseudoTcpSocketPrivate *priv = self->priv;
   gboolean has_window_scaling_option = FALSE;
   gboolean has_fin_ack_option = FALSE;
+  gboolean has_sack_option = FALSE;
+  gboolean has_ack_decimation_option = FALSE;
   guint32 pos = 0;
 
   // See http://www.freesoft.org/CIE/Course/Section4/8.htm for
@@ -2342,10 +3437,16 @@ parse_options (PseudoTcpSocket *self, const guint8 *data, guint32 len)
       has_window_scaling_option = TRUE;
     else if (kind == TCP_OPT_FIN_ACK)
       has_fin_ack_option = TRUE;
+    else if (kind == TCP_OPT_SACK)
+      has_sack_option = TRUE;
+    else if (kind == TCP_OPT_ACK_DECIMATION)
+      has_ack_decimation_option = TRUE;
   }
 
   if (!has_window_scaling_option) {
     DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Peer doesn't support window scaling");
+    // Unscaled windows can't advertise more than 64 KB.
+    priv->rbuf_max = min (priv->rbuf_max, 0xFFFF);
     if (priv->rwnd_scale > 0) {
       // Peer doesn't support TCP options and window scaling.
       // Revert receive buffer size to default value.
@@ -2358,6 +3459,16 @@ parse_options (PseudoTcpSocket *self, const guint8 *data, guint32 len)
     DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Peer doesn't support FIN-ACK");
     priv->support_fin_ack = FALSE;
   }
+
+  if (!has_sack_option) {
+    DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Peer doesn't support SACK");
+    priv->support_sack = FALSE;
+  }
+
+  if (!has_ack_decimation_option) {
+    DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Peer doesn't support ACK decimation");
+    priv->support_ack_decimation = FALSE;
+  }
 }
 
 static void
@@ -2374,22 +3485,20 @@ static void
 resize_receive_buffer (PseudoTcpSocket *self, guint32 new_size)
 {
   PseudoTcpSocketPrivate *priv = self->priv;
-  guint8 scale_factor = 0;
+  guint8 scale_factor = window_scale_factor (new_size);
   gboolean result;
   gsize available_space;
 
-  if (priv->rbuf_len == new_size)
+  if (priv->rbuf_len == new_size && priv->rwnd_scale == scale_factor)
     return;
 
-  // Determine the scale factor such that the scaled window size can fit
-  // in a 16-bit unsigned integer.
-  while (new_size > 0xFFFF) {
-    ++scale_factor;
-    new_size >>= 1;
+  if (priv->rbuf_peeked) {
+    DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Receive buffer in use, not resized");
+    return;
   }
 
   // Determine the proper size of the buffer.
-  new_size <<= scale_factor;
+  new_size = (new_size >> scale_factor) << scale_factor;
   result = pseudo_tcp_fifo_set_capacity (&priv->rbuf, new_size);
 
   // Make sure the new buffer is large enough to contain data in the old
@@ -2405,6 +3514,602 @@ resize_receive_buffer (PseudoTcpSocket *self, guint32 new_size)
   priv->rcv_wnd = available_space;
 }
 
+/* Grow the receive buffer to twice what the application read in the last
+ * round trip, as Linux does in tcp_rcv_space_adjust(). A window limited
+ * flow reads the whole buffer every RTT, so the buffer doubles until the
+ * path, not the window, is the bottleneck. */
+static void
+rcv_space_adjust (PseudoTcpSocket *self, guint32 copied)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  guint32 now = get_current_time (self);
+  guint32 rtt = priv->rcv_rtt ? priv->rcv_rtt : priv->rx_srtt;
+  guint32 limit, new_size;
+
+  if (priv->rbuf_max <= priv->rbuf_len || priv->rbuf_peeked)
+    return;
+
+  priv->rcv_space_copied += copied;
+
+  if (priv->rcv_space_time == 0) {
+    priv->rcv_space_time = now;
+    return;
+  }
+
+  if (rtt == 0 || time_diff (now, priv->rcv_space_time) < (long)rtt)
+    return;
+
+  if (priv->rcv_space_copied > priv->rcv_space) {
+    priv->rcv_space = priv->rcv_space_copied;
+
+    limit = min (priv->rbuf_max, (guint32)0xFFFF << priv->rwnd_scale);
+    new_size = min (2 * (guint64)priv->rcv_space, limit);
+
+    if (new_size > priv->rbuf_len &&
+        pseudo_tcp_fifo_set_capacity (&priv->rbuf, new_size)) {
+      DEBUG (PSEUDO_TCP_DEBUG_NORMAL,
+          "Receive buffer %u -> %u bytes (%u bytes in %u ms)",
+          priv->rbuf_len, new_size, priv->rcv_space, rtt);
+      priv->rbuf_len = new_size;
+    }
+  }
+
+  priv->rcv_space_copied = 0;
+  priv->rcv_space_time = now;
+}
+
+/* Keep the send buffer at twice the usable window so the application can
+ * refill it while a full window is in flight. */
+static void
+snd_space_adjust (PseudoTcpSocket *self)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  guint32 new_size;
+
+  if (priv->sbuf_max <= priv->sbuf_len)
+    return;
+
+  new_size = min (2 * (guint64)min (priv->cwnd, priv->snd_wnd),
+      priv->sbuf_max);
+  if (new_size > priv->sbuf_len) {
+    DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Send buffer %u -> %u bytes",
+        priv->sbuf_len, new_size);
+    resize_send_buffer (self, new_size);
+  }
+}
+
+/* Counts an in-order data segment towards the next ACK, and towards the
+ * segments received per round trip. */
+static void
+ack_count (PseudoTcpSocket *self, guint32 now)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  priv->ack_pending++;
+  priv->ack_segs++;
+
+  if (priv->ack_time == 0) {
+    priv->ack_time = now;
+  } else if (priv->rcv_rtt &&
+      time_diff (now, priv->ack_time) >= (long)priv->rcv_rtt) {
+    priv->ack_flight = priv->ack_segs;
+    priv->ack_segs = 0;
+    priv->ack_time = now;
+  }
+}
+
+/* Data segments to receive before acknowledging them at once. Adaptive
+ * decimation acknowledges every other one of a small flight, and about
+ * four times a round trip, up to every ACK_DECIMATION_MAX, as the flight
+ * grows, which keeps the sender's clock going. It needs a peer that
+ * advertised TCP_OPT_ACK_DECIMATION, others get every other segment
+ * acknowledged. */
+static guint32
+ack_threshold (PseudoTcpSocket *self)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  if (priv->ack_freq)
+    return priv->ack_freq;
+
+  if (!priv->support_ack_decimation)
+    return DEFAULT_ACK_FREQUENCY;
+
+  return bound (2, priv->ack_flight / 4, ACK_DECIMATION_MAX);
+}
+
+/* When the delayed ACK scheduled at t_ack goes out. */
+static guint32
+ack_timeout (PseudoTcpSocket *self)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  guint32 delay = priv->ack_delay;
+
+  if (ack_threshold (self) > 2 && priv->rcv_rtt)
+    delay = min (delay, max (1, priv->rcv_rtt / 4));
+
+  return priv->t_ack + delay;
+}
+
+/* g_queue_insert_after() for a caller owned link. */
+static void
+queue_insert_link_after (GQueue *queue, GList *sibling, GList *link)
+{
+  link->prev = sibling;
+  link->next = sibling->next;
+  if (sibling->next)
+    sibling->next->prev = link;
+  else
+    queue->tail = link;
+  sibling->next = link;
+  queue->length++;
+}
+
+/* Takes a segment from the pool, or allocates one. */
+static SSegment *
+sseg_new (PseudoTcpSocketPrivate *priv)
+{
+  GList *link = priv->sseg_pool;
+  SSegment *sseg;
+
+  if (link) {
+    priv->sseg_pool = link->next;
+    sseg = link->data;
+    memset (sseg, 0, sizeof(SSegment));
+  } else {
+    sseg = g_slice_new0 (SSegment);
+  }
+
+  sseg->link.data = sseg;
+  sseg->unsent_link.data = sseg;
+  sseg->tsorted_link.data = sseg;
+
+  return sseg;
+}
+
+/* Returns @sseg, no longer queued anywhere, to the pool. */
+static void
+sseg_free (PseudoTcpSocketPrivate *priv, SSegment *sseg)
+{
+  sseg->link.next = priv->sseg_pool;
+  priv->sseg_pool = &sseg->link;
+}
+
+/* Cuts @sseg down to @len bytes and queues the rest right after it, in
+ * every queue @sseg is in. */
+static void
+sseg_split (PseudoTcpSocketPrivate *priv, SSegment *sseg, guint32 len)
+{
+  SSegment *subseg = sseg_new (priv);
+
+  subseg->seq = sseg->seq + len;
+  subseg->len = sseg->len - len;
+  subseg->flags = sseg->flags;
+  subseg->xmit = sseg->xmit;
+  subseg->sacked = sseg->sacked;
+  subseg->lost = sseg->lost;
+  subseg->xmit_time = sseg->xmit_time;
+  sseg->len = len;
+
+  queue_insert_link_after (&priv->slist, &sseg->link, &subseg->link);
+  if (sseg->xmit == 0)
+    queue_insert_link_after (&priv->unsent_slist, &sseg->unsent_link,
+        &subseg->unsent_link);
+  if (sseg->tsorted) {
+    queue_insert_link_after (&priv->tsorted, &sseg->tsorted_link,
+        &subseg->tsorted_link);
+    subseg->tsorted = 1;
+  }
+}
+
+static void
+tsorted_remove (PseudoTcpSocketPrivate *priv, SSegment *sseg)
+{
+  if (sseg->tsorted) {
+    g_queue_unlink (&priv->tsorted, &sseg->tsorted_link);
+    sseg->tsorted = 0;
+  }
+}
+
+static RSegment *
+rseg_new (PseudoTcpSocketPrivate *priv)
+{
+  GList *link = priv->rseg_pool;
+  RSegment *rseg;
+
+  if (link) {
+    priv->rseg_pool = link->next;
+    rseg = link->data;
+    memset (rseg, 0, sizeof(RSegment));
+  } else {
+    rseg = g_slice_new0 (RSegment);
+  }
+
+  rseg->link.data = rseg;
+
+  return rseg;
+}
+
+static void
+rseg_free (PseudoTcpSocketPrivate *priv, RSegment *rseg)
+{
+  rseg->link.next = priv->rseg_pool;
+  priv->rseg_pool = &rseg->link;
+}
+
+/* Records out of order data at @seq, merging it with the ranges it
+ * overlaps or touches. Data mostly arrives above the highest range, so
+ * the search starts from the tail. */
+static void
+rlist_insert (PseudoTcpSocketPrivate *priv, guint32 seq, guint32 len)
+{
+  GList *prev = g_queue_peek_tail_link (&priv->rlist);
+  GList *next;
+  RSegment *rseg;
+
+  while (prev && LARGER (((RSegment *)prev->data)->seq, seq))
+    prev = prev->prev;
+
+  rseg = prev ? prev->data : NULL;
+  if (rseg && LARGER_OR_EQUAL (rseg->seq + rseg->len, seq)) {
+    if (LARGER (seq + len, rseg->seq + rseg->len))
+      rseg->len = seq + len - rseg->seq;
+  } else {
+    rseg = rseg_new (priv);
+    rseg->seq = seq;
+    rseg->len = len;
+    if (prev)
+      queue_insert_link_after (&priv->rlist, prev, &rseg->link);
+    else
+      g_queue_push_head_link (&priv->rlist, &rseg->link);
+  }
+
+  while ((next = rseg->link.next) &&
+      SMALLER_OR_EQUAL (((RSegment *)next->data)->seq, rseg->seq + rseg->len)) {
+    RSegment *merged = next->data;
+
+    if (LARGER (merged->seq + merged->len, rseg->seq + rseg->len))
+      rseg->len = merged->seq + merged->len - rseg->seq;
+    g_queue_unlink (&priv->rlist, next);
+    rseg_free (priv, merged);
+  }
+}
+
+/* Fills @blocks with the out of order ranges in rlist as network order
+ * (left, right) pairs, the one holding the latest arrival first and then
+ * the lowest ones (RFC 2018, §4). Returns the number of blocks. */
+static guint8
+sack_build (PseudoTcpSocket *self, guint32 *blocks)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  guint32 left[MAX_SACK_BLOCKS], right[MAX_SACK_BLOCKS];
+  gboolean found = FALSE;
+  guint8 count = 1, i;
+  GList *iter;
+
+  // rlist is sorted by seq, with overlapping and adjacent ranges merged
+  for (iter = g_queue_peek_head_link (&priv->rlist); iter;
+      iter = iter->next) {
+    RSegment *rseg = iter->data;
+    guint32 start = rseg->seq;
+    guint32 end = rseg->seq + rseg->len;
+
+    if (!found && SMALLER_OR_EQUAL (start, priv->rcv_sack) &&
+        SMALLER (priv->rcv_sack, end)) {
+      left[0] = start;
+      right[0] = end;
+      found = TRUE;
+    } else if (count < MAX_SACK_BLOCKS) {
+      left[count] = start;
+      right[count] = end;
+      count++;
+    } else if (found) {
+      break;
+    }
+  }
+
+  for (i = found ? 0 : 1; i < count; i++) {
+    *blocks++ = htonl (left[i]);
+    *blocks++ = htonl (right[i]);
+  }
+
+  return found ? count : count - 1;
+}
+
+/* Marks the sent segments covered by the SACK blocks of @seg. Returns the
+ * number of bytes newly SACKed. */
+static guint32
+sack_update (PseudoTcpSocket *self, Segment *seg, guint32 now)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  guint32 seen_left[MAX_SACK_BLOCKS], seen_right[MAX_SACK_BLOCKS];
+  guint32 newly_sacked = 0;
+  guint8 seen = 0;
+  guint8 i, j;
+
+  if (!priv->support_sack)
+    return 0;
+
+  for (i = 0; i < seg->sack_blocks; i++) {
+    guint32 left = seg->sack[i].left;
+    guint32 right = seg->sack[i].right;
+    GList *iter;
+
+    if (SMALLER_OR_EQUAL (right, priv->snd_una) ||
+        LARGER (right, priv->snd_nxt) || !SMALLER (left, right)) {
+      DEBUG (PSEUDO_TCP_DEBUG_VERBOSE, "Ignoring SACK block %u-%u",
+          left, right);
+      continue;
+    }
+
+    // Segments stay SACKed, a block inside one already seen has no news
+    for (j = 0; j < priv->sack_seen_blocks; j++) {
+      if (SMALLER_OR_EQUAL (priv->sack_seen[j].left, left) &&
+          SMALLER_OR_EQUAL (right, priv->sack_seen[j].right))
+        break;
+    }
+    seen_left[seen] = left;
+    seen_right[seen++] = right;
+    if (j < priv->sack_seen_blocks)
+      continue;
+
+    // Walk in from the closer end of the queue: the newest block sits
+    // near snd_nxt, the others near snd_una
+    if (left - priv->snd_una < priv->snd_nxt - right) {
+      iter = g_queue_peek_head_link (&priv->slist);
+      while (iter && SMALLER (((SSegment *)iter->data)->seq, left))
+        iter = iter->next;
+    } else {
+      iter = g_queue_peek_tail_link (&priv->slist);
+      while (iter && LARGER_OR_EQUAL (((SSegment *)iter->data)->seq, left))
+        iter = iter->prev;
+      iter = iter ? iter->next : g_queue_peek_head_link (&priv->slist);
+    }
+
+    for (; iter; iter = iter->next) {
+      SSegment *sseg = iter->data;
+
+      if (sseg->xmit == 0 || SMALLER_OR_EQUAL (right, sseg->seq))
+        break;
+
+      if (!sseg->sacked && SMALLER_OR_EQUAL (sseg->seq + sseg->len, right)) {
+        sseg->sacked = 1;
+        priv->sacked_bytes += sseg->len;
+        newly_sacked += sseg->len;
+        rack_update (self, sseg, now);
+        tsorted_remove (priv, sseg);
+      }
+    }
+  }
+
+  for (i = 0; i < seen; i++) {
+    priv->sack_seen[i].left = seen_left[i];
+    priv->sack_seen[i].right = seen_right[i];
+  }
+  priv->sack_seen_blocks = seen;
+
+  return newly_sacked;
+}
+
+/* Retransmits about @budget bytes of the holes the scoreboard has found
+ * lost: the ones RACK marked, and past high_rxt, in fast recovery the ones
+ * with more than (DUP_THRESH - 1) segments SACKed above them (RFC 6675,
+ * IsLost()) or next after a partial ACK. After a timeout, every hole below
+ * recover is. */
+static int
+sack_retransmit (PseudoTcpSocket *self, guint32 budget, guint32 now,
+    guint32 *sent)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  guint32 sacked_above = priv->sacked_bytes;
+  GList *iter;
+
+  *sent = 0;
+
+  for (iter = g_queue_peek_head_link (&priv->slist);
+      iter && *sent < budget; iter = iter->next) {
+    SSegment *sseg = iter->data;
+    int transmit_status;
+
+    if (sseg->xmit == 0)
+      break;
+
+    if (sseg->sacked) {
+      sacked_above -= sseg->len;
+      continue;
+    }
+
+    if (sseg->lost) {
+      // Found by RACK, even below high_rxt
+    } else if (SMALLER (sseg->seq, priv->high_rxt)) {
+      continue;
+    } else if (priv->fast_recovery) {
+      if (sseg->seq != priv->snd_una &&
+          sacked_above <= (DUP_THRESH - 1) * priv->mss)
+        continue;
+    } else if (!SMALLER (sseg->seq, priv->recover)) {
+      continue;
+    }
+
+    DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "SACK retransmit %u-%u (sacked: %u)",
+        sseg->seq, sseg->seq + sseg->len, priv->sacked_bytes);
+
+    transmit_status = transmit (self, sseg, now);
+    if (transmit_status != 0)
+      return transmit_status;
+
+    *sent += sseg->len;
+    if (LARGER (sseg->seq + sseg->len, priv->high_rxt))
+      priv->high_rxt = sseg->seq + sseg->len;
+  }
+
+  return 0;
+}
+
+/* Takes @sseg, just acknowledged or SACKed, as the most recently sent
+ * delivered segment if it was sent after the current one (RFC 8985, §6.2). */
+static void
+rack_update (PseudoTcpSocket *self, SSegment *sseg, guint32 now)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  glong rtt = time_diff (now, sseg->xmit_time);
+
+  // Too fast for the last transmission, the ACK is for an earlier one
+  if (sseg->xmit > 1 && rtt < (glong)priv->rx_rtt_min)
+    return;
+
+  if (priv->rack_rtt == 0 ||
+      time_diff (sseg->xmit_time, priv->rack_xmit_time) > 0 ||
+      (sseg->xmit_time == priv->rack_xmit_time &&
+       LARGER (sseg->seq + sseg->len, priv->rack_end))) {
+    priv->rack_xmit_time = sseg->xmit_time;
+    priv->rack_end = sseg->seq + sseg->len;
+    priv->rack_rtt = max (1, rtt);
+  }
+}
+
+/* Marks the segments sent before the most recently sent delivered one as
+ * lost once they have been out for its RTT plus a reordering window of a
+ * quarter of the minimum RTT, and arms rack_timeout for the first one that
+ * isn't due yet. Needs SACK to see deliveries past a hole. Returns the
+ * number of segments newly marked. */
+static guint32
+rack_detect (PseudoTcpSocket *self, guint32 now)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  guint32 reo_wnd = priv->rx_rtt_min / 4;
+  guint32 marked = 0;
+  GList *iter, *next;
+
+  priv->rack_timeout = 0;
+
+  if (!priv->support_sack || priv->rack_rtt == 0)
+    return 0;
+
+  // Only segments neither SACKed nor marked yet are on tsorted
+  for (iter = g_queue_peek_head_link (&priv->tsorted); iter; iter = next) {
+    SSegment *sseg = iter->data;
+    glong remaining;
+
+    next = iter->next;
+
+    if (time_diff (sseg->xmit_time, priv->rack_xmit_time) > 0)
+      break;
+    if (sseg->xmit_time == priv->rack_xmit_time &&
+        !SMALLER (sseg->seq + sseg->len, priv->rack_end))
+      continue;
+
+    remaining = time_diff (sseg->xmit_time + priv->rack_rtt + reo_wnd, now);
+    if (remaining <= 0) {
+      DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "RACK lost %u-%u (sent: %u rtt: %u)",
+          sseg->seq, sseg->seq + sseg->len, sseg->xmit_time, priv->rack_rtt);
+      sseg->lost = 1;
+      tsorted_remove (priv, sseg);
+      priv->stats.rack_losses++;
+      marked++;
+    } else {
+      // The rest were sent later and time out later
+      priv->rack_timeout = now + remaining;
+      break;
+    }
+  }
+
+  return marked;
+}
+
+/* Fast retransmit: resends the first hole and lets the congestion
+ * controller react (RFC 6582, §3.2 step 2). */
+static int
+enter_recovery (PseudoTcpSocket *self, guint32 now)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  SSegment *sseg = g_queue_peek_head (&priv->slist);
+  guint32 nInFlight;
+  int transmit_status;
+
+  DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "enter recovery");
+  DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "recovery retransmit");
+
+  transmit_status = transmit (self, sseg, now);
+  if (transmit_status != 0)
+    return transmit_status;
+
+  priv->high_rxt = sseg->seq + sseg->len;
+  priv->recover = priv->snd_nxt;
+  nInFlight = priv->snd_nxt - priv->snd_una;
+  priv->cc->on_recovery (self, nInFlight);
+  priv->fast_recovery = TRUE;
+  // RACK may get here first, the ACK handling keys recovery on this
+  priv->dup_acks = max (priv->dup_acks, DUP_THRESH);
+  priv->stats.fast_recoveries++;
+
+  return 0;
+}
+
+/* Probe timeout, 0 when no probe is due: one per flight, with an RTT
+ * sample, and not while recovering (RFC 8985, §7.2). */
+static guint32
+tlp_timeout (PseudoTcpSocket *self)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  guint32 pto;
+
+  if (priv->tlp_out || priv->rx_rtt_min == 0 ||
+      priv->state != TCP_ESTABLISHED || priv->fast_recovery ||
+      SMALLER (priv->snd_una, priv->recover))
+    return 0;
+
+  pto = 2 * priv->rx_srtt;
+  if (priv->snd_nxt - priv->snd_una <= priv->mss)
+    pto += TLP_ACK_DELAY;
+  pto = max (pto, TLP_MIN_TIMEOUT);
+
+  return pto < priv->rx_rto ? pto : 0;
+}
+
+/* Sends a new segment if the peer's window allows, or the last one sent
+ * again, so the ACK for it reveals a lost tail to SACK and RACK. */
+static int
+tail_loss_probe (PseudoTcpSocket *self, guint32 now)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  SSegment *sseg = g_queue_peek_head (&priv->unsent_slist);
+  int transmit_status;
+
+  if (!sseg || priv->snd_nxt - priv->snd_una + min (sseg->len, priv->mss) >
+      priv->snd_wnd) {
+    GList *iter = g_queue_peek_tail_link (&priv->slist);
+
+    while (((SSegment *)iter->data)->xmit == 0)
+      iter = iter->prev;
+    sseg = iter->data;
+  }
+
+  DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "tail loss probe %u-%u (srtt: %u)",
+      sseg->seq, sseg->seq + min (sseg->len, priv->mss), priv->rx_srtt);
+
+  transmit_status = transmit (self, sseg, now);
+  if (transmit_status != 0)
+    return transmit_status;
+
+  priv->tlp_out = TRUE;
+  priv->stats.tail_loss_probes++;
+  priv->rto_base = now;
+
+  return 0;
+}
+
+void
+pseudo_tcp_socket_get_stats (PseudoTcpSocket *self, PseudoTcpStats *stats)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  *stats = priv->stats;
+  stats->srtt = priv->rx_srtt;
+  stats->rto = priv->rx_rto;
+  stats->mtu = priv->mtu_advise;
+}
+
 gint
 pseudo_tcp_socket_get_available_bytes (PseudoTcpSocket *self)
 {
@@ -184,6 +184,49 @@ typedef enum {
   PSEUDO_TCP_SHUTDOWN_RDWR,
 } PseudoTcpShutdown;
 
+/**
+ * PseudoTcpCongestionControl:
+ * @PSEUDO_TCP_CC_RENO: Loss based NewReno, halves the window on loss
+ * @PSEUDO_TCP_CC_BBR: Model based, sizes the window from the measured
+ * bottleneck bandwidth and minimum RTT, and doesn't back off on random loss
+ *
+ * Congestion controllers for #PseudoTcpSocket:congestion-control. Only the
+ * sending side is affected, peers don't need to agree.
+ */
+typedef enum {
+  PSEUDO_TCP_CC_RENO,
+  PSEUDO_TCP_CC_BBR,
+} PseudoTcpCongestionControl;
+
+/**
+ * PseudoTcpStats:
+ * @retransmits: Segments sent again, for any reason
+ * @timeouts: Retransmission timeouts
+ * @tail_loss_probes: Probes sent because the tail of a flight went unacked
+ * @fast_recoveries: Times fast recovery was entered, on duplicate ACKs or
+ * on a loss found by the RACK timer
+ * @rack_losses: Segments found lost by sent time (RACK) rather than by
+ * duplicate ACKs
+ * @mtu_probes: Larger segments sent to discover the path MTU
+ * @srtt: Smoothed round trip time, in milliseconds
+ * @rto: Current retransmission timeout, in milliseconds
+ * @mtu: MTU the segment size is derived from, in bytes
+ *
+ * Loss recovery counters of a #PseudoTcpSocket, see
+ * pseudo_tcp_socket_get_stats().
+ */
+typedef struct {
+  uint64_t retransmits;
+  uint64_t timeouts;
+  uint64_t tail_loss_probes;
+  uint64_t fast_recoveries;
+  uint64_t rack_losses;
+  uint64_t mtu_probes;
+  uint32_t srtt;
+  uint32_t rto;
+  uint32_t mtu;
+} PseudoTcpStats;
+
 /**
  * PseudoTcpCallbacks:
  * @user_data: A user defined pointer to be passed to the callbacks
@@ -279,6 +322,42 @@ bool pseudo_tcp_socket_connect(PseudoTcpSocket *self);
 int  pseudo_tcp_socket_recv(PseudoTcpSocket *self, char * buffer, size_t len);
 
 
+/**
+ * pseudo_tcp_socket_peek:
+ * @self: The #PseudoTcpSocket object.
+ * @buffer: Set to the received data, in place in the receive buffer
+ *
+ * Receive data from the socket without copying it. The data must be
+ * released with pseudo_tcp_socket_consume(). Until then the receive buffer
+ * is not resized, so the data stays valid even if the caller releases its
+ * lock and other calls into the socket append newly received data.
+ *
+ <note>
+   <para>
+     The same rules as for pseudo_tcp_socket_recv() apply. The receive
+     buffer is a ring, so when the data wraps around only the part up to
+     its end is returned; consume it and peek again for the rest.
+   </para>
+ </note>
+ *
+ * Returns: The number of bytes at @buffer, 0 at the end of the stream or
+ * -1 in case of error
+ * <para> See also: pseudo_tcp_socket_get_error() </para>
+ */
+int  pseudo_tcp_socket_peek(PseudoTcpSocket *self, const char **buffer);
+
+
+/**
+ * pseudo_tcp_socket_consume:
+ * @self: The #PseudoTcpSocket object.
+ * @len: The number of bytes read
+ *
+ * Release @len bytes returned by pseudo_tcp_socket_peek(), reopening the
+ * receive window for them.
+ */
+void pseudo_tcp_socket_consume(PseudoTcpSocket *self, size_t len);
+
+
 /**
  * pseudo_tcp_socket_send:
  * @self: The #PseudoTcpSocket object.
@@ -512,6 +591,15 @@ bool pseudo_tcp_socket_can_send (PseudoTcpSocket *self);
  */
 size_t pseudo_tcp_socket_get_available_send_space (PseudoTcpSocket *self);
 
+/**
+ * pseudo_tcp_socket_get_stats:
+ * @self: The #PseudoTcpSocket object.
+ * @stats: The #PseudoTcpStats to fill.
+ *
+ * Gets the loss recovery counters and the current RTT estimates.
+ */
+void pseudo_tcp_socket_get_stats (PseudoTcpSocket *self, PseudoTcpStats *stats);
+
 /**
  * pseudo_tcp_socket_set_time:
  * @self: The #PseudoTcpSocket object.
@@ -570,6 +658,31 @@ enum
     PROP_RCV_BUF,
     PROP_SND_BUF,
     PROP_SUPPORT_FIN_ACK,
+    /* Buffer autotuning ceilings, only settable before connecting. A
+     * ceiling not above PROP_RCV_BUF/PROP_SND_BUF disables autotuning. */
+    PROP_RCV_BUF_MAX,
+    PROP_SND_BUF_MAX,
+    PROP_CONGESTION_CONTROL,
+    /* Selective acknowledgements, on by default and only used when the
+     * peer advertises them too. */
+    PROP_SUPPORT_SACK,
+    /* Least the retransmission timeout adds to the smoothed RTT, in
+     * milliseconds. */
+    PROP_RTO_MIN,
+    /* Spread new data over the round trip instead of sending what the
+     * window allows back to back, off by default. */
+    PROP_PACING,
+    /* Largest MTU to probe the path for, above the one given to
+     * pseudo_tcp_socket_notify_mtu(). 0, the default, disables probing. */
+    PROP_MTU_PROBE_MAX,
+    /* Segments received before an ACK goes out without waiting for
+     * PROP_ACK_DELAY, 2 by default. 0 acknowledges every other segment at
+     * first and fewer once a bulk transfer is under way, if the peer
+     * advertises PROP_SUPPORT_ACK_DECIMATION. */
+    PROP_ACK_FREQUENCY,
+    /* Advertise that the congestion window grows with the bytes acked,
+     * so the peer may decimate its ACKs. On by default. */
+    PROP_SUPPORT_ACK_DECIMATION,
     LAST_PROPERTY
 };
 
@@ -251,12 +251,21 @@ create_sockets (Data *data, gboolean support_fin_ack)
   PseudoTcpCallbacks cbs = {
     data, opened, readable, writable, closed, write_packet
   };
+  /* Keep the SYN segments at the 7 bytes the sequence numbers below expect. */
+  gboolean support_sack = FALSE;
+  gboolean support_ack_decimation = FALSE;
 
   data->left = pseudo_tcp_socket_new(0, &cbs);
   pseudo_tcp_socket_set_property(data->left, PROP_SUPPORT_FIN_ACK, &support_fin_ack);
+  pseudo_tcp_socket_set_property(data->left, PROP_SUPPORT_SACK, &support_sack);
+  pseudo_tcp_socket_set_property(data->left, PROP_SUPPORT_ACK_DECIMATION,
+      &support_ack_decimation);
 
   data->right = pseudo_tcp_socket_new(0, &cbs);
   pseudo_tcp_socket_set_property(data->right, PROP_SUPPORT_FIN_ACK, &support_fin_ack);
+  pseudo_tcp_socket_set_property(data->right, PROP_SUPPORT_SACK, &support_sack);
+  pseudo_tcp_socket_set_property(data->right, PROP_SUPPORT_ACK_DECIMATION,
+      &support_ack_decimation);
 
   g_debug ("Left: %p, right: %p", data->left, data->right);
 
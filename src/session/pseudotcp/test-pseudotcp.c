@@ -41,6 +41,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <time.h>
 
 #include "pseudotcp.h"
 
@@ -457,6 +458,591 @@ static void adjust_clock (PseudoTcpSocket *sock)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// High RTT throughput, simulated in virtual time so it runs in well under a
+// second: a bottleneck link with LINK_RATE bytes/ms and LINK_DELAY ms one way,
+// a 1.25 MB bandwidth-delay product, far above the default 60 KB window.
+
+#define LINK_DELAY          100
+#define LINK_RATE           6250
+#define LINK_DURATION       20000
+
+typedef struct LinkPacket {
+  struct LinkPacket *next;
+  guint32 deliver;
+  guint32 len;
+  gchar buffer[];
+} LinkPacket;
+
+typedef struct LinkPeer {
+  PseudoTcpSocket *sock;
+  struct LinkPeer *remote;
+  gboolean sender;
+  LinkPacket *head, *tail;  // in flight towards remote
+  guint32 queued;
+  guint64 busy_until;       // bottleneck serialization, in microseconds
+  guint64 sent, received;
+} LinkPeer;
+
+static guint32 link_now;
+static guint32 link_delay = LINK_DELAY;
+static guint32 link_loss;   // per mille, random drop on the link
+static guint32 link_seed;
+static gboolean link_drop_next;
+static guint32 link_packets, link_max_queued;
+static guint32 link_queue_limit;  // bytes queued at the bottleneck, 0 for no limit
+static guint32 link_drops;
+static gboolean link_pacing;
+static guint32 link_mtu;        // larger packets are dropped, 0 for no limit
+static guint32 link_mtu_probe;  // PROP_MTU_PROBE_MAX of both ends
+static PseudoTcpStats link_stats;  // the sender's, when link_run() ends
+static guint32 link_ack_freq = 2;  // PROP_ACK_FREQUENCY of both ends
+static guint32 link_acks;          // packets the receiver sent
+static gboolean link_ack_decimation = TRUE;  // PROP_SUPPORT_ACK_DECIMATION
+                                             // of the sender
+
+static void link_fill (LinkPeer *peer)
+{
+  gchar buf[4096];
+  gint len;
+  guint i;
+
+  do {
+    for (i = 0; i < sizeof(buf); i++)
+      buf[i] = (gchar)((peer->sent + i) % 251);
+
+    len = pseudo_tcp_socket_send (peer->sock, buf, sizeof(buf));
+    if (len > 0)
+      peer->sent += len;
+  } while (len == (gint)sizeof(buf));
+}
+
+static void link_opened (PseudoTcpSocket *sock, gpointer data)
+{
+  LinkPeer *peer = (LinkPeer *)data;
+
+  if (peer->sender)
+    link_fill (peer);
+}
+
+/* Reads in place, the way the reliable handler does. */
+static void link_readable (PseudoTcpSocket *sock, gpointer data)
+{
+  LinkPeer *peer = (LinkPeer *)data;
+  const gchar *buf;
+  gint len;
+  gint i;
+
+  while ((len = pseudo_tcp_socket_peek (sock, &buf)) > 0) {
+    for (i = 0; i < len; i++) {
+      if (buf[i] != (gchar)((peer->received + i) % 251)) {
+        g_error ("Corrupted data at offset %" G_GUINT64_FORMAT,
+            peer->received + i);
+        exit (-1);
+      }
+    }
+    peer->received += len;
+    pseudo_tcp_socket_consume (sock, len);
+  }
+}
+
+static void link_writable (PseudoTcpSocket *sock, gpointer data)
+{
+  LinkPeer *peer = (LinkPeer *)data;
+
+  if (peer->sender)
+    link_fill (peer);
+}
+
+static void link_closed (PseudoTcpSocket *sock, guint32 err, gpointer data)
+{
+  g_error ("Socket %p Closed : %d", sock, err);
+  exit (-1);
+}
+
+static PseudoTcpWriteResult link_write_packet (PseudoTcpSocket *sock,
+    const gchar *buffer, guint32 len, gpointer data)
+{
+  LinkPeer *peer = (LinkPeer *)data;
+  LinkPacket *packet;
+  guint64 start = (guint64)link_now * 1000;
+
+  if (!peer->sender)
+    link_acks++;
+
+  // Deterministic LCG so every run sees the same drop pattern
+  link_seed = link_seed * 1103515245 + 12345;
+  if ((link_seed >> 16) % 1000 < link_loss || link_drop_next) {
+    link_drop_next = FALSE;
+    return WR_SUCCESS;
+  }
+
+  // What the pseudo-TCP header leaves of the overhead it allows for
+  if (link_mtu && len + 92 > link_mtu)
+    return WR_SUCCESS;
+
+  // Tail drop once the bottleneck queue is full
+  if (link_queue_limit && peer->busy_until > start &&
+      (peer->busy_until - start) * LINK_RATE / 1000 + len > link_queue_limit) {
+    link_drops++;
+    return WR_SUCCESS;
+  }
+
+  packet = g_malloc (sizeof(LinkPacket) + len);
+  memcpy (packet->buffer, buffer, len);
+  packet->len = len;
+  packet->next = NULL;
+
+  if (peer->busy_until > start)
+    start = peer->busy_until;
+  peer->busy_until = start + (guint64)len * 1000 / LINK_RATE;
+  packet->deliver = (guint32)(peer->busy_until / 1000) + link_delay;
+
+  if (peer->tail)
+    peer->tail->next = packet;
+  else
+    peer->head = packet;
+  peer->tail = packet;
+
+  link_packets++;
+  if (++peer->queued > link_max_queued)
+    link_max_queued = peer->queued;
+
+  return WR_SUCCESS;
+}
+
+static guint32 link_next_event (LinkPeer *peers)
+{
+  guint32 next = LINK_DURATION;
+  guint64 timeout;
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    if (peers[i].head && peers[i].head->deliver < next)
+      next = peers[i].head->deliver;
+    if (pseudo_tcp_socket_get_next_clock (peers[i].sock, &timeout) &&
+        timeout < next)
+      next = (guint32)timeout;
+  }
+
+  return next > link_now ? next : link_now + 1;
+}
+
+/* Returns the receive rate over the second half of the run, in bytes/s. */
+static guint64 link_run (gboolean autotune, PseudoTcpCongestionControl cc,
+    gboolean sack, guint32 loss)
+{
+  LinkPeer peers[2];
+  guint64 received = 0;
+  guint32 disabled = 0;
+  guint64 timeout;
+  int i;
+
+  memset (peers, 0, sizeof(peers));
+  peers[0].sender = TRUE;
+  peers[0].remote = &peers[1];
+  peers[1].remote = &peers[0];
+  link_loss = loss;
+  link_seed = 1;
+
+  for (i = 0; i < 2; i++) {
+    PseudoTcpCallbacks cbs = {
+      &peers[i], link_opened, link_readable, link_writable, link_closed,
+      link_write_packet
+    };
+
+    peers[i].sock = pseudo_tcp_socket_new (0, &cbs);
+    pseudo_tcp_socket_notify_mtu (peers[i].sock, 1400);
+    if (!autotune) {
+      pseudo_tcp_socket_set_property (peers[i].sock, PROP_RCV_BUF_MAX,
+          &disabled);
+      pseudo_tcp_socket_set_property (peers[i].sock, PROP_SND_BUF_MAX,
+          &disabled);
+    }
+    pseudo_tcp_socket_set_property (peers[i].sock, PROP_CONGESTION_CONTROL,
+        &cc);
+    pseudo_tcp_socket_set_property (peers[i].sock, PROP_SUPPORT_SACK, &sack);
+    pseudo_tcp_socket_set_property (peers[i].sock, PROP_PACING, &link_pacing);
+    pseudo_tcp_socket_set_property (peers[i].sock, PROP_MTU_PROBE_MAX,
+        &link_mtu_probe);
+    pseudo_tcp_socket_set_property (peers[i].sock, PROP_ACK_FREQUENCY,
+        &link_ack_freq);
+  }
+
+  pseudo_tcp_socket_set_property (peers[0].sock, PROP_SUPPORT_ACK_DECIMATION,
+      &link_ack_decimation);
+
+  link_now = 1;
+  for (i = 0; i < 2; i++)
+    pseudo_tcp_socket_set_time (peers[i].sock, link_now);
+
+  pseudo_tcp_socket_connect (peers[0].sock);
+
+  while (link_now < LINK_DURATION) {
+    for (i = 0; i < 2; i++) {
+      LinkPeer *peer = &peers[i];
+
+      while (peer->head && peer->head->deliver <= link_now) {
+        LinkPacket *packet = peer->head;
+
+        peer->head = packet->next;
+        if (!peer->head)
+          peer->tail = NULL;
+        peer->queued--;
+
+        pseudo_tcp_socket_notify_packet (peer->remote->sock, packet->buffer,
+            packet->len);
+        g_free (packet);
+      }
+    }
+
+    for (i = 0; i < 2; i++) {
+      if (pseudo_tcp_socket_get_next_clock (peers[i].sock, &timeout) &&
+          timeout <= link_now)
+        pseudo_tcp_socket_notify_clock (peers[i].sock);
+    }
+
+    if (link_now <= LINK_DURATION / 2)
+      received = peers[1].received;
+
+    link_now = link_next_event (peers);
+    for (i = 0; i < 2; i++)
+      pseudo_tcp_socket_set_time (peers[i].sock, link_now);
+  }
+
+  received = peers[1].received - received;
+  pseudo_tcp_socket_get_stats (peers[0].sock, &link_stats);
+
+  for (i = 0; i < 2; i++) {
+    while (peers[i].head) {
+      LinkPacket *packet = peers[i].head;
+      peers[i].head = packet->next;
+      g_free (packet);
+    }
+    g_object_unref (peers[i].sock);
+  }
+
+  return received * 1000 / (LINK_DURATION / 2);
+}
+
+static void test_high_rtt (void)
+{
+  guint64 fixed = link_run (FALSE, PSEUDO_TCP_CC_RENO, TRUE, 0);
+  guint64 tuned = link_run (TRUE, PSEUDO_TCP_CC_RENO, TRUE, 0);
+
+  printf ("High RTT (%d ms, %d KB/s link): fixed buffers %u KB/s, "
+      "autotuned %u KB/s\n", 2 * LINK_DELAY, LINK_RATE,
+      (guint)(fixed / 1000), (guint)(tuned / 1000));
+
+  // A 60 KB window yields ~300 KB/s over a 200 ms round trip.
+  if (tuned < 4 * fixed || tuned < (guint64)LINK_RATE * 1000 / 2) {
+    g_error ("Buffer autotuning didn't fill the link");
+    exit (-1);
+  }
+}
+
+static void test_lossy_link (void)
+{
+  guint64 reno = link_run (TRUE, PSEUDO_TCP_CC_RENO, TRUE, 10);
+  guint64 bbr = link_run (TRUE, PSEUDO_TCP_CC_BBR, TRUE, 10);
+  guint64 clean = link_run (TRUE, PSEUDO_TCP_CC_BBR, TRUE, 0);
+
+  printf ("Lossy link (1%% random loss): reno %u KB/s, bbr %u KB/s, "
+      "bbr lossless %u KB/s\n", (guint)(reno / 1000), (guint)(bbr / 1000),
+      (guint)(clean / 1000));
+
+  // Reno halves its window on every loss, BBR keeps sending at the
+  // measured bottleneck rate.
+  if (bbr < 2 * reno || clean < (guint64)LINK_RATE * 1000 / 2) {
+    g_error ("BBR didn't hold the link rate");
+    exit (-1);
+  }
+}
+
+static void test_sack (void)
+{
+  guint64 reno = link_run (TRUE, PSEUDO_TCP_CC_RENO, FALSE, 30);
+  guint64 reno_sack = link_run (TRUE, PSEUDO_TCP_CC_RENO, TRUE, 30);
+  guint64 bbr = link_run (TRUE, PSEUDO_TCP_CC_BBR, FALSE, 30);
+  guint64 bbr_sack = link_run (TRUE, PSEUDO_TCP_CC_BBR, TRUE, 30);
+
+  printf ("SACK (3%% random loss): reno %u -> %u KB/s, bbr %u -> %u KB/s\n",
+      (guint)(reno / 1000), (guint)(reno_sack / 1000),
+      (guint)(bbr / 1000), (guint)(bbr_sack / 1000));
+
+  // Reno is bound by halving its window, but it mustn't get worse. BBR
+  // keeps sending, so resending only the holes pays off.
+  if (reno_sack < reno * 9 / 10 || bbr_sack < bbr * 3 / 2) {
+    g_error ("SACK didn't speed up loss recovery");
+    exit (-1);
+  }
+}
+
+/* Interactive messages over a 20 ms round trip, each one small enough for a
+ * single segment, and every other one lost on the first try: the tail loss
+ * probe has to bring it in well before the old one second timeout floor.
+ * The delayed ACK of a lone segment still shows in the RTT, so it takes a
+ * few hundred milliseconds rather than a few round trips. */
+static void test_tail_loss (void)
+{
+  LinkPeer peers[2];
+  PseudoTcpStats stats;
+  guint32 worst = 0;
+  guint32 sent_at = 0;
+  guint64 timeout;
+  gchar msg[500];
+  int count = 0;
+  int i;
+
+  memset (peers, 0, sizeof(peers));
+  peers[0].remote = &peers[1];
+  peers[1].remote = &peers[0];
+  link_delay = 10;
+  link_loss = 0;
+  link_seed = 1;
+
+  for (i = 0; i < 2; i++) {
+    PseudoTcpCallbacks cbs = {
+      &peers[i], link_opened, link_readable, link_writable, link_closed,
+      link_write_packet
+    };
+
+    peers[i].sock = pseudo_tcp_socket_new (0, &cbs);
+    pseudo_tcp_socket_notify_mtu (peers[i].sock, 1400);
+  }
+
+  link_now = 1;
+  for (i = 0; i < 2; i++)
+    pseudo_tcp_socket_set_time (peers[i].sock, link_now);
+
+  pseudo_tcp_socket_connect (peers[0].sock);
+
+  while (link_now < LINK_DURATION / 2) {
+    for (i = 0; i < 2; i++) {
+      LinkPeer *peer = &peers[i];
+
+      while (peer->head && peer->head->deliver <= link_now) {
+        LinkPacket *packet = peer->head;
+
+        peer->head = packet->next;
+        if (!peer->head)
+          peer->tail = NULL;
+        peer->queued--;
+
+        pseudo_tcp_socket_notify_packet (peer->remote->sock, packet->buffer,
+            packet->len);
+        g_free (packet);
+      }
+    }
+
+    if (sent_at && peers[1].received == peers[0].sent) {
+      if (link_now - sent_at > worst)
+        worst = link_now - sent_at;
+      sent_at = 0;
+    }
+
+    // One message a second, once connected and idle
+    if (!sent_at && link_now >= 1000 * (count + 1) &&
+        pseudo_tcp_socket_get_available_send_space (peers[0].sock) > 0) {
+      for (i = 0; i < (int)sizeof(msg); i++)
+        msg[i] = (gchar)((peers[0].sent + i) % 251);
+
+      link_drop_next = count++ % 2;
+      g_assert (pseudo_tcp_socket_send (peers[0].sock, msg, sizeof(msg)) ==
+          sizeof(msg));
+      peers[0].sent += sizeof(msg);
+      sent_at = link_now;
+    }
+
+    for (i = 0; i < 2; i++) {
+      if (pseudo_tcp_socket_get_next_clock (peers[i].sock, &timeout) &&
+          timeout <= link_now)
+        pseudo_tcp_socket_notify_clock (peers[i].sock);
+    }
+
+    link_now = link_next_event (peers);
+    if (!sent_at && link_now > 1000 * (count + 1))
+      link_now = 1000 * (count + 1);
+    for (i = 0; i < 2; i++)
+      pseudo_tcp_socket_set_time (peers[i].sock, link_now);
+  }
+
+  pseudo_tcp_socket_get_stats (peers[0].sock, &stats);
+
+  printf ("Tail loss (%d ms RTT): %d messages, worst latency %u ms, "
+      "%u probes, %u timeouts, rto %u ms\n", 2 * link_delay, count, worst,
+      (guint)stats.tail_loss_probes, (guint)stats.timeouts, stats.rto);
+
+  for (i = 0; i < 2; i++) {
+    while (peers[i].head) {
+      LinkPacket *packet = peers[i].head;
+      peers[i].head = packet->next;
+      g_free (packet);
+    }
+    g_object_unref (peers[i].sock);
+  }
+  link_delay = LINK_DELAY;
+
+  if (count < 5 || worst > 400 || stats.tail_loss_probes == 0 ||
+      stats.timeouts > 0) {
+    g_error ("Lost tail wasn't recovered quickly");
+    exit (-1);
+  }
+}
+
+/* A shallow bottleneck buffer, as on TURN relays and mobile links, holding
+ * 16 segments where the bandwidth-delay product is 180: bursts of a whole
+ * window overflow it, paced segments don't. */
+static void test_pacing (void)
+{
+  PseudoTcpCongestionControl ccs[] = { PSEUDO_TCP_CC_RENO, PSEUDO_TCP_CC_BBR };
+  const gchar *names[] = { "reno", "bbr" };
+  guint64 rate[2][2];
+  guint32 drops[2][2], packets[2][2];
+  int i, j;
+
+  link_delay = 20;
+  link_queue_limit = 16 * 1400;
+
+  for (i = 0; i < 2; i++) {
+    for (j = 0; j < 2; j++) {
+      link_pacing = j;
+      link_packets = link_drops = 0;
+      rate[i][j] = link_run (TRUE, ccs[i], TRUE, 0);
+      drops[i][j] = link_drops;
+      packets[i][j] = link_packets + link_drops;
+    }
+
+    printf ("Pacing (40 ms RTT, 16 segment buffer): %s %u KB/s, %.2f%% loss "
+        "-> %u KB/s, %.2f%% loss\n", names[i], (guint)(rate[i][0] / 1000),
+        100.0 * drops[i][0] / packets[i][0], (guint)(rate[i][1] / 1000),
+        100.0 * drops[i][1] / packets[i][1]);
+  }
+
+  link_delay = LINK_DELAY;
+  link_queue_limit = 0;
+  link_pacing = FALSE;
+
+  // BBR keeps sending into a full buffer unless paced
+  if (rate[1][1] < 4 * rate[1][0] ||
+      (guint64)drops[1][1] * packets[1][0] >=
+      (guint64)drops[1][0] * packets[1][1]) {
+    g_error ("Pacing didn't reduce losses on a shallow buffer");
+    exit (-1);
+  }
+}
+
+/* Path MTU discovery from the 1400 byte MTU both ends are told about, up to
+ * 1500: a full Ethernet path is found with the first probe, a narrower one
+ * to within a probe step, and a path that drops 1400 byte packets falls back
+ * to the base MTU before searching up again. */
+static void test_mtu_probe (void)
+{
+  guint32 mtus[] = { 1500, 1450, 1300 };
+  guint64 rate;
+  int i;
+
+  link_mtu_probe = 1500;
+
+  for (i = 0; i < 3; i++) {
+    link_mtu = mtus[i];
+    rate = link_run (TRUE, PSEUDO_TCP_CC_BBR, TRUE, 0);
+
+    printf ("MTU probing (%u byte path): MTU %u after %u probes, %u KB/s\n",
+        link_mtu, link_stats.mtu, (guint)link_stats.mtu_probes,
+        (guint)(rate / 1000));
+
+    if (link_stats.mtu > link_mtu || link_stats.mtu + 16 < link_mtu ||
+        rate < (guint64)LINK_RATE * 1000 / 2) {
+      g_error ("Path MTU wasn't found");
+      exit (-1);
+    }
+  }
+
+  link_mtu = link_mtu_probe = 0;
+}
+
+/* A bulk transfer with every other segment acknowledged, and with adaptive
+ * ACK decimation: a fraction of the ACKs must keep the link as busy. Holes
+ * are still acknowledged at once, so at 1% loss there are about as many
+ * ACKs either way, and the rate mustn't drop much. */
+static void test_ack_decimation (void)
+{
+  PseudoTcpCongestionControl ccs[] = { PSEUDO_TCP_CC_RENO, PSEUDO_TCP_CC_BBR };
+  const gchar *names[] = { "reno", "bbr" };
+  guint32 losses[] = { 0, 10 };
+  guint64 rate[2];
+  guint32 acks[2];
+  int i, j, k;
+
+  for (i = 0; i < 2; i++) {
+    for (k = 0; k < 2; k++) {
+      for (j = 0; j < 2; j++) {
+        link_ack_freq = j ? 0 : 2;
+        link_acks = 0;
+        rate[j] = link_run (TRUE, ccs[i], TRUE, losses[k]);
+        acks[j] = link_acks;
+      }
+
+      printf ("ACK decimation (%.1f%% loss): %s %u KB/s, %u ACKs -> "
+          "%u KB/s, %u ACKs\n", losses[k] / 10.0, names[i],
+          (guint)(rate[0] / 1000), acks[0], (guint)(rate[1] / 1000), acks[1]);
+
+      if ((losses[k] == 0 &&
+          (acks[1] * 3 > acks[0] || rate[1] < rate[0] * 19 / 20)) ||
+          rate[1] < rate[0] * 4 / 5) {
+        g_error ("ACK decimation cost throughput");
+        exit (-1);
+      }
+    }
+  }
+
+  /* A sender that doesn't advertise it grows its window per ACK, so it
+   * still gets every other segment acknowledged. */
+  for (j = 0; j < 2; j++) {
+    link_ack_freq = j ? 0 : 2;
+    link_ack_decimation = !j;
+    link_acks = 0;
+    rate[j] = link_run (TRUE, PSEUDO_TCP_CC_RENO, TRUE, 0);
+    acks[j] = link_acks;
+  }
+
+  printf ("ACK decimation, unsupported by the sender: %u KB/s, %u ACKs -> "
+      "%u KB/s, %u ACKs\n", (guint)(rate[0] / 1000), acks[0],
+      (guint)(rate[1] / 1000), acks[1]);
+
+  if (acks[1] * 10 < acks[0] * 9) {
+    g_error ("ACKs decimated for a sender without support");
+    exit (-1);
+  }
+
+  link_ack_freq = 2;
+  link_ack_decimation = TRUE;
+}
+
+/* Queue handling cost with well over a thousand segments in flight: a 500 ms
+ * round trip at the link rate and 0.1% loss keep the send queue, the SACK
+ * scoreboard and the reassembly queue long. */
+static void bench_queues (void)
+{
+  clock_t start;
+  guint64 rate;
+  double cpu;
+
+  link_delay = 250;
+  link_packets = link_max_queued = 0;
+
+  start = clock ();
+  rate = link_run (TRUE, PSEUDO_TCP_CC_BBR, TRUE, 1);
+  cpu = (double)(clock () - start) / CLOCKS_PER_SEC;
+
+  link_delay = LINK_DELAY;
+
+  printf ("Queues (%u segments in flight): %u KB/s, %u packets, "
+      "%.2f us per packet\n", link_max_queued, (guint)(rate / 1000),
+      link_packets, cpu * 1000000 / link_packets);
+}
+
 int main (int argc, char *argv[])
 {
   PseudoTcpCallbacks cbs = {
@@ -465,6 +1051,15 @@ int main (int argc, char *argv[])
 
   setlocale (LC_ALL, "");
 
+  test_high_rtt ();
+  test_lossy_link ();
+  test_sack ();
+  test_tail_loss ();
+  test_pacing ();
+  test_mtu_probe ();
+  test_ack_decimation ();
+  bench_queues ();
+
   mainloop = g_main_loop_new (NULL, FALSE);
 
   pseudo_tcp_set_debug_level (PSEUDO_TCP_DEBUG_VERBOSE);
@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include <crystal.h>
+
+#include "session.h"
+#include "reliable_clock.h"
+
+static inline uint64_t clock_now(void)
+{
+    return (uint64_t)get_monotonic_time() / 1000;
+}
+
+static void clock_link(ReliableClock *clock, ReliableClockEntry *entry)
+{
+    uint64_t t = entry->deadline;
+
+    // Deadlines already passed go to the next slot to expire.
+    if (t < clock->tick)
+        t = clock->tick;
+
+    entry->slot = (unsigned int)(t % RELIABLE_CLOCK_SLOTS);
+    entry->prev = NULL;
+    entry->next = clock->slots[entry->slot];
+    if (entry->next)
+        entry->next->prev = entry;
+    clock->slots[entry->slot] = entry;
+
+    entry->scheduled = true;
+    clock->entries++;
+}
+
+static void clock_unlink(ReliableClock *clock, ReliableClockEntry *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        clock->slots[entry->slot] = entry->next;
+
+    if (entry->next)
+        entry->next->prev = entry->prev;
+
+    entry->prev = entry->next = NULL;
+    entry->scheduled = false;
+    clock->entries--;
+}
+
+/*
+ * Earliest deadline left in the wheel, 0 if none. Slots are visited in
+ * time order from the current tick, so the first entry due within this
+ * turn of the wheel is the earliest; later turns are only compared when
+ * there is none.
+ */
+static uint64_t clock_earliest(ReliableClock *clock)
+{
+    uint64_t earliest = 0;
+    uint64_t due;
+    uint64_t t;
+
+    if (!clock->entries)
+        return 0;
+
+    for (t = clock->tick; t < clock->tick + RELIABLE_CLOCK_SLOTS; t++) {
+        ReliableClockEntry *entry = clock->slots[t % RELIABLE_CLOCK_SLOTS];
+
+        for (due = 0; entry; entry = entry->next) {
+            if (entry->deadline <= t && (!due || entry->deadline < due))
+                due = entry->deadline;
+
+            if (!earliest || entry->deadline < earliest)
+                earliest = entry->deadline;
+        }
+
+        if (due)
+            return due;
+    }
+
+    return earliest;
+}
+
+/* Called with the clock locked. */
+static void clock_arm(ReliableClock *clock, uint64_t deadline)
+{
+    TransportWorker *worker = clock->worker;
+    uint64_t now;
+
+    if (!deadline || deadline == clock->armed)
+        return;
+
+    clock->armed = deadline;
+
+    // The worker takes the deadline as is, it must not be in the past.
+    now = clock_now();
+    if (deadline < now)
+        deadline = now;
+
+    worker->schedule_timer(worker, clock->timer, (unsigned long)deadline);
+}
+
+static bool clock_timer_callback(void *user_data)
+{
+    ReliableClock *clock = (ReliableClock *)user_data;
+    ReliableClockEntry *expired = NULL;
+    ReliableClockEntry **tail = &expired;
+    ReliableClockEntry *entry;
+    uint64_t now = clock_now();
+    uint64_t t;
+    uint64_t end;
+
+    pthread_mutex_lock(&clock->lock);
+
+    end = clock->tick + RELIABLE_CLOCK_SLOTS;
+    if (end > now + 1)
+        end = now + 1;
+
+    for (t = clock->tick; t < end; t++) {
+        ReliableClockEntry *next;
+
+        for (entry = clock->slots[t % RELIABLE_CLOCK_SLOTS]; entry;
+             entry = next) {
+            next = entry->next;
+            if (entry->deadline > now)
+                continue;
+
+            clock_unlink(clock, entry);
+
+            ref(entry->user_data);
+            entry->expired = NULL;
+            *tail = entry;
+            tail = &entry->expired;
+        }
+    }
+
+    if (clock->tick < now + 1)
+        clock->tick = now + 1;
+
+    clock->armed = 0;
+
+    pthread_mutex_unlock(&clock->lock);
+
+    /* Callbacks take the stream locks, and reschedule their entries, so the
+     * clock must not be held while they run. */
+    while (expired) {
+        void *user_data;
+
+        entry = expired;
+        expired = entry->expired;
+        user_data = entry->user_data;
+
+        entry->callback(user_data);
+        deref(user_data);
+    }
+
+    // Entries rescheduled meanwhile may have armed the timer for a later one.
+    pthread_mutex_lock(&clock->lock);
+    clock_arm(clock, clock_earliest(clock));
+    pthread_mutex_unlock(&clock->lock);
+
+    return false;
+}
+
+int reliable_clock_schedule(ReliableClock *clock, ReliableClockEntry *entry,
+                            uint64_t deadline)
+{
+    TransportWorker *worker = clock->worker;
+    int rc = 0;
+
+    assert(entry && entry->callback && entry->user_data);
+
+    pthread_mutex_lock(&clock->lock);
+
+    if (entry->scheduled)
+        clock_unlink(clock, entry);
+
+    entry->deadline = deadline;
+    clock_link(clock, entry);
+
+    if (!clock->timer) {
+        uint64_t now = clock_now();
+
+        rc = worker->create_timer(worker, worker->id | 0x00100000,
+                        deadline > now ? (unsigned long)(deadline - now) : 0,
+                        clock_timer_callback, clock, &clock->timer);
+        if (rc == 0)
+            clock->armed = deadline;
+        else
+            clock_unlink(clock, entry);
+    } else if (!clock->armed || deadline < clock->armed) {
+        clock_arm(clock, deadline);
+    }
+
+    pthread_mutex_unlock(&clock->lock);
+
+    return rc;
+}
+
+void reliable_clock_cancel(ReliableClock *clock, ReliableClockEntry *entry)
+{
+    pthread_mutex_lock(&clock->lock);
+
+    // The worker timer may fire early now, which only costs a spare wakeup.
+    if (entry->scheduled)
+        clock_unlink(clock, entry);
+
+    pthread_mutex_unlock(&clock->lock);
+}
+
+static void reliable_clock_destroy(void *p)
+{
+    ReliableClock *clock = (ReliableClock *)p;
+
+    // The timer belongs to the worker and goes with its timer heap.
+    pthread_mutex_destroy(&clock->lock);
+}
+
+ReliableClock *reliable_clock_create(TransportWorker *worker)
+{
+    ReliableClock *clock;
+
+    assert(worker);
+
+    clock = (ReliableClock *)rc_zalloc(sizeof(ReliableClock),
+                                       reliable_clock_destroy);
+    if (!clock)
+        return NULL;
+
+    pthread_mutex_init(&clock->lock, NULL);
+    clock->worker = worker;
+    clock->tick = clock_now();
+
+    return clock;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __RELIABLE_CLOCK_H__
+#define __RELIABLE_CLOCK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <crystal.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * One timer per worker drives the clocks of all its pseudo-TCP sockets.
+ * Deadlines are hashed into a wheel of millisecond slots, so sockets can
+ * move their deadline after every packet without going to the timer heap,
+ * which is only touched when the earliest deadline of the worker moves
+ * ahead.
+ */
+#define RELIABLE_CLOCK_SLOTS        512
+
+struct TransportWorker;
+
+typedef struct ReliableClock ReliableClock;
+typedef struct ReliableClockEntry ReliableClockEntry;
+
+/*
+ * Embedded in the owner, which must be a reference counted object passed
+ * as user_data; the clock holds a reference while the callback runs.
+ */
+struct ReliableClockEntry {
+    ReliableClockEntry      *prev;
+    ReliableClockEntry      *next;
+    ReliableClockEntry      *expired;
+    uint64_t                deadline;
+    unsigned int            slot;
+    bool                    scheduled;
+    void (*callback)(void *user_data);
+    void                    *user_data;
+};
+
+struct ReliableClock {
+    pthread_mutex_t         lock;
+    struct TransportWorker  *worker;
+    void                    *timer;
+    uint64_t                armed;      /* Deadline of the worker timer */
+    uint64_t                tick;       /* First slot not yet expired */
+    int                     entries;
+    ReliableClockEntry      *slots[RELIABLE_CLOCK_SLOTS];
+};
+
+ReliableClock *reliable_clock_create(struct TransportWorker *worker);
+
+/*
+ * (Re)schedule @entry to fire at @deadline, in milliseconds of
+ * get_monotonic_time().
+ */
+int reliable_clock_schedule(ReliableClock *clock, ReliableClockEntry *entry,
+                            uint64_t deadline);
+
+void reliable_clock_cancel(ReliableClock *clock, ReliableClockEntry *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RELIABLE_CLOCK_H__ */
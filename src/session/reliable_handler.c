@@ -21,12 +21,16 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <limits.h>
 #include <errno.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
 
 #include <crystal.h>
 
@@ -41,8 +45,21 @@ typedef struct ReliableHandler {
     PseudoTcpSocket *sock;
     int sock_closed; // TODO: check same as pseudo_tcp_socket_is_closed()
 
+    /* Set under the stream lock while a reader hands peeked data up with
+     * the lock released; other readers leave the new data to it. */
+    int reading;
+
     uint64_t last_clock_timeout;
-    Timer *clock;
+    ReliableClock *clock;
+    ReliableClockEntry clock_entry;
+
+    /* Blocking writers wait here for the send buffer to drain. The count
+     * only changes under the stream lock, so a writer that saw the buffer
+     * full can not miss the wakeup. */
+    pthread_mutex_t write_lock;
+    pthread_cond_t write_cond;
+    unsigned int writable_count;
+    int want_writable;
 } ReliableHandler;
 
 /* Maximum size of a UDP packet’s payload, as the packet’s length field is 16b
@@ -51,6 +68,15 @@ typedef struct ReliableHandler {
 
 #define DEFAULT_TCP_MTU 1400 /* Use 1400 because of VPNs and we assume IEE 802.3 */
 
+/* Ceiling of path MTU probing above DEFAULT_TCP_MTU. The ICE sockets don't
+ * set the don't-fragment bit, so a larger probe could arrive in IP fragments
+ * and pass for one that fits. */
+#define PROBE_TCP_MTU 1500
+
+/* Upper bound of one wait for the send buffer, in case a wakeup is lost
+ * to a closing socket. */
+#define WRITE_WAIT_INTERVAL 100
+
 static void reliable_handler_adjust_clock(ReliableHandler *tcp);
 static void reliable_handler_stop(StreamHandler *handler, int error);
 
@@ -68,62 +94,64 @@ void reliable_handler_unlock(ReliableHandler *handler)
     handler->base.stream->unlock(handler->base.stream);
 }
 
+/*
+ * The pseudo-TCP clocks of all streams on a worker share the worker's
+ * reliable clock, see reliable_clock.h.
+ */
 static inline
-int reliable_handler_create_timer(ReliableHandler *handler, unsigned long interval,
-                                  TimerCallback *callback, void *user_data)
+int reliable_handler_create_timer(ReliableHandler *handler, uint64_t next,
+                                  void (*callback)(void *), void *user_data)
 {
     TransportWorker *wk = stream_get_worker(handler->base.stream);
-    assert(wk);
+    assert(wk && wk->reliable_clock);
 
-    return wk->create_timer(wk, handler->base.stream->id | 0x00100000,
-                            interval, callback, user_data, &handler->clock);
+    handler->clock_entry.callback = callback;
+    handler->clock_entry.user_data = user_data;
+    handler->clock = ref(wk->reliable_clock);
+
+    return reliable_clock_schedule(handler->clock, &handler->clock_entry, next);
 }
 
 static inline
-void reliable_handler_schedule_timer(ReliableHandler *handler, unsigned long next)
+void reliable_handler_schedule_timer(ReliableHandler *handler, uint64_t next)
 {
-    TransportWorker *wk = stream_get_worker(handler->base.stream);
-    assert(wk);
-
-    wk->schedule_timer(wk, handler->clock, next);
+    reliable_clock_schedule(handler->clock, &handler->clock_entry, next);
 }
 
 static inline
 void reliable_handler_destroy_timer(ReliableHandler *handler)
 {
-    TransportWorker *wk;
-
     if (!handler->clock)
         return;
 
-    wk = stream_get_worker(handler->base.stream);
-    assert(wk);
-
-    wk->destroy_timer(wk, handler->clock);
+    reliable_clock_cancel(handler->clock, &handler->clock_entry);
+    deref(handler->clock);
     handler->clock = NULL;
 }
 
-static bool reliable_handler_timer_callback(void *user_data)
+static void reliable_handler_timer_callback(void *user_data)
 {
     ReliableHandler *handler = (ReliableHandler *)user_data;
 
     assert(handler && handler->sock);
 
+    reliable_handler_lock(handler);
+
     if (!handler->clock) {
+        reliable_handler_unlock(handler);
         vlogD("Stream: %d pseudo-TCP socket' timer destroyed. "
               "Avoided race condition in pseudo_tcp_socket_notify_clock.",
               handler->base.stream->id);
-        return false;
+        return;
     }
 
-    reliable_handler_lock(handler);
+    // The entry has fired, it must be scheduled again whatever the timeout.
+    handler->last_clock_timeout = 0;
 
     pseudo_tcp_socket_notify_clock(handler->sock);
     reliable_handler_adjust_clock(handler);
 
     reliable_handler_unlock(handler);
-
-    return true;
 }
 
 static void reliable_handler_adjust_clock(ReliableHandler *handler)
@@ -143,13 +171,9 @@ static void reliable_handler_adjust_clock(ReliableHandler *handler)
         if (timeout != handler->last_clock_timeout) {
             handler->last_clock_timeout = timeout;
             if (handler->clock) {
-                reliable_handler_schedule_timer(handler, (unsigned long)timeout);
+                reliable_handler_schedule_timer(handler, timeout);
             } else {
-                long interval = (long)(timeout - (get_monotonic_time() / 1000));
-                if (interval < 0 || interval > INT_MAX)
-                    interval = INT_MAX;
-
-                reliable_handler_create_timer(handler, interval,
+                reliable_handler_create_timer(handler, timeout,
                                               reliable_handler_timer_callback,
                                               handler);
                 // TODO: timer create failed?!
@@ -183,27 +207,61 @@ static void pseudo_tcp_socket_readable(PseudoTcpSocket *sock, void *user_data)
 {
     ReliableHandler *handler = (ReliableHandler *)user_data;
     ElaStream *s = handler->base.stream;
-    FlexBuffer *buf;
+    FlexBuffer view;
+    bool pooled;
 
-    flex_buffer_alloca(buf, FLEX_BUFFER_MAX_LEN, FLEX_PADDING_LEN);
+    // Multiplexer reassembles packets into its own buffer, nothing to save.
+    pooled = stream_wants_rx_buffers(s) && !s->mux;
 
     vlogT("Stream: %d pseudo Tcp socket readable.", s->id);
 
     /* Only dequeue pseudo-TCP data if we can reliably inform the client. The
      * agent lock is held here, so has_io_callback can only change during
      * component_emit_io_callback(), after which it’s re-queried. This ensures
-     * no data loss of packets already received and dequeued. */
-    do {
-        ssize_t len;
+     * no data loss of packets already received and dequeued.
+     *
+     * Data is handed up straight from the pseudo-TCP receive buffer, one
+     * contiguous region at a time, and consumed once the upper handler has
+     * seen it. Only pooled buffers, which the application keeps beyond the
+     * callback, still need a copy.
+     *
+     * Only this callback's own hold of the lock is released around
+     * on_data(). On the ICE receive path the same group lock is held
+     * around the whole pipeline, so upper handlers and the application
+     * still run under it there. The peeked region stays valid while
+     * unlocked: pseudo-TCP does not resize its receive buffer until the
+     * data is consumed, and new data only goes to the free part of it. */
+    reliable_handler_lock(handler);
 
-        reliable_handler_lock(handler);
+    if (handler->reading) {
+        reliable_handler_unlock(handler);
+        return;
+    }
+
+    handler->reading = 1;
 
-        flex_buffer_reset(buf, FLEX_PADDING_LEN);
+    do {
+        ElaStreamBuffer *pbuf = NULL;
+        FlexBuffer *buf = &view;
+        const char *data;
+        ssize_t len;
 
-        /* FIXME: Why copy into a temporary buffer here? Why can’t the I/O
-         * callbacks be emitted directly from the pseudo-TCP receive buffer? */
-        len = pseudo_tcp_socket_recv(sock, flex_buffer_mutable_ptr(buf),
-                                     flex_buffer_available(buf));
+        len = pseudo_tcp_socket_peek(sock, &data);
+        if (len > 0 && pooled)
+            pbuf = buffer_pool_get(stream_get_buffer_pool(s), FLEX_PADDING_LEN);
+
+        if (pbuf) {
+            buf = &pbuf->flex;
+            flex_buffer_reset(buf, FLEX_PADDING_LEN);
+            if ((size_t)len > flex_buffer_available(buf))
+                len = flex_buffer_available(buf);
+            memcpy(flex_buffer_mutable_ptr(buf), data, len);
+            pseudo_tcp_socket_consume(sock, len);
+        } else if (len > 0) {
+            flex_buffer_init(buf, data, len, 0);
+        } else {
+            handler->reading = 0;
+        }
 
         reliable_handler_unlock(handler);
 
@@ -228,7 +286,19 @@ static void pseudo_tcp_socket_readable(PseudoTcpSocket *sock, void *user_data)
 
         handler->base.prev->on_data(handler->base.prev, buf);
 
+        if (pbuf)
+            buffer_release(pbuf);
+
+        reliable_handler_lock(handler);
+
+        /* The view is only valid until the data is consumed; the upper
+         * handler must have copied what it needs by now. */
+        if (!pbuf && !pseudo_tcp_socket_is_closed(handler->sock))
+            pseudo_tcp_socket_consume(sock, len);
+
         if (pseudo_tcp_socket_is_closed(handler->sock)) {
+            handler->reading = 0;
+            reliable_handler_unlock(handler);
             vlogD("Stream: %d pseudoTCP socket got destroyed "
                   "in readable callback!", s->id);
             return;
@@ -238,11 +308,52 @@ static void pseudo_tcp_socket_readable(PseudoTcpSocket *sock, void *user_data)
     reliable_handler_adjust_clock(handler);
 }
 
+/* Called under the stream lock. */
+static void reliable_handler_wake_writers(ReliableHandler *handler)
+{
+    pthread_mutex_lock(&handler->write_lock);
+    handler->writable_count++;
+    pthread_cond_broadcast(&handler->write_cond);
+    pthread_mutex_unlock(&handler->write_lock);
+}
+
+static void reliable_handler_wait_writable(ReliableHandler *handler,
+                                           unsigned int count)
+{
+    struct timeval now;
+    struct timespec deadline;
+    long nsec;
+
+    gettimeofday(&now, NULL);
+    nsec = now.tv_usec * 1000L + WRITE_WAIT_INTERVAL * 1000000L;
+    deadline.tv_sec = now.tv_sec + nsec / 1000000000L;
+    deadline.tv_nsec = nsec % 1000000000L;
+
+    pthread_mutex_lock(&handler->write_lock);
+    while (handler->writable_count == count) {
+        if (pthread_cond_timedwait(&handler->write_cond, &handler->write_lock,
+                                   &deadline) == ETIMEDOUT)
+            break;
+    }
+    pthread_mutex_unlock(&handler->write_lock);
+}
+
 static void pseudo_tcp_socket_writable(PseudoTcpSocket *sock, void *user_data)
 {
     ReliableHandler *tcp = (ReliableHandler *)user_data;
+    ElaStream *s = tcp->base.stream;
+
+    vlogT("Stream: %d pseudo Tcp socket writable", s->id);
+
+    reliable_handler_wake_writers(tcp);
 
-    vlogT("Stream: %d pseudo Tcp socket writable", tcp->base.stream->id);
+    // Called under the stream lock, see ElaStreamCallbacks.stream_writable.
+    if (tcp->want_writable) {
+        tcp->want_writable = 0;
+
+        if (s->callbacks.stream_writable)
+            s->callbacks.stream_writable(s->session, s->id, s->context);
+    }
 }
 
 static void pseudo_tcp_socket_closed(PseudoTcpSocket *sock, uint32_t err,
@@ -253,6 +364,9 @@ static void pseudo_tcp_socket_closed(PseudoTcpSocket *sock, uint32_t err,
     vlogD("Stream: %d pseudo Tcp socket closed.", handler->base.stream->id);
     handler->sock_closed = 1;
 
+    // Let blocked writers see the error.
+    reliable_handler_wake_writers(handler);
+
     // NOTICE: force close pseudo TCP socket locally will cause ECONNABORTED,
     //         do NOT treat this situation as error.
     err = (err == ECONNABORTED) ? 0 : err;
@@ -298,6 +412,8 @@ static PseudoTcpWriteResult pseudo_tcp_socket_write_packet(PseudoTcpSocket *sock
 static int reliable_handler_prepare(StreamHandler *base)
 {
     ReliableHandler *handler = (ReliableHandler *)base;
+    uint32_t mtu_probe_max = PROBE_TCP_MTU;
+    uint32_t ack_freq = 0;
     int rc;
 
     assert(base);
@@ -324,6 +440,56 @@ static int reliable_handler_prepare(StreamHandler *base)
         return ELA_GENERAL_ERROR(ELAERR_OUT_OF_MEMORY);
 
     pseudo_tcp_socket_notify_mtu(handler->sock, DEFAULT_TCP_MTU);
+    pseudo_tcp_socket_set_property(handler->sock, PROP_MTU_PROBE_MAX,
+                                   &mtu_probe_max);
+
+    if (base->stream->buffer_min) {
+        uint32_t size = (uint32_t)base->stream->buffer_min;
+
+        pseudo_tcp_socket_set_property(handler->sock, PROP_RCV_BUF, &size);
+        pseudo_tcp_socket_set_property(handler->sock, PROP_SND_BUF, &size);
+    }
+
+    if (base->stream->buffer_max) {
+        uint32_t size = (uint32_t)base->stream->buffer_max;
+
+        pseudo_tcp_socket_set_property(handler->sock, PROP_RCV_BUF_MAX, &size);
+        pseudo_tcp_socket_set_property(handler->sock, PROP_SND_BUF_MAX, &size);
+    }
+
+    if (base->stream->bbr) {
+        PseudoTcpCongestionControl cc = PSEUDO_TCP_CC_BBR;
+
+        pseudo_tcp_socket_set_property(handler->sock, PROP_CONGESTION_CONTROL,
+                                       &cc);
+    }
+
+    if (base->stream->min_rto) {
+        uint32_t min_rto = base->stream->min_rto;
+
+        pseudo_tcp_socket_set_property(handler->sock, PROP_RTO_MIN, &min_rto);
+    }
+
+    if (base->stream->pacing) {
+        bool pacing = true;
+
+        pseudo_tcp_socket_set_property(handler->sock, PROP_PACING, &pacing);
+    }
+
+    if (base->stream->low_latency) {
+        bool no_delay = true;
+        uint32_t ack_delay = 0;
+
+        ack_freq = 1;
+        pseudo_tcp_socket_set_property(handler->sock, PROP_NO_DELAY, &no_delay);
+        pseudo_tcp_socket_set_property(handler->sock, PROP_ACK_DELAY,
+                                       &ack_delay);
+    }
+
+    /* Adaptive decimation, unless every segment is acknowledged anyway.
+     * Peers that do not advertise support for it still get every other
+     * segment acknowledged. */
+    pseudo_tcp_socket_set_property(handler->sock, PROP_ACK_FREQUENCY, &ack_freq);
 
     vlogD("Stream: %d reliable handler prepared.", base->stream->id);
 
@@ -373,42 +539,56 @@ static
 ssize_t reliable_handler_write(StreamHandler *base, FlexBuffer *buf)
 {
     ReliableHandler *handler = (ReliableHandler *)base;
+    ElaStream *s = base->stream;
     ssize_t sent, len;
-    int retry_delay = 10;
 
     assert(base);
     assert(handler->sock);
 
-    if(base->stream->state != ElaStreamState_connected)
+    if(s->state != ElaStreamState_connected)
         return ELA_GENERAL_ERROR(ELAERR_WRONG_STATE);
 
     len = flex_buffer_size(buf);
 
     while (flex_buffer_size(buf) > 0) {
+        unsigned int count;
+        int error = 0;
+
         reliable_handler_lock(handler);
 
         sent = pseudo_tcp_socket_send(handler->sock, flex_buffer_ptr(buf),
                                       (uint32_t)flex_buffer_size(buf));
+        if (sent < 0)
+            error = pseudo_tcp_socket_get_error(handler->sock);
+
+        if (error == EWOULDBLOCK && s->nonblocking)
+            handler->want_writable = 1;
+        count = handler->writable_count;
+
         reliable_handler_adjust_clock(handler);
 
         reliable_handler_unlock(handler);
 
         if (sent < 0) {
-            int error = pseudo_tcp_socket_get_error(handler->sock);
             if (error != EWOULDBLOCK) {
                 vlogE("Stream: %d reliable handler write data error %d.",
-                      base->stream->id, error);
+                      s->id, error);
 
                 reliable_handler_stop(base, error);
                 return (ssize_t)ELA_SYS_ERROR(error);
+            } else if (s->nonblocking) {
+                sent = len - (ssize_t)flex_buffer_size(buf);
+
+                vlogT("Stream: %d reliable handler busy, wrote %zd of "
+                      "%zd bytes.", s->id, sent, len);
+                return sent > 0 ? sent : (ssize_t)ELA_SYS_ERROR(EAGAIN);
             } else {
-                vlogT("Stream: %d reliable handler busy, retry in %d microseconds.",
-                      base->stream->id, retry_delay);
-                usleep(retry_delay);
-                reliable_handler_adjust_clock(handler);
+                vlogT("Stream: %d reliable handler busy, wait for writable.",
+                      s->id);
+                reliable_handler_wait_writable(handler, count);
 
-                if (retry_delay < 500)  //TODO: need to find better way.
-                    retry_delay += 100;
+                if (s->state != ElaStreamState_connected)
+                    return ELA_GENERAL_ERROR(ELAERR_WRONG_STATE);
                 continue;
             }
         } else {
@@ -462,6 +642,46 @@ void reliable_handler_on_state_changed(StreamHandler *base, int state)
     }
 }
 
+void reliable_handler_get_stats(StreamHandler *base,
+                                ElaStreamReliableStats *stats)
+{
+    ReliableHandler *handler = (ReliableHandler *)base;
+    PseudoTcpStats tcp_stats;
+
+    memset(stats, 0, sizeof(*stats));
+
+    reliable_handler_lock(handler);
+    if (handler->sock) {
+        pseudo_tcp_socket_get_stats(handler->sock, &tcp_stats);
+
+        stats->retransmits = tcp_stats.retransmits;
+        stats->timeouts = tcp_stats.timeouts;
+        stats->tail_loss_probes = tcp_stats.tail_loss_probes;
+        stats->fast_recoveries = tcp_stats.fast_recoveries;
+        stats->time_losses = tcp_stats.rack_losses;
+        stats->mtu_probes = tcp_stats.mtu_probes;
+        stats->srtt = tcp_stats.srtt;
+        stats->rto = tcp_stats.rto;
+    }
+    reliable_handler_unlock(handler);
+}
+
+int reliable_handler_get_mtu(StreamHandler *base)
+{
+    ReliableHandler *handler = (ReliableHandler *)base;
+    PseudoTcpStats tcp_stats;
+    int mtu = 0;
+
+    reliable_handler_lock(handler);
+    if (handler->sock) {
+        pseudo_tcp_socket_get_stats(handler->sock, &tcp_stats);
+        mtu = (int)tcp_stats.mtu;
+    }
+    reliable_handler_unlock(handler);
+
+    return mtu;
+}
+
 static void reliable_handler_destroy(void *p)
 {
     ReliableHandler *handler = (ReliableHandler *)p;
@@ -474,6 +694,9 @@ static void reliable_handler_destroy(void *p)
 
     reliable_handler_destroy_timer(handler);
 
+    pthread_cond_destroy(&handler->write_cond);
+    pthread_mutex_destroy(&handler->write_lock);
+
     if (handler->base.next)
         deref(handler->base.next);
 
@@ -492,6 +715,9 @@ int reliable_handler_create(ElaStream *s, StreamHandler **handler)
     _handler->base.name = "Reliable Handler";
     _handler->base.stream = s;
 
+    pthread_mutex_init(&_handler->write_lock, NULL);
+    pthread_cond_init(&_handler->write_cond, NULL);
+
     _handler->base.init    = default_handler_init;
     _handler->base.prepare = reliable_handler_prepare;
     _handler->base.start   = reliable_handler_start;
@@ -0,0 +1,578 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef HAVE_ARPA_INET_H
+#include <arpa/inet.h>
+#endif
+#ifdef HAVE_WINSOCK2_H
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+#include <crystal.h>
+
+#include "sdp_compact.h"
+
+/*
+ * Compact SDP layout, multi-byte integers in network byte order:
+ *
+ *   u8 magic, u8 version, u8 flags
+ *   bytes origin user (raw public key), u32 origin id, u32 origin version
+ *   addr origin address
+ *   str ice-ufrag, str ice-pwd, [str nonce], [str ciphers]
+ *   u8 media count, then for each media:
+ *     str media, u16 port, u16 fmt, addr connection address
+ *     u8 media flags, u8 candidate count, then for each candidate:
+ *       str foundation, u8 component, u32 priority, u8 type
+ *       addr address, u16 port, [addr related address, u16 related port]
+ *
+ * str and bytes are prefixed with a u8 length, addr is a u8 family (4 or 6)
+ * followed by 4 or 16 bytes.
+ */
+
+#define FLAG_TRICKLE                    0x01
+#define FLAG_NONCE                      0x02
+#define FLAG_CIPHERS                    0x04
+
+#define MEDIA_FLAG_END_OF_CANDIDATES    0x01
+
+#define CAND_FLAG_RELATED               0x80
+
+#define MAX_MEDIA                       32
+#define MAX_LINE                        256
+
+static const char *cand_types[] = { "host", "srflx", "prflx", "relay" };
+
+typedef struct Writer {
+    uint8_t *pos;
+    uint8_t *end;
+    int     error;
+} Writer;
+
+typedef struct Reader {
+    const uint8_t *pos;
+    const uint8_t *end;
+    int     error;
+} Reader;
+
+static void put_bytes(Writer *w, const void *data, size_t len)
+{
+    if (w->error || (size_t)(w->end - w->pos) < len) {
+        w->error = 1;
+        return;
+    }
+
+    memcpy(w->pos, data, len);
+    w->pos += len;
+}
+
+static void put_u8(Writer *w, uint8_t val)
+{
+    put_bytes(w, &val, 1);
+}
+
+static uint8_t *reserve_u8(Writer *w)
+{
+    uint8_t *p = w->pos;
+
+    put_u8(w, 0);
+    return w->error ? NULL : p;
+}
+
+static void put_u16(Writer *w, uint16_t val)
+{
+    uint8_t buf[2] = { (uint8_t)(val >> 8), (uint8_t)val };
+    put_bytes(w, buf, sizeof(buf));
+}
+
+static void put_u32(Writer *w, uint32_t val)
+{
+    uint8_t buf[4] = { (uint8_t)(val >> 24), (uint8_t)(val >> 16),
+                       (uint8_t)(val >> 8), (uint8_t)val };
+    put_bytes(w, buf, sizeof(buf));
+}
+
+static void put_str(Writer *w, const char *str, size_t len)
+{
+    if (len > UINT8_MAX) {
+        w->error = 1;
+        return;
+    }
+
+    put_u8(w, (uint8_t)len);
+    put_bytes(w, str, len);
+}
+
+static void put_addr(Writer *w, const char *addr)
+{
+    uint8_t buf[16];
+
+    if (inet_pton(AF_INET, addr, buf) == 1) {
+        put_u8(w, 4);
+        put_bytes(w, buf, 4);
+    } else if (inet_pton(AF_INET6, addr, buf) == 1) {
+        put_u8(w, 6);
+        put_bytes(w, buf, 16);
+    } else {
+        w->error = 1;
+    }
+}
+
+static const uint8_t *get_bytes(Reader *r, size_t len)
+{
+    const uint8_t *p = r->pos;
+
+    if (r->error || (size_t)(r->end - r->pos) < len) {
+        r->error = 1;
+        return NULL;
+    }
+
+    r->pos += len;
+    return p;
+}
+
+static uint8_t get_u8(Reader *r)
+{
+    const uint8_t *p = get_bytes(r, 1);
+    return p ? p[0] : 0;
+}
+
+static uint16_t get_u16(Reader *r)
+{
+    const uint8_t *p = get_bytes(r, 2);
+    return p ? (uint16_t)((p[0] << 8) | p[1]) : 0;
+}
+
+static uint32_t get_u32(Reader *r)
+{
+    const uint8_t *p = get_bytes(r, 4);
+    return p ? ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+               ((uint32_t)p[2] << 8) | (uint32_t)p[3] : 0;
+}
+
+static const char *get_str(Reader *r, char *buf, size_t size)
+{
+    size_t len = get_u8(r);
+    const uint8_t *p = get_bytes(r, len);
+
+    if (!p || len >= size) {
+        r->error = 1;
+        return "";
+    }
+
+    memcpy(buf, p, len);
+    buf[len] = 0;
+    return buf;
+}
+
+static const char *get_addr(Reader *r, char *buf, size_t size, int *family)
+{
+    uint8_t type = get_u8(r);
+    const uint8_t *p;
+
+    if (type == 4) {
+        p = get_bytes(r, 4);
+        if (p && inet_ntop(AF_INET, (void *)p, buf, (socklen_t)size)) {
+            *family = 4;
+            return buf;
+        }
+    } else if (type == 6) {
+        p = get_bytes(r, 16);
+        if (p && inet_ntop(AF_INET6, (void *)p, buf, (socklen_t)size)) {
+            *family = 6;
+            return buf;
+        }
+    }
+
+    r->error = 1;
+    return "";
+}
+
+/*
+ * Returns the next line without line terminator, or NULL at the end.
+ */
+static const char *next_line(const char **pos, const char *end,
+                             char *line, size_t size)
+{
+    const char *p = *pos;
+    const char *eol;
+    size_t len;
+
+    while (p < end && (*p == '\r' || *p == '\n'))
+        p++;
+
+    if (p >= end || *p == 0)
+        return NULL;
+
+    eol = p;
+    while (eol < end && *eol && *eol != '\r' && *eol != '\n')
+        eol++;
+
+    len = (size_t)(eol - p);
+    if (len >= size)
+        return NULL;
+
+    memcpy(line, p, len);
+    line[len] = 0;
+
+    *pos = eol;
+    return line;
+}
+
+static int encode_candidate(Writer *w, const char *value)
+{
+    char foundation[33], transport[13], ipaddr[46], type[8], raddr[46];
+    unsigned int comp_id, prio, port, rport;
+    uint8_t type_idx;
+    int cnt;
+
+    cnt = sscanf(value, "%32s %u %12s %u %45s %u typ %7s raddr %45s rport %u",
+                 foundation, &comp_id, transport, &prio, ipaddr, &port,
+                 type, raddr, &rport);
+    if ((cnt != 7 && cnt != 9) || strcmp(transport, "UDP") != 0 ||
+        comp_id > UINT8_MAX || port > UINT16_MAX ||
+        (cnt == 9 && rport > UINT16_MAX))
+        return -1;
+
+    for (type_idx = 0; type_idx < sizeof(cand_types) / sizeof(cand_types[0]);
+         type_idx++) {
+        if (strcmp(type, cand_types[type_idx]) == 0)
+            break;
+    }
+
+    if (type_idx == sizeof(cand_types) / sizeof(cand_types[0]))
+        return -1;
+
+    put_str(w, foundation, strlen(foundation));
+    put_u8(w, (uint8_t)comp_id);
+    put_u32(w, (uint32_t)prio);
+    put_u8(w, type_idx | (cnt == 9 ? CAND_FLAG_RELATED : 0));
+    put_addr(w, ipaddr);
+    put_u16(w, (uint16_t)port);
+
+    if (cnt == 9) {
+        put_addr(w, raddr);
+        put_u16(w, (uint16_t)rport);
+    }
+
+    return w->error ? -1 : 0;
+}
+
+int sdp_compact_encode(const char *sdp, size_t len, uint8_t *buf, size_t size)
+{
+    Writer w = { buf, buf + size, 0 };
+    const char *pos = sdp;
+    const char *end = sdp + len;
+    char line[MAX_LINE];
+    uint8_t *flags = NULL;
+    uint8_t *media_cnt = NULL;
+    uint8_t *media_flags = NULL;
+    uint8_t *cand_cnt = NULL;
+    const char *ufrag = NULL, *pwd = NULL, *nonce = NULL, *ciphers = NULL;
+    char ufrag_buf[MAX_LINE], pwd_buf[MAX_LINE], nonce_buf[MAX_LINE];
+    char ciphers_buf[MAX_LINE];
+    int has_origin = 0;
+    int has_name = 0;
+
+    assert(sdp && buf);
+
+    put_u8(&w, SDP_COMPACT_MAGIC);
+    put_u8(&w, SDP_COMPACT_VERSION);
+    flags = reserve_u8(&w);
+    if (!flags)
+        return -1;
+
+    while (!w.error && next_line(&pos, end, line, sizeof(line))) {
+        if (!media_cnt) {
+            // Session level lines.
+            if (strcmp(line, "v=0") == 0 || strcmp(line, "t=0 0") == 0) {
+                continue;
+            } else if (strncmp(line, "o=", 2) == 0) {
+                char user[128], addr_type[4], addr[46];
+                uint8_t key[64];
+                unsigned int id, version;
+                ssize_t key_len;
+
+                if (sscanf(line + 2, "%127s %u %u IN %3s %45s", user, &id,
+                           &version, addr_type, addr) != 5)
+                    return -1;
+
+                key_len = base58_decode(user, strlen(user), key, sizeof(key));
+                if (key_len <= 0)
+                    return -1;
+
+                put_str(&w, (const char *)key, (size_t)key_len);
+                put_u32(&w, (uint32_t)id);
+                put_u32(&w, (uint32_t)version);
+                put_addr(&w, addr);
+                has_origin = 1;
+            } else if (strcmp(line, "s=elastos-ice-session") == 0) {
+                has_name = 1;
+            } else if (strncmp(line, "a=ice-ufrag:", 12) == 0) {
+                ufrag = strcpy(ufrag_buf, line + 12);
+            } else if (strncmp(line, "a=ice-pwd:", 10) == 0) {
+                pwd = strcpy(pwd_buf, line + 10);
+            } else if (strncmp(line, "a=nonce:", 8) == 0) {
+                nonce = strcpy(nonce_buf, line + 8);
+                *flags |= FLAG_NONCE;
+            } else if (strncmp(line, "a=x-cipher:", 11) == 0) {
+                ciphers = strcpy(ciphers_buf, line + 11);
+                *flags |= FLAG_CIPHERS;
+            } else if (strcmp(line, "a=ice-options:trickle") == 0) {
+                *flags |= FLAG_TRICKLE;
+            } else if (strcmp(line, "a=" SDP_COMPACT_ATTRIBUTE) == 0) {
+                continue;
+            } else if (strncmp(line, "m=", 2) == 0) {
+                if (!has_origin || !has_name || !ufrag || !pwd)
+                    return -1;
+
+                put_str(&w, ufrag, strlen(ufrag));
+                put_str(&w, pwd, strlen(pwd));
+                if (nonce)
+                    put_str(&w, nonce, strlen(nonce));
+                if (ciphers)
+                    put_str(&w, ciphers, strlen(ciphers));
+
+                media_cnt = reserve_u8(&w);
+                if (!media_cnt)
+                    return -1;
+            } else {
+                return -1;
+            }
+
+            if (!media_cnt)
+                continue;
+        }
+
+        if (strncmp(line, "m=", 2) == 0) {
+            char media[16];
+            unsigned int port, fmt;
+
+            if (sscanf(line + 2, "%15s %u UDP %u", media, &port, &fmt) != 3 ||
+                port > UINT16_MAX || fmt > UINT16_MAX ||
+                *media_cnt == MAX_MEDIA || (*media_cnt && !media_flags))
+                return -1;
+
+            put_str(&w, media, strlen(media));
+            put_u16(&w, (uint16_t)port);
+            put_u16(&w, (uint16_t)fmt);
+
+            (*media_cnt)++;
+            media_flags = cand_cnt = NULL;
+        } else if (strncmp(line, "c=", 2) == 0) {
+            char addr_type[4], addr[46];
+
+            if (media_flags ||
+                sscanf(line + 2, "IN %3s %45s", addr_type, addr) != 2)
+                return -1;
+
+            put_addr(&w, addr);
+
+            media_flags = reserve_u8(&w);
+            cand_cnt = reserve_u8(&w);
+            if (!media_flags || !cand_cnt)
+                return -1;
+        } else if (strncmp(line, "a=candidate:", 12) == 0) {
+            if (!cand_cnt || *cand_cnt == UINT8_MAX ||
+                encode_candidate(&w, line + 12) < 0)
+                return -1;
+
+            (*cand_cnt)++;
+        } else if (strcmp(line, "a=end-of-candidates") == 0) {
+            if (!media_flags)
+                return -1;
+
+            *media_flags |= MEDIA_FLAG_END_OF_CANDIDATES;
+        } else {
+            return -1;
+        }
+    }
+
+    // Every media needs a connection line.
+    if (w.error || !media_cnt || !*media_cnt || !media_flags)
+        return -1;
+
+    return (int)(w.pos - buf);
+}
+
+static int append(char **pos, char *end, const char *fmt, ...)
+{
+    va_list args;
+    int rc;
+
+    va_start(args, fmt);
+    rc = vsnprintf(*pos, (size_t)(end - *pos), fmt, args);
+    va_end(args);
+
+    if (rc < 0 || rc >= end - *pos)
+        return -1;
+
+    *pos += rc;
+    return 0;
+}
+
+int sdp_compact_decode(const uint8_t *data, size_t len, char *sdp, size_t size)
+{
+    Reader r = { data, data + len, 0 };
+    char *pos = sdp;
+    char *end = sdp + size;
+    char str[MAX_LINE];
+    char addr[46];
+    char user[128];
+    size_t user_len = sizeof(user);
+    const uint8_t *key;
+    size_t key_len;
+    uint32_t id, version;
+    uint8_t flags;
+    int media_cnt;
+    int family;
+    int i, j;
+
+    assert(data && sdp);
+
+    if (!sdp_is_compact(data, len))
+        return -1;
+
+    get_u8(&r);
+    if (get_u8(&r) != SDP_COMPACT_VERSION)
+        return -1;
+
+    flags = get_u8(&r);
+
+    key_len = get_u8(&r);
+    key = get_bytes(&r, key_len);
+    if (!key || !base58_encode(key, key_len, user, &user_len))
+        return -1;
+
+    id = get_u32(&r);
+    version = get_u32(&r);
+    get_addr(&r, addr, sizeof(addr), &family);
+    if (r.error)
+        return -1;
+
+    if (append(&pos, end, "v=0\r\no=%s %u %u IN IP%d %s\r\n"
+               "s=elastos-ice-session\r\nt=0 0\r\n",
+               user, id, version, family, addr) < 0)
+        return -1;
+
+    get_str(&r, str, sizeof(str));
+    if (r.error || append(&pos, end, "a=ice-ufrag:%s\r\n", str) < 0)
+        return -1;
+
+    get_str(&r, str, sizeof(str));
+    if (r.error || append(&pos, end, "a=ice-pwd:%s\r\n", str) < 0)
+        return -1;
+
+    if (flags & FLAG_NONCE) {
+        get_str(&r, str, sizeof(str));
+        if (r.error || append(&pos, end, "a=nonce:%s\r\n", str) < 0)
+            return -1;
+    }
+
+    if (flags & FLAG_CIPHERS) {
+        get_str(&r, str, sizeof(str));
+        if (r.error || append(&pos, end, "a=x-cipher:%s\r\n", str) < 0)
+            return -1;
+    }
+
+    if ((flags & FLAG_TRICKLE) &&
+        append(&pos, end, "a=ice-options:trickle\r\n") < 0)
+        return -1;
+
+    // The peer sending compact SDP understands it.
+    if (append(&pos, end, "a=" SDP_COMPACT_ATTRIBUTE "\r\n") < 0)
+        return -1;
+
+    media_cnt = get_u8(&r);
+    if (r.error || media_cnt == 0 || media_cnt > MAX_MEDIA)
+        return -1;
+
+    for (i = 0; i < media_cnt; i++) {
+        uint16_t port, fmt;
+        uint8_t media_flags;
+        int cand_cnt;
+
+        get_str(&r, str, sizeof(str));
+        port = get_u16(&r);
+        fmt = get_u16(&r);
+        get_addr(&r, addr, sizeof(addr), &family);
+        media_flags = get_u8(&r);
+        cand_cnt = get_u8(&r);
+        if (r.error)
+            return -1;
+
+        if (append(&pos, end, "m=%s %u UDP %u\r\nc=IN IP%d %s\r\n",
+                   str, port, fmt, family, addr) < 0)
+            return -1;
+
+        for (j = 0; j < cand_cnt; j++) {
+            char foundation[33];
+            char raddr[46];
+            uint8_t comp_id, type;
+            uint32_t prio;
+
+            get_str(&r, foundation, sizeof(foundation));
+            comp_id = get_u8(&r);
+            prio = get_u32(&r);
+            type = get_u8(&r);
+            get_addr(&r, addr, sizeof(addr), &family);
+            port = get_u16(&r);
+            if (r.error ||
+                (type & ~CAND_FLAG_RELATED) >= sizeof(cand_types) / sizeof(cand_types[0]))
+                return -1;
+
+            if (append(&pos, end, "a=candidate:%s %u UDP %u %s %u typ %s",
+                       foundation, comp_id, prio, addr, port,
+                       cand_types[type & ~CAND_FLAG_RELATED]) < 0)
+                return -1;
+
+            if (type & CAND_FLAG_RELATED) {
+                uint16_t rport;
+
+                get_addr(&r, raddr, sizeof(raddr), &family);
+                rport = get_u16(&r);
+                if (r.error ||
+                    append(&pos, end, " raddr %s rport %u", raddr, rport) < 0)
+                    return -1;
+            }
+
+            if (append(&pos, end, "\r\n") < 0)
+                return -1;
+        }
+
+        if ((media_flags & MEDIA_FLAG_END_OF_CANDIDATES) &&
+            append(&pos, end, "a=end-of-candidates\r\n") < 0)
+            return -1;
+    }
+
+    if (r.pos != r.end)
+        return -1;
+
+    return (int)(pos - sdp);
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SDP_COMPACT_H__
+#define __SDP_COMPACT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <crystal.h>
+
+#include "session.h"
+
+/*
+ * Text SDP always starts with "v=", so a leading magic byte is enough to
+ * tell the compact binary form apart on the receiving side.
+ */
+#define SDP_COMPACT_MAGIC               0xEC
+#define SDP_COMPACT_VERSION             1
+
+/* Session attribute advertising compact SDP support in text SDP */
+#define SDP_COMPACT_ATTRIBUTE           "x-compact"
+
+static inline
+bool sdp_is_compact(const void *data, size_t len)
+{
+    return len > 2 && ((const uint8_t *)data)[0] == SDP_COMPACT_MAGIC;
+}
+
+/*
+ * Encode the text SDP generated by the ICE transport to compact binary
+ * form. Returns the encoded length, or -1 if the SDP contains anything the
+ * compact form can not carry, in which case the text SDP should be sent.
+ */
+int sdp_compact_encode(const char *sdp, size_t len, uint8_t *buf, size_t size);
+
+/*
+ * Decode compact binary SDP back to null terminated text SDP. Returns the
+ * text length without the terminal null, or -1 if the data is malformed.
+ */
+int sdp_compact_decode(const uint8_t *data, size_t len, char *sdp, size_t size);
+
+/*
+ * Friends known to understand compact SDP, learned from their requests and
+ * replies.
+ */
+typedef struct CompactPeer {
+    hash_entry_t        he;
+    char                friendid[ELA_MAX_ID_LEN + 1];
+} CompactPeer;
+
+static inline
+int compact_peers_key_compare(const void *key1, size_t len1,
+                              const void *key2, size_t len2)
+{
+    return strcmp(key1, key2);
+}
+
+static inline
+hashtable_t *compact_peers_create(int capacity)
+{
+    return hashtable_create(capacity, 1, NULL, compact_peers_key_compare);
+}
+
+static inline
+void compact_peers_put(hashtable_t *htab, CompactPeer *peer)
+{
+    peer->he.data = peer;
+    peer->he.key = (void *)peer->friendid;
+    peer->he.keylen = strlen(peer->friendid);
+
+    hashtable_put(htab, &peer->he);
+}
+
+static inline
+int compact_peers_exist(hashtable_t *htab, const char *friendid)
+{
+    return hashtable_exist(htab, (void *)friendid, strlen(friendid));
+}
+
+#endif /* __SDP_COMPACT_H__ */
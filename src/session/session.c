@@ -32,6 +32,9 @@
 #include "ela_turnserver.h"
 #include "portforwarding.h"
 #include "services.h"
+#include "trickles.h"
+#include "invites.h"
+#include "sdp_compact.h"
 #include "session.h"
 #include "stream_handler.h"
 #include "multiplex_handler.h"
@@ -39,6 +42,9 @@
 #include "ice.h"
 
 #define SDP_MAX_LEN                 2048
+
+/* Reuse the acquired TURN credentials for sessions created in a while */
+#define TURN_CREDENTIAL_TTL         600 /* 10 minutes */
 static const char *extension_name = "session";
 
 #if defined(__ANDROID__)
@@ -91,6 +97,86 @@ int ela_session_register_strerror()
     return 0;
 }
 
+static void compact_peer_learn(SessionExtension *ext, const char *friendid)
+{
+    CompactPeer *peer;
+
+    if (compact_peers_exist(ext->compact_peers, friendid))
+        return;
+
+    peer = (CompactPeer *)rc_zalloc(sizeof(CompactPeer), NULL);
+    if (!peer)
+        return;
+
+    strncpy(peer->friendid, friendid, sizeof(peer->friendid) - 1);
+    compact_peers_put(ext->compact_peers, peer);
+    deref(peer);
+}
+
+/*
+ * Applications always get text SDP, the compact form only lives on wire.
+ */
+static const char *remote_sdp_text(SessionExtension *ext, const char *from,
+                                   const void *data, size_t *len,
+                                   char *sdp, size_t size)
+{
+    int rc;
+
+    if (sdp_is_compact(data, *len)) {
+        rc = sdp_compact_decode((const uint8_t *)data, *len, sdp, size);
+        if (rc < 0)
+            return NULL;
+
+        compact_peer_learn(ext, from);
+        *len = (size_t)rc + 1;
+        return sdp;
+    }
+
+    if (*len > 0 && ((const char *)data)[*len - 1] == 0 &&
+        strstr((const char *)data, "a=" SDP_COMPACT_ATTRIBUTE))
+        compact_peer_learn(ext, from);
+
+    return (const char *)data;
+}
+
+static const void *local_sdp_wire(ElaSession *ws, const char *sdp, size_t *len,
+                                  uint8_t *buf, size_t size)
+{
+    SessionExtension *ext = session_get_extension(ws);
+    int rc;
+
+    if (!compact_peers_exist(ext->compact_peers, ws->to))
+        return sdp;
+
+    rc = sdp_compact_encode(sdp, *len, buf, size);
+    if (rc < 0) {
+        vlogW("Session: Can not encode compact SDP, use text SDP instead.");
+        return sdp;
+    }
+
+    vlogD("Session: Compact SDP with %d bytes, text SDP with %zu bytes.",
+          rc, *len);
+
+    *len = (size_t)rc;
+    return buf;
+}
+
+static void invite_received(SessionExtension *ext, const char *friendid)
+{
+    Invite *invite;
+
+    invite = (Invite *)rc_zalloc(sizeof(Invite), NULL);
+    if (!invite)
+        return;
+
+    invite->received = (int64_t)get_monotonic_time();
+    strncpy(invite->friendid, friendid, sizeof(invite->friendid) - 1);
+
+    deref(invites_remove(ext->invites, friendid));
+    invites_put(ext->invites, invite);
+    deref(invite);
+}
+
 static void friend_invite(ElaCarrier *w, const char *from, const char *bundle,
                           const char *data, size_t len, void *context)
 {
@@ -98,6 +184,7 @@ static void friend_invite(ElaCarrier *w, const char *from, const char *bundle,
     ElaSessionRequestCallback *callback = NULL;
     void *callback_context = NULL;
     list_iterator_t it;
+    char sdp[SDP_MAX_LEN];
 
     ext = (SessionExtension *)context;
     if (!ext) {
@@ -105,9 +192,17 @@ static void friend_invite(ElaCarrier *w, const char *from, const char *bundle,
         return;
     }
 
+    data = remote_sdp_text(ext, from, data, &len, sdp, sizeof(sdp));
+    if (!data) {
+        vlogE("Session: Invalid compact SDP from %s, dropped.", from);
+        return;
+    }
+
     vlogD("Session: Session request from %s with bundle: %s, SDP: %s",
           from, bundle, data);
 
+    invite_received(ext, from);
+
     pthread_rwlock_rdlock(&ext->callbacks_lock);
 
     if (!bundle || !*bundle) {
@@ -148,12 +243,263 @@ static void friend_invite(ElaCarrier *w, const char *from, const char *bundle,
         callback(w, from, bundle, data, len, callback_context);
 }
 
+static void trickle_destroy(void *p)
+{
+    Trickle *trickle = (Trickle *)p;
+
+    if (trickle->session)
+        deref(trickle->session);
+}
+
+/*
+ * Drop pending entries nobody attached to in time, and the leftovers of
+ * closed sessions. Returns the number of entries still pending for 'from'.
+ * Called with trickles_lock held.
+ */
+static int trickles_expire(SessionExtension *ext, const char *from)
+{
+    hashtable_iterator_t it;
+    Trickle *trickle;
+    int64_t now = (int64_t)get_monotonic_time();
+    size_t from_len = from ? strlen(from) : 0;
+    int pending = 0;
+    int rc;
+
+rescan:
+    pending = 0;
+    trickles_iterate(ext->trickles, &it);
+    while (trickles_iterator_has_next(&it)) {
+        rc = trickles_iterator_next(&it, &trickle);
+        if (rc == 0)
+            break;
+
+        if (rc == -1)
+            goto rescan;
+
+        if (!trickle->session && now >= trickle->expire) {
+            trickles_iterator_remove(&it);
+            deref(trickle);
+            continue;
+        }
+
+        if (from && !trickle->session && !trickle->detached &&
+                strncmp(trickle->key, from, from_len) == 0 &&
+                trickle->key[from_len] == ':')
+            pending++;
+
+        deref(trickle);
+    }
+
+    return pending;
+}
+
+static void friend_message(ElaCarrier *w, const char *from,
+                           const void *msg, size_t len, void *context)
+{
+    SessionExtension *ext = (SessionExtension *)context;
+    const char *ufrag = "a=ice-ufrag:";
+    char *data;
+    ElaSession *ws = NULL;
+    Trickle *trickle;
+    char key[ELA_MAX_ID_LEN + 82];
+    size_t ufrag_len;
+
+    if (!ext) {
+        vlogE("Session: Internal error!");
+        return;
+    }
+
+    // IMPORTANT: add terminal null
+    data = (char *)alloca(len + 1);
+    memcpy(data, msg, len);
+    data[len] = 0;
+
+    if (len <= strlen(ufrag) || strncmp(data, ufrag, strlen(ufrag)) != 0) {
+        vlogW("Session: Invalid session message from %s, dropped.", from);
+        return;
+    }
+
+    ufrag_len = strcspn(data + strlen(ufrag), "\r\n");
+    if (ufrag_len == 0 || ufrag_len >= sizeof(ws->trickle.peer_ufrag)) {
+        vlogW("Session: Invalid trickle candidates from %s, dropped.", from);
+        return;
+    }
+
+    sprintf(key, "%s:%.*s", from, (int)ufrag_len, data + strlen(ufrag));
+
+    pthread_mutex_lock(&ext->trickles_lock);
+
+    trickle = trickles_get(ext->trickles, key);
+    if (!trickle) {
+        if (trickles_expire(ext, from) >= TRICKLE_MAX_PENDING_PER_PEER) {
+            pthread_mutex_unlock(&ext->trickles_lock);
+            vlogW("Session: Too many pending trickle sessions from %s, "
+                  "candidates dropped.", from);
+            return;
+        }
+
+        trickle = (Trickle *)rc_zalloc(sizeof(Trickle), trickle_destroy);
+        if (!trickle) {
+            pthread_mutex_unlock(&ext->trickles_lock);
+            vlogE("Session: Out of memory, trickle candidates dropped.");
+            return;
+        }
+
+        strcpy(trickle->key, key);
+        trickle->expire = (int64_t)get_monotonic_time() +
+                          (int64_t)TRICKLE_PENDING_TIMEOUT * 1000000;
+        trickles_put(ext->trickles, trickle);
+    }
+
+    if (trickle->detached) {
+        vlogD("Session: Session to %s closed, trickle candidates dropped.",
+              from);
+    } else if (trickle->session) {
+        ws = trickle->session;
+        ref(ws);
+    } else if (trickle->len + len <= sizeof(trickle->data)) {
+        memcpy(trickle->data + trickle->len, data, len);
+        trickle->len += len;
+    } else {
+        vlogW("Session: Too many pending trickle candidates from %s, dropped.",
+              from);
+    }
+
+    deref(trickle);
+    pthread_mutex_unlock(&ext->trickles_lock);
+
+    if (ws) {
+        int rc = ws->apply_remote_candidates(ws, data, len);
+        if (rc < 0)
+            vlogW("Session: Session to %s can not apply trickle candidates(0x%x).",
+                  ws->to, rc);
+        deref(ws);
+    } else {
+        vlogD("Session: Trickle candidates from %s pending.", from);
+    }
+}
+
+static void trickle_attach(ElaSession *ws)
+{
+    SessionExtension *ext = session_get_extension(ws);
+    Trickle *trickle;
+    char key[ELA_MAX_ID_LEN + 82];
+    char *pending = NULL;
+    size_t len = 0;
+
+    sprintf(key, "%s:%s", ws->to, ws->trickle.peer_ufrag);
+
+    pthread_mutex_lock(&ext->trickles_lock);
+
+    trickle = trickles_get(ext->trickles, key);
+    if (!trickle) {
+        trickle = (Trickle *)rc_zalloc(sizeof(Trickle), trickle_destroy);
+        if (!trickle) {
+            pthread_mutex_unlock(&ext->trickles_lock);
+            vlogE("Session: Out of memory, can not receive trickle candidates.");
+            return;
+        }
+
+        strcpy(trickle->key, key);
+        trickles_put(ext->trickles, trickle);
+    }
+
+    if (!trickle->session) {
+        trickle->session = ws;
+        trickle->detached = 0;
+        ref(ws);
+    }
+
+    if (trickle->len) {
+        pending = (char *)alloca(trickle->len + 1);
+        memcpy(pending, trickle->data, trickle->len);
+        pending[trickle->len] = 0;
+        len = trickle->len;
+        trickle->len = 0;
+    }
+
+    deref(trickle);
+    pthread_mutex_unlock(&ext->trickles_lock);
+
+    if (len > 0) {
+        int rc = ws->apply_remote_candidates(ws, pending, len);
+        if (rc < 0)
+            vlogW("Session: Session to %s can not apply pending trickle "
+                  "candidates(0x%x).", ws->to, rc);
+    }
+}
+
+static void trickle_detach(ElaSession *ws)
+{
+    SessionExtension *ext = session_get_extension(ws);
+    Trickle *trickle;
+    char key[ELA_MAX_ID_LEN + 82];
+
+    if (!*ws->trickle.peer_ufrag)
+        return;
+
+    sprintf(key, "%s:%s", ws->to, ws->trickle.peer_ufrag);
+
+    pthread_mutex_lock(&ext->trickles_lock);
+
+    /*
+     * Keep the entry a while as closed, otherwise candidates still on
+     * the way would create a new pending one nobody ever attaches to.
+     */
+    trickle = trickles_get(ext->trickles, key);
+    if (trickle && trickle->session == ws) {
+        trickle->session = NULL;
+        trickle->detached = 1;
+        trickle->len = 0;
+        trickle->expire = (int64_t)get_monotonic_time() +
+                          (int64_t)TRICKLE_PENDING_TIMEOUT * 1000000;
+        deref(ws);
+    }
+
+    if (trickle)
+        deref(trickle);
+
+    trickles_expire(ext, NULL);
+
+    pthread_mutex_unlock(&ext->trickles_lock);
+}
+
+int session_send_trickle(ElaSession *ws, const char *data, size_t len)
+{
+    ElaCarrier *w;
+    char *ext_to;
+    int rc;
+
+    assert(ws && data && len);
+
+    w = session_get_extension(ws)->carrier;
+    assert(w);
+
+    ext_to = (char *)alloca(ELA_MAX_ID_LEN + strlen(extension_name) + 2);
+    strcpy(ext_to, ws->to);
+    strcat(ext_to, ":");
+    strcat(ext_to, extension_name);
+
+    rc = ela_send_friend_message(w, ext_to, data, len);
+
+    vlogD("Session: Send trickle candidates to %s %s.", ws->to,
+          rc == 0 ? "success" : "failed");
+
+    return rc < 0 ? ela_get_error() : 0;
+}
+
 static void remove_transport(ElaTransport *);
 
 static void extension_destroy(void *p)
 {
     SessionExtension *ext = (SessionExtension *)p;
 
+    // Finish offloaded packets first, they hold sessions and streams.
+    if (ext->crypto_pool) {
+        deref(ext->crypto_pool);
+        ext->crypto_pool = NULL;
+    }
+
     ext->carrier->extension = NULL;
 
     if (ext->transport) {
@@ -166,7 +512,26 @@ static void extension_destroy(void *p)
         ext->callbacks = NULL;
     }
 
+    if (ext->trickles) {
+        deref(ext->trickles);
+        ext->trickles = NULL;
+    }
+
+    if (ext->compact_peers) {
+        deref(ext->compact_peers);
+        ext->compact_peers = NULL;
+    }
+
+    if (ext->invites) {
+        deref(ext->invites);
+        ext->invites = NULL;
+    }
+
     pthread_rwlock_destroy(&ext->callbacks_lock);
+    pthread_rwlock_destroy(&ext->streams_lock);
+    pthread_mutex_destroy(&ext->trickles_lock);
+    pthread_mutex_destroy(&ext->turn_lock);
+    pthread_mutex_destroy(&ext->crypto_pool_lock);
 
     ids_heap_destroy((ids_heap_t *)&ext->stream_ids);
 
@@ -229,6 +594,8 @@ int ela_session_init(ElaCarrier *w)
     ext->carrier = w;
     ext->friend_invite_cb = friend_invite;
     ext->friend_invite_context = ext;
+    ext->friend_message_cb = friend_message;
+    ext->friend_message_context = ext;
     ext->create_transport = ice_transport_create;
 
     rc = pthread_rwlock_init(&ext->callbacks_lock, NULL);
@@ -239,6 +606,14 @@ int ela_session_init(ElaCarrier *w)
         return -1;
     }
 
+    rc = pthread_rwlock_init(&ext->streams_lock, NULL);
+    if (rc != 0) {
+        deref(ext);
+        pthread_mutex_unlock(&w->ext_mutex);
+        ela_set_error(ELA_SYS_ERROR(rc));
+        return -1;
+    }
+
     ext->callbacks = list_create(0, NULL);
     if (!ext->callbacks) {
         deref(ext);
@@ -247,6 +622,34 @@ int ela_session_init(ElaCarrier *w)
         return -1;
     }
 
+    pthread_mutex_init(&ext->trickles_lock, NULL);
+    pthread_mutex_init(&ext->turn_lock, NULL);
+    pthread_mutex_init(&ext->crypto_pool_lock, NULL);
+
+    ext->trickles = trickles_create(8);
+    if (!ext->trickles) {
+        deref(ext);
+        pthread_mutex_unlock(&w->ext_mutex);
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_OUT_OF_MEMORY));
+        return -1;
+    }
+
+    ext->compact_peers = compact_peers_create(8);
+    if (!ext->compact_peers) {
+        deref(ext);
+        pthread_mutex_unlock(&w->ext_mutex);
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_OUT_OF_MEMORY));
+        return -1;
+    }
+
+    ext->invites = invites_create(8);
+    if (!ext->invites) {
+        deref(ext);
+        pthread_mutex_unlock(&w->ext_mutex);
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_OUT_OF_MEMORY));
+        return -1;
+    }
+
     rc = ids_heap_init((ids_heap_t *)&ext->stream_ids, MAX_STREAM_ID);
     if (rc < 0) {
         deref(ext);
@@ -415,12 +818,76 @@ void transport_base_destroy(void *p)
     vlogD("Session: ICE transport destroyed.");
 }
 
+void worker_base_destroy(void *p)
+{
+    TransportWorker *worker = (TransportWorker *)p;
+
+    if (worker->buffers)
+        deref(worker->buffers);
+
+    if (worker->reliable_clock)
+        deref(worker->reliable_clock);
+}
+
+/*
+ * The index holds its own reference, so a lookup never races with the
+ * final deref of a stream.
+ */
+static void stream_index_put(ElaStream *s)
+{
+    SessionExtension *ext = stream_get_extension(s);
+
+    assert(s->id > 0 && s->id <= MAX_STREAM_ID);
+
+    pthread_rwlock_wrlock(&ext->streams_lock);
+    assert(!ext->streams[s->id]);
+    ext->streams[s->id] = s;
+    ref(s);
+    pthread_rwlock_unlock(&ext->streams_lock);
+}
+
+static void stream_index_remove(ElaStream *s)
+{
+    SessionExtension *ext = stream_get_extension(s);
+    ElaStream *indexed;
+
+    pthread_rwlock_wrlock(&ext->streams_lock);
+    indexed = ext->streams[s->id];
+    if (indexed == s)
+        ext->streams[s->id] = NULL;
+    else
+        indexed = NULL;
+    pthread_rwlock_unlock(&ext->streams_lock);
+
+    if (indexed)
+        deref(indexed);
+}
+
 void session_base_destroy(void *p)
 {
     ElaSession *ws = (ElaSession *)p;
 
-    if (ws->streams)
+    if (ws->streams) {
+        list_iterator_t it;
+        ElaStream *s;
+        int rc;
+
+reindex:
+        list_iterate(ws->streams, &it);
+        while (list_iterator_has_next(&it)) {
+            rc = list_iterator_next(&it, (void **)&s);
+            if (rc == 0)
+                break;
+
+            if (rc == -1)
+                goto reindex;
+
+            stream_index_remove(s);
+            deref(s);
+        }
+
         deref(ws->streams);
+    }
 
     if (ws->portforwarding.services)
         deref(ws->portforwarding.services);
@@ -428,12 +895,50 @@ void session_base_destroy(void *p)
     if (ws->worker)
         deref(ws->worker);
 
+    pthread_mutex_destroy(&ws->timing.lock);
+
     vlogD("Session: Session to %s destroyed.", ws->to);
 
     if (ws->to)
         free(ws->to);
 }
 
+static int get_turn_server(SessionExtension *ext, ElaTurnServer *turn_server)
+{
+    int64_t now = (int64_t)get_monotonic_time();
+    int rc;
+
+    pthread_mutex_lock(&ext->turn_lock);
+
+    if (*ext->turn_server.server && now < ext->turn_expire) {
+        memcpy(turn_server, &ext->turn_server, sizeof(ElaTurnServer));
+        pthread_mutex_unlock(&ext->turn_lock);
+
+        vlogD("Session: Reuse TURN server %s.", turn_server->server);
+        return 0;
+    }
+
+    rc = ela_get_turn_server(ext->carrier, turn_server);
+    if (rc == 0) {
+        memcpy(&ext->turn_server, turn_server, sizeof(ElaTurnServer));
+        ext->turn_expire = now + (int64_t)TURN_CREDENTIAL_TTL * 1000000;
+    }
+
+    pthread_mutex_unlock(&ext->turn_lock);
+
+    return rc;
+}
+
+void session_reset_turn_server(ElaSession *ws)
+{
+    SessionExtension *ext = session_get_extension(ws);
+
+    pthread_mutex_lock(&ext->turn_lock);
+    memset(&ext->turn_server, 0, sizeof(ElaTurnServer));
+    ext->turn_expire = 0;
+    pthread_mutex_unlock(&ext->turn_lock);
+}
+
 ElaSession *ela_session_new(ElaCarrier *w, const char *address)
 {
     SessionExtension *ext;
@@ -473,6 +978,9 @@ ElaSession *ela_session_new(ElaCarrier *w, const char *address)
         return NULL;
     }
 
+    pthread_mutex_init(&ws->timing.lock, NULL);
+    session_timing_mark(ws, &ws->timing.created);
+
     ws->streams = list_create(1, NULL);
     if (!ws->streams) {
         deref(ws);
@@ -483,12 +991,14 @@ ElaSession *ela_session_new(ElaCarrier *w, const char *address)
     ws->transport = transport;
     ws->to = strdup(address);
 
-    rc = ela_get_turn_server(w, &turn_server);
+    rc = get_turn_server(ext, &turn_server);
     if (rc < 0) {
         deref(ws);
         return NULL;
     }
 
+    session_timing_mark(ws, &ws->timing.turn_acquired);
+
     opts.stun_host = turn_server.server;
     opts.stun_port = NULL;
     opts.turn_host = turn_server.server;
@@ -505,6 +1015,21 @@ ElaSession *ela_session_new(ElaCarrier *w, const char *address)
     }
     ws->worker->le.data = ws->worker;
 
+    ws->worker->buffers = buffer_pool_create(FLEX_BUFFER_MAX_LEN,
+                                             BUFFER_POOL_MAX_SLABS);
+    if (!ws->worker->buffers) {
+        deref(ws);
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_OUT_OF_MEMORY));
+        return NULL;
+    }
+
+    ws->worker->reliable_clock = reliable_clock_create(ws->worker);
+    if (!ws->worker->reliable_clock) {
+        deref(ws);
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_OUT_OF_MEMORY));
+        return NULL;
+    }
+
     rc = ws->init(ws);
     if (rc < 0) {
         deref(ws);
@@ -570,6 +1095,8 @@ restop:
         //Hold the zombie stream object, clear on session destroy.
     }
 
+    trickle_detach(ws);
+
     if (ws->worker) {
         deref(list_remove_entry(ws->transport->workers, &ws->worker->le));
         ws->worker->stop(ws->worker);
@@ -599,10 +1126,24 @@ static void friend_invite_response(ElaCarrier *w, const char *from,
                         const void *data, size_t len, void *context)
 {
     ElaSession *ws = (ElaSession*)context;
+    char sdp[SDP_MAX_LEN];
+
+    if (status == 0 && data && len) {
+        data = remote_sdp_text(session_get_extension(ws), from, data, &len,
+                               sdp, sizeof(sdp));
+        if (!data) {
+            vlogE("Session: Invalid compact SDP from %s.", from);
+            status = ELA_GENERAL_ERROR(ELAERR_INVALID_SDP);
+            reason = "Invalid SDP";
+            len = 0;
+        }
+    }
 
     vlogD("Session: Session response from %s with bundle: %s, SDP: %s",
           from, bundle, (const char *)data);
 
+    session_timing_mark(ws, &ws->timing.answered);
+
     if (ws->complete_callback)
         ws->complete_callback(ws, bundle, status, reason,
                              (const char *)data, len, ws->context);
@@ -615,6 +1156,9 @@ int ela_session_request(ElaSession *ws, const char *bundle,
     int rc = 0;
     list_iterator_t iterator;
     char sdp[SDP_MAX_LEN];
+    uint8_t compact[SDP_MAX_LEN];
+    const void *data;
+    size_t len;
     char *ext_to;
 
     if (!ws || !callback ||
@@ -682,7 +1226,12 @@ reprepare:
     strcat(ext_to, ":");
     strcat(ext_to, extension_name);
 
-    rc = ela_invite_friend(w, ext_to, bundle, sdp, (size_t)rc + 1,
+    len = (size_t)rc + 1;
+    data = local_sdp_wire(ws, sdp, &len, compact, sizeof(compact));
+
+    session_timing_mark(ws, &ws->timing.offered);
+
+    rc = ela_invite_friend(w, ext_to, bundle, data, len,
                            friend_invite_response, (void *)ws);
 
     vlogD("Session: Session request to %s %s.", ws->to,
@@ -697,9 +1246,11 @@ int ela_session_reply_request(ElaSession *ws, const char *bundle,
     ElaCarrier *w;
     int rc = 0;
     char sdp[SDP_MAX_LEN];
-    char *local_sdp = NULL;
+    uint8_t compact[SDP_MAX_LEN];
+    const void *local_sdp = NULL;
     size_t sdp_len = 0;
     char *ext_to;
+    Invite *invite;
 
     if (!ws || (status != 0 && !reason)  ||
             (bundle && (!*bundle || strlen(bundle) > ELA_MAX_BUNDLE_LEN))){
@@ -761,8 +1312,8 @@ reprepare:
 
         vlogD("Session: Encode local SDP success[%s].", sdp);
 
-        local_sdp = sdp;
         sdp_len = rc + 1;
+        local_sdp = local_sdp_wire(ws, sdp, &sdp_len, compact, sizeof(compact));
     }
 
     ext_to = (char *)alloca(ELA_MAX_ID_LEN + strlen(extension_name) + 2);
@@ -770,9 +1321,21 @@ reprepare:
     strcat(ext_to, ":");
     strcat(ext_to, extension_name);
 
+    // The answerer's signaling phase runs from the invite to this reply.
+    invite = invites_remove(session_get_extension(ws)->invites, ws->to);
+
+    pthread_mutex_lock(&ws->timing.lock);
+    ws->timing.offered = invite ? invite->received : 0;
+    pthread_mutex_unlock(&ws->timing.lock);
+
+    if (invite)
+        deref(invite);
+
     rc = ela_reply_friend_invite(w, ext_to, bundle, status, reason,
                                  local_sdp, sdp_len);
 
+    session_timing_mark(ws, &ws->timing.answered);
+
     vlogD("Session: Session reply to %s %s.", ws->to,
           rc == 0 ? "success" : "failed");
 
@@ -832,6 +1395,13 @@ recheck:
         return -1;
     }
 
+    if (ws->crypto.enabled)
+        crypto_cipher_setup(ws);
+
+    // The peer is going to trickle the rest of its candidates.
+    if (*ws->trickle.peer_ufrag)
+        trickle_attach(ws);
+
 restart:
     list_iterate(ws->streams, &iterator);
     while (list_iterator_has_next(&iterator)) {
@@ -870,18 +1440,166 @@ void stream_base_destroy(void *p)
     vlogD("Session: Stream %d destroyed", s->id);
 }
 
-static
-void stream_base_on_data(StreamHandler *handler, FlexBuffer *buf)
+int ela_session_enable_trickle(ElaSession *ws)
 {
-    ElaStream *s = (ElaStream *)handler;
-    size_t buf_sz = flex_buffer_size(buf);
-
-    if (s->callbacks.stream_data)
-        s->callbacks.stream_data(s->session, s->id,
-                                 buf_sz ? flex_buffer_ptr(buf) : NULL, buf_sz,
+    if (!ws) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
+        return -1;
+    }
+
+    if (list_size(ws->streams) > 0) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_WRONG_STATE));
+        return -1;
+    }
+
+    ws->trickle.enabled = 1;
+
+    vlogD("Session: Trickle ICE enabled for session to %s.", ws->to);
+
+    return 0;
+}
+
+/*
+ * Hand received data to the application as a pooled buffer. Data already
+ * received into a pooled buffer is passed on as is, anything else costs
+ * one copy, which the application would otherwise have to make itself.
+ */
+ElaStreamBuffer *stream_rx_buffer(ElaStream *s, FlexBuffer *buf)
+{
+    ElaStreamBuffer *pbuf;
+    size_t len = flex_buffer_size(buf);
+
+    pbuf = flex_buffer_owner(buf);
+    if (pbuf) {
+        // The handler may look at the pooled data through its own view.
+        assert(buf->buffer == pbuf->flex.buffer);
+        pbuf->flex.offset = buf->offset;
+        pbuf->flex.size = buf->size;
+        return buffer_retain(pbuf);
+    }
+
+    if (len > FLEX_BUFFER_MAX_LEN - FLEX_PADDING_LEN)
+        return NULL;
+
+    pbuf = buffer_pool_get(stream_get_buffer_pool(s), FLEX_PADDING_LEN);
+    if (!pbuf)
+        return NULL;
+
+    memcpy(flex_buffer_mutable_ptr(&pbuf->flex), flex_buffer_ptr(buf), len);
+    flex_buffer_set_size(&pbuf->flex, len);
+
+    return pbuf;
+}
+
+/*
+ * One pool for the whole extension, started when the first stream asks
+ * for parallel crypto.
+ */
+CryptoPool *stream_get_crypto_pool(ElaStream *s)
+{
+    SessionExtension *ext = stream_get_extension(s);
+    CryptoPool *pool;
+
+    pthread_mutex_lock(&ext->crypto_pool_lock);
+    if (!ext->crypto_pool)
+        ext->crypto_pool = crypto_pool_create(0);
+    pool = ext->crypto_pool;
+    pthread_mutex_unlock(&ext->crypto_pool_lock);
+
+    return pool;
+}
+
+static
+void stream_base_on_data(StreamHandler *handler, FlexBuffer *buf)
+{
+    ElaStream *s = (ElaStream *)handler;
+    size_t buf_sz = flex_buffer_size(buf);
+
+    if (s->callbacks.stream_buffer) {
+        ElaStreamBuffer *pbuf;
+
+        pbuf = stream_rx_buffer(s, buf);
+        if (!pbuf) {
+            vlogE("Stream: %d out of memory, drop %zu bytes data.",
+                  s->id, buf_sz);
+            return;
+        }
+
+        s->callbacks.stream_buffer(s->session, s->id, pbuf, s->context);
+        buffer_release(pbuf);
+    } else if (s->callbacks.stream_data)
+        s->callbacks.stream_data(s->session, s->id,
+                                 buf_sz ? flex_buffer_ptr(buf) : NULL, buf_sz,
                                  s->context);
 }
 
+static int timing_span(int64_t from, int64_t to)
+{
+    if (!from || !to || to < from)
+        return -1;
+
+    return (int)((to - from) / 1000);
+}
+
+static void session_get_timings(ElaSession *ws, ElaSessionTimings *timings)
+{
+    pthread_mutex_lock(&ws->timing.lock);
+
+    timings->turn = timing_span(ws->timing.created, ws->timing.turn_acquired);
+    timings->gathering = timing_span(ws->timing.gathering, ws->timing.gathered);
+    timings->signaling = timing_span(ws->timing.offered, ws->timing.answered);
+    timings->checking = timing_span(ws->timing.checking, ws->timing.nominated);
+    timings->handshake = timing_span(ws->timing.nominated, ws->timing.connected);
+    timings->total = timing_span(ws->timing.created, ws->timing.connected);
+
+    pthread_mutex_unlock(&ws->timing.lock);
+}
+
+int ela_session_get_timings(ElaSession *ws, ElaSessionTimings *timings)
+{
+    if (!ws || !timings) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
+        return -1;
+    }
+
+    session_get_timings(ws, timings);
+    return 0;
+}
+
+static void session_log_timings(ElaSession *ws)
+{
+    ElaSessionTimings timings;
+    list_iterator_t iterator;
+    int rc;
+
+rescan:
+    list_iterate(ws->streams, &iterator);
+    while (list_iterator_has_next(&iterator)) {
+        ElaStream *s;
+        bool connected;
+
+        rc = list_iterator_next(&iterator, (void **)&s);
+        if (rc == 0)
+            break;
+
+        if (rc == -1)
+            goto rescan;
+
+        connected = (s->deactivate || s->state == ElaStreamState_connected);
+        deref(s);
+
+        if (!connected)
+            return;
+    }
+
+    session_get_timings(ws, &timings);
+
+    vlogI("Session: Session to %s connected in %d ms: turn %d ms, gathering "
+          "%d ms, signaling %d ms, checking %d ms, handshake %d ms.",
+          ws->to, timings.total, timings.turn, timings.gathering,
+          timings.signaling, timings.checking, timings.handshake);
+}
+
 static
 void stream_base_on_state_chagned(StreamHandler *handler, int state)
 {
@@ -889,6 +1607,11 @@ void stream_base_on_state_chagned(StreamHandler *handler, int state)
 
     s->state = state;
 
+    if (state == ElaStreamState_connected) {
+        session_timing_mark(s->session, &s->session->timing.connected);
+        session_log_timings(s->session);
+    }
+
     if (s->callbacks.state_changed)
         s->callbacks.state_changed(s->session, s->id, state, s->context);
 }
@@ -912,6 +1635,8 @@ int ela_session_add_stream(ElaSession *ws, ElaStreamType type,
         return -1;
     }
 
+    session_timing_mark_once(ws, &ws->timing.gathering);
+
     rc = ws->create_stream(ws, &s);
     if (rc != 0) {
         ela_set_error(rc);
@@ -947,6 +1672,14 @@ int ela_session_add_stream(ElaSession *ws, ElaStreamType type,
         s->multiplexing = 1;
         s->portforwarding = 1;
     }
+    if (options & ELA_STREAM_PARALLEL_CRYPTO)
+        s->parallel_crypto = 1;
+    if (options & ELA_STREAM_BBR)
+        s->bbr = 1;
+    if (options & ELA_STREAM_LOW_LATENCY)
+        s->low_latency = 1;
+    if (options & ELA_STREAM_FEC)
+        s->fec = 1;
 
     s->pipeline.name = "Root Handler";
     s->pipeline.init = default_handler_init;
@@ -981,6 +1714,35 @@ int ela_session_add_stream(ElaSession *ws, ElaStreamType type,
             ela_set_error(rc);
             return -1;
         }
+
+        s->tcp = handler;
+        handler_connect(prev, handler);
+        prev = handler;
+    }
+
+    if (s->compress) {
+        rc = compress_handler_create(s, &handler);
+        if (rc < 0) {
+            deref(s);
+            ela_set_error(rc);
+            return -1;
+        }
+
+        s->compressor = handler;
+        handler_connect(prev, handler);
+        prev = handler;
+    }
+
+    // Retransmission makes parity redundant on reliable streams.
+    if (s->fec && !s->reliable) {
+        rc = fec_handler_create(s, &handler);
+        if (rc < 0) {
+            deref(s);
+            ela_set_error(rc);
+            return -1;
+        }
+
+        s->fec_handler = handler;
         handler_connect(prev, handler);
         prev = handler;
     }
@@ -998,9 +1760,11 @@ int ela_session_add_stream(ElaSession *ws, ElaStreamType type,
 
     s->le.data = s;
     list_add(ws->streams, &s->le);
+    stream_index_put(s);
 
     rc = s->pipeline.init(&s->pipeline);
     if (rc < 0) {
+        stream_index_remove(s);
         deref(list_remove_entry(ws->streams, &s->le));
         deref(s);
         ela_set_error(rc);
@@ -1016,30 +1780,24 @@ int ela_session_add_stream(ElaSession *ws, ElaStreamType type,
 
 static ElaStream *get_stream(ElaSession *ws, int stream)
 {
+    SessionExtension *ext = session_get_extension(ws);
     ElaStream *s;
-    list_iterator_t iterator;
-    int rc;
 
     assert(ws);
     assert(stream > 0);
 
-rescan:
-    list_iterate(ws->streams, &iterator);
-    while (list_iterator_has_next(&iterator)) {
-        rc = list_iterator_next(&iterator, (void **)&s);
-        if (rc == 0)
-            break;
-
-        if (rc == -1)
-            goto rescan;
-
-        if (s->id == stream)
-            return s;
+    if (stream > MAX_STREAM_ID)
+        return NULL;
 
-        deref(s);
-    }
+    pthread_rwlock_rdlock(&ext->streams_lock);
+    s = ext->streams[stream];
+    if (s && s->session == ws)
+        ref(s);
+    else
+        s = NULL;
+    pthread_rwlock_unlock(&ext->streams_lock);
 
-    return NULL;
+    return s;
 }
 
 int ela_session_remove_stream(ElaSession *ws, int stream)
@@ -1059,6 +1817,7 @@ int ela_session_remove_stream(ElaSession *ws, int stream)
 
     s->pipeline.stop(&s->pipeline, 0);
 
+    stream_index_remove(s);
     deref(list_remove_entry(ws->streams, &s->le));
 
     vlogD("Session: Remove stream %d.", s->id);
@@ -1068,42 +1827,162 @@ int ela_session_remove_stream(ElaSession *ws, int stream)
     return 0;
 }
 
-ssize_t ela_stream_write(ElaSession *ws, int stream,
-                         const void *data, size_t len)
+/*
+ * Write scattered data with a single stream lookup. Reliable streams
+ * without framing take the caller's buffers directly, the reliable handler
+ * copies them into its send buffer anyway. Otherwise data is gathered into
+ * packets of at most ELA_MAX_USER_DATA_LEN with headroom for lower handlers.
+ */
+static ssize_t stream_writev(ElaStream *s, int channel,
+                             const ElaStreamIOVec *iov, int iovcnt)
 {
-    ElaStream *s;
+    FlexBuffer _buf;
     FlexBuffer *buf;
-    ssize_t sent;
+    size_t total = 0;
+    size_t offset = 0;
+    ssize_t sent = 0;
+    ssize_t rc;
+    int i;
 
-    if (!ws || stream <= 0 || !data || !len || len > ELA_MAX_USER_DATA_LEN) {
-        ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
-        return -1;
+    for (i = 0; i < iovcnt; i++)
+        total += iov[i].len;
+
+    if (!stream_is_reliable(s) && total > ELA_MAX_USER_DATA_LEN)
+        return ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS);
+
+    if (channel < 0 && !s->mux && stream_is_reliable(s)) {
+        for (i = 0; i < iovcnt; i++) {
+            if (!iov[i].len)
+                continue;
+
+            buf = flex_buffer_init(&_buf, iov[i].data, iov[i].len, 0);
+            flex_buffer_set_size(buf, iov[i].len);
+
+            rc = s->pipeline.write(&s->pipeline, buf);
+            if (rc < 0)
+                return sent > 0 ? sent : rc;
+
+            sent += rc;
+
+            // A non-blocking stream ran out of send buffer.
+            if ((size_t)rc < iov[i].len)
+                break;
+        }
+
+        return sent;
+    }
+
+    flex_buffer_alloca(buf, FLEX_BUFFER_MAX_LEN, FLEX_PADDING_LEN);
+
+    i = 0;
+    while (total > 0) {
+        size_t len = 0;
+
+        flex_buffer_reset(buf, FLEX_PADDING_LEN);
+
+        while (len < ELA_MAX_USER_DATA_LEN && i < iovcnt) {
+            size_t n = iov[i].len - offset;
+
+            if (n > ELA_MAX_USER_DATA_LEN - len)
+                n = ELA_MAX_USER_DATA_LEN - len;
+
+            memcpy((char *)flex_buffer_mutable_ptr(buf) + len,
+                   (const char *)iov[i].data + offset, n);
+            len += n;
+            offset += n;
+
+            if (offset == iov[i].len) {
+                offset = 0;
+                i++;
+            }
+        }
+
+        flex_buffer_set_size(buf, len);
+
+        if (channel < 0)
+            rc = s->pipeline.write(&s->pipeline, buf);
+        else
+            rc = s->mux->channel.write(s->mux, channel, buf);
+
+        if (rc < 0)
+            return sent > 0 ? sent : rc;
+
+        sent += len;
+        total -= len;
     }
 
+    return sent;
+}
+
+static ElaStream *get_writable_stream(ElaSession *ws, int stream)
+{
+    ElaStream *s;
+
     s = get_stream(ws, stream);
     if (!s) {
         ela_set_error(ELA_GENERAL_ERROR(ELAERR_NOT_EXIST));
-        return -1;
+        return NULL;
     }
 
     if (s->type == ElaStreamType_audio || s->type == ElaStreamType_video) {
         deref(s);
         ela_set_error(ELA_GENERAL_ERROR(ELAERR_NOT_IMPLEMENTED));
-        return -1;
+        return NULL;
     }
 
     if (s->state != ElaStreamState_connected) {
         deref(s);
         ela_set_error(ELA_GENERAL_ERROR(ELAERR_WRONG_STATE));
+        return NULL;
+    }
+
+    return s;
+}
+
+ssize_t ela_stream_write(ElaSession *ws, int stream,
+                         const void *data, size_t len)
+{
+    ElaStreamIOVec iov;
+
+    if (!ws || stream <= 0 || !data || !len) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
+        return -1;
+    }
+
+    iov.data = data;
+    iov.len = len;
+
+    return ela_stream_writev(ws, stream, &iov, 1);
+}
+
+ssize_t ela_stream_writev(ElaSession *ws, int stream,
+                          const ElaStreamIOVec *iov, int iovcnt)
+{
+    ElaStream *s;
+    ssize_t sent;
+    int i;
+
+    if (!ws || stream <= 0 || !iov || iovcnt <= 0) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
         return -1;
     }
 
-    flex_buffer_from(buf, FLEX_PADDING_LEN, data, len);
-    sent = s->pipeline.write(&s->pipeline, buf);
+    for (i = 0; i < iovcnt; i++) {
+        if (!iov[i].data && iov[i].len) {
+            ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
+            return -1;
+        }
+    }
+
+    s = get_writable_stream(ws, stream);
+    if (!s)
+        return -1;
+
+    sent = stream_writev(s, -1, iov, iovcnt);
     if (sent < 0)
         ela_set_error((int)sent);
     else
-        vlogD("Session: Stream %d sent %d bytes data.", s->id, (int)len);
+        vlogD("Session: Stream %d sent %d bytes data.", s->id, (int)sent);
 
     deref(s);
     return sent < 0 ? -1: sent;
@@ -1176,11 +2055,209 @@ int ela_stream_get_transport_info(ElaSession *ws, int stream, ElaTransportInfo *
     rc = s->get_info(s, info);
     if (rc < 0)
         ela_set_error(rc);
+    else
+        info->mtu = s->tcp ? reliable_handler_get_mtu(s->tcp) : 0;
 
     deref(s);
     return rc < 0 ? -1 : 0;
 }
 
+int ela_stream_get_compress_stats(ElaSession *ws, int stream,
+                                  ElaStreamCompressStats *stats)
+{
+    ElaStream *s;
+
+    if (!ws || stream <= 0 || !stats) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
+        return -1;
+    }
+
+    s = get_stream(ws, stream);
+    if (!s) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_NOT_EXIST));
+        return -1;
+    }
+
+    if (!s->compressor) {
+        deref(s);
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_WRONG_STATE));
+        return -1;
+    }
+
+    compress_handler_get_stats(s->compressor, stats);
+
+    deref(s);
+    return 0;
+}
+
+int ela_stream_get_fec_stats(ElaSession *ws, int stream,
+                             ElaStreamFecStats *stats)
+{
+    ElaStream *s;
+
+    if (!ws || stream <= 0 || !stats) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
+        return -1;
+    }
+
+    s = get_stream(ws, stream);
+    if (!s) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_NOT_EXIST));
+        return -1;
+    }
+
+    if (!s->fec_handler) {
+        deref(s);
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_WRONG_STATE));
+        return -1;
+    }
+
+    fec_handler_get_stats(s->fec_handler, stats);
+
+    deref(s);
+    return 0;
+}
+
+int ela_stream_set_buffer_limits(ElaSession *ws, int stream,
+                                 size_t min_size, size_t max_size)
+{
+    ElaStream *s;
+
+    if (!ws || stream <= 0 || min_size > RELIABLE_BUFFER_LIMIT ||
+        max_size > RELIABLE_BUFFER_LIMIT ||
+        (max_size && max_size < min_size)) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
+        return -1;
+    }
+
+    s = get_stream(ws, stream);
+    if (!s) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_NOT_EXIST));
+        return -1;
+    }
+
+    if (!s->reliable || s->state > ElaStreamState_initialized) {
+        deref(s);
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_WRONG_STATE));
+        return -1;
+    }
+
+    s->buffer_min = min_size;
+    s->buffer_max = max_size;
+
+    deref(s);
+    return 0;
+}
+
+int ela_stream_get_reliable_stats(ElaSession *ws, int stream,
+                                  ElaStreamReliableStats *stats)
+{
+    ElaStream *s;
+
+    if (!ws || stream <= 0 || !stats) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
+        return -1;
+    }
+
+    s = get_stream(ws, stream);
+    if (!s) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_NOT_EXIST));
+        return -1;
+    }
+
+    if (!s->tcp) {
+        deref(s);
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_WRONG_STATE));
+        return -1;
+    }
+
+    reliable_handler_get_stats(s->tcp, stats);
+
+    deref(s);
+    return 0;
+}
+
+int ela_stream_set_min_rto(ElaSession *ws, int stream, uint32_t min_rto)
+{
+    ElaStream *s;
+
+    if (!ws || stream <= 0 || min_rto > RELIABLE_RTO_LIMIT) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
+        return -1;
+    }
+
+    s = get_stream(ws, stream);
+    if (!s) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_NOT_EXIST));
+        return -1;
+    }
+
+    if (!s->reliable || s->state > ElaStreamState_initialized) {
+        deref(s);
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_WRONG_STATE));
+        return -1;
+    }
+
+    s->min_rto = min_rto;
+
+    deref(s);
+    return 0;
+}
+
+int ela_stream_set_pacing(ElaSession *ws, int stream, bool pacing)
+{
+    ElaStream *s;
+
+    if (!ws || stream <= 0) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
+        return -1;
+    }
+
+    s = get_stream(ws, stream);
+    if (!s) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_NOT_EXIST));
+        return -1;
+    }
+
+    if (!s->reliable || s->state > ElaStreamState_initialized) {
+        deref(s);
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_WRONG_STATE));
+        return -1;
+    }
+
+    s->pacing = pacing ? 1 : 0;
+
+    deref(s);
+    return 0;
+}
+
+int ela_stream_set_nonblocking(ElaSession *ws, int stream, bool nonblocking)
+{
+    ElaStream *s;
+
+    if (!ws || stream <= 0) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
+        return -1;
+    }
+
+    s = get_stream(ws, stream);
+    if (!s) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_NOT_EXIST));
+        return -1;
+    }
+
+    if (!s->reliable || s->multiplexing) {
+        deref(s);
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_WRONG_STATE));
+        return -1;
+    }
+
+    s->nonblocking = nonblocking ? 1 : 0;
+
+    deref(s);
+    return 0;
+}
+
 int ela_stream_open_channel(ElaSession *ws, int stream, const char *cookie)
 {
     int rc;
@@ -1248,13 +2325,19 @@ ssize_t ela_stream_write_channel(ElaSession *ws, int stream,
 {
     ssize_t written;
     ElaStream *s;
+    ElaStreamIOVec iov;
 
-    if (!ws || stream <= 0 || channel < 0 || (len && !data) || (!len && data) ||
-        len > ELA_MAX_USER_DATA_LEN) {
+    if (!ws || stream <= 0 || channel < 0 || (len && !data) || (!len && data)) {
         ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
         return -1;
     }
 
+    if (len) {
+        iov.data = data;
+        iov.len = len;
+        return ela_stream_write_channelv(ws, stream, channel, &iov, 1);
+    }
+
     s = get_stream(ws, stream);
     if (!s) {
         ela_set_error(ELA_GENERAL_ERROR(ELAERR_NOT_EXIST));
@@ -1283,6 +2366,49 @@ ssize_t ela_stream_write_channel(ElaSession *ws, int stream,
     return written;
 }
 
+ssize_t ela_stream_write_channelv(ElaSession *ws, int stream, int channel,
+                                  const ElaStreamIOVec *iov, int iovcnt)
+{
+    ssize_t written;
+    ElaStream *s;
+    int i;
+
+    if (!ws || stream <= 0 || channel < 0 || !iov || iovcnt <= 0) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
+        return -1;
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        if (!iov[i].data && iov[i].len) {
+            ela_set_error(ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS));
+            return -1;
+        }
+    }
+
+    s = get_stream(ws, stream);
+    if (!s) {
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_NOT_EXIST));
+        return -1;
+    }
+
+    if (s->state != ElaStreamState_connected) {
+        deref(s);
+        ela_set_error(ELA_GENERAL_ERROR(ELAERR_WRONG_STATE));
+        return -1;
+    }
+
+    if (!s->mux)
+        written = (ssize_t)ELA_GENERAL_ERROR(ELAERR_WRONG_STATE);
+    else
+        written = stream_writev(s, channel, iov, iovcnt);
+
+    if (written < 0)
+        ela_set_error((int)written);
+
+    deref(s);
+    return written < 0 ? -1 : written;
+}
+
 int ela_stream_pend_channel(ElaSession *ws, int stream, int channel)
 {
     int rc;
@@ -24,6 +24,7 @@
 #define __SESSION_H__
 
 #include <pthread.h>
+#include <time.h>
 
 #ifdef __APPLE__
 #pragma GCC diagnostic push
@@ -37,7 +38,11 @@
 #include <crystal.h>
 
 #include "ela_session.h"
+#include "ela_turnserver.h"
 #include "stream_handler.h"
+#include "buffer_pool.h"
+#include "crypto_pool.h"
+#include "reliable_clock.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -67,6 +72,9 @@ typedef struct IceTransportOptions {
 typedef void (*friend_invite_callback)(ElaCarrier *, const char *from,
               const char *bundle, const char *data, size_t len, void *context);
 
+typedef void (*friend_message_callback)(ElaCarrier *, const char *from,
+              const void *msg, size_t len, void *context);
+
 struct ElaCarrier       {
     pthread_mutex_t         ext_mutex;
     void                    *extension;
@@ -86,6 +94,9 @@ struct SessionExtension {
     friend_invite_callback  friend_invite_cb;
     void                    *friend_invite_context;
 
+    friend_message_callback friend_message_cb;
+    void                    *friend_message_context;
+
     ElaSessionRequestCallback *default_callback;
     void                    *default_context;
 
@@ -94,8 +105,28 @@ struct SessionExtension {
 
     ElaTransport            *transport;
 
+    pthread_mutex_t         trickles_lock;
+    hashtable_t             *trickles;
+
+    // Arrival time of the latest invite from each friend.
+    hashtable_t             *invites;
+
+    hashtable_t             *compact_peers;
+
+    // Created on the first stream asking for parallel crypto.
+    pthread_mutex_t         crypto_pool_lock;
+    CryptoPool              *crypto_pool;
+
+    pthread_mutex_t         turn_lock;
+    ElaTurnServer           turn_server;
+    int64_t                 turn_expire;
+
     IDS_HEAP(stream_ids, MAX_STREAM_ID);
 
+    // Streams indexed by id, ids are unique across all sessions.
+    pthread_rwlock_t        streams_lock;
+    ElaStream               *streams[MAX_STREAM_ID + 1];
+
     int (*create_transport)(ElaTransport **transport);
 };
 
@@ -113,6 +144,9 @@ struct TransportWorker {
 
     list_entry_t            le;
 
+    BufferPool              *buffers;
+    ReliableClock           *reliable_clock;
+
     void (*stop)           (TransportWorker *worker);
     int  (*create_timer)   (TransportWorker *worker, int id, unsigned long interval,
                             TimerCallback *callback, void *user_data, Timer **timer);
@@ -145,7 +179,10 @@ typedef struct ElaSession {
 
     struct {
         int enabled;
+        int cipher;
         uint8_t key[SYMMETRIC_KEY_BYTES];
+        uint8_t tx_key[SYMMETRIC_KEY_BYTES];
+        uint8_t rx_key[SYMMETRIC_KEY_BYTES];
     }  crypto;
 
     struct {
@@ -153,11 +190,35 @@ typedef struct ElaSession {
         hashtable_t *services;
     } portforwarding;
 
+    struct {
+        int enabled;
+        char peer_ufrag[80];
+    } trickle;
+
+    /*
+     * Monotonic timestamps(us) of session setup phases, 0 if not reached.
+     * Marked from both pj worker threads and application threads, so
+     * always accessed with lock held.
+     */
+    struct {
+        pthread_mutex_t lock;
+        int64_t created;
+        int64_t turn_acquired;
+        int64_t gathering;
+        int64_t gathered;
+        int64_t offered;
+        int64_t answered;
+        int64_t checking;
+        int64_t nominated;
+        int64_t connected;
+    } timing;
+
     int  (*init)            (ElaSession *session);
     int  (*create_stream)   (ElaSession *session, ElaStream **stream);
     bool (*set_offer)       (ElaSession *session, bool offerer);
     int  (*encode_local_sdp)(ElaSession *session, char *sdp, size_t len);
     int  (*apply_remote_sdp)(ElaSession *session, const char *sdp, size_t sdp_len);
+    int  (*apply_remote_candidates)(ElaSession *session, const char *data, size_t len);
 } ElaSession;
 
 typedef struct Multiplexer  Multiplexer;
@@ -165,6 +226,9 @@ typedef struct Multiplexer  Multiplexer;
 struct ElaStream {
     StreamHandler           pipeline;
     Multiplexer             *mux;
+    StreamHandler           *compressor;
+    StreamHandler           *fec_handler;
+    StreamHandler           *tcp;
 
     list_entry_t            le;
     int                     id;
@@ -177,8 +241,18 @@ struct ElaStream {
     int                     reliable;
     int                     multiplexing;
     int                     portforwarding;
+    int                     parallel_crypto;
+    int                     bbr;
+    int                     low_latency;
+    int                     fec;
     int                     deactivate;
 
+    size_t                  buffer_min;
+    size_t                  buffer_max;
+    uint32_t                min_rto;
+    int                     pacing;
+    int                     nonblocking;
+
     ElaStreamCallbacks  callbacks;
     void *context;
 
@@ -192,8 +266,35 @@ void transport_base_destroy(void *p);
 
 void session_base_destroy(void *p);
 
+void worker_base_destroy(void *p);
+
 void stream_base_destroy(void *p);
 
+ElaStreamBuffer *stream_rx_buffer(ElaStream *stream, FlexBuffer *buf);
+
+CryptoPool *stream_get_crypto_pool(ElaStream *stream);
+
+int session_send_trickle(ElaSession *session, const char *data, size_t len);
+
+void session_reset_turn_server(ElaSession *session);
+
+static inline
+void session_timing_mark(ElaSession *session, int64_t *timestamp)
+{
+    pthread_mutex_lock(&session->timing.lock);
+    *timestamp = (int64_t)get_monotonic_time();
+    pthread_mutex_unlock(&session->timing.lock);
+}
+
+static inline
+void session_timing_mark_once(ElaSession *session, int64_t *timestamp)
+{
+    pthread_mutex_lock(&session->timing.lock);
+    if (!*timestamp)
+        *timestamp = (int64_t)get_monotonic_time();
+    pthread_mutex_unlock(&session->timing.lock);
+}
+
 static inline
 SessionExtension *stream_get_extension(ElaStream *stream)
 {
@@ -212,6 +313,12 @@ TransportWorker *stream_get_worker(ElaStream *stream)
     return stream->session->worker;
 }
 
+static inline
+BufferPool *stream_get_buffer_pool(ElaStream *stream)
+{
+    return stream->session->worker->buffers;
+}
+
 static inline
 ElaSession *stream_get_session(ElaStream *stream)
 {
@@ -224,6 +331,16 @@ bool stream_is_reliable(ElaStream *stream)
     return stream->reliable != 0;
 }
 
+/*
+ * Whether received data should land in pooled buffers the application
+ * can retain, rather than on the stack.
+ */
+static inline
+bool stream_wants_rx_buffers(ElaStream *stream)
+{
+    return stream->callbacks.stream_buffer || stream->callbacks.channel_buffer;
+}
+
 static inline
 SessionExtension *session_get_extension(ElaSession *session)
 {
@@ -115,10 +115,50 @@ void default_handler_on_state_changed(StreamHandler *handler, int state)
     handler->prev->on_state_changed(handler->prev, state);
 }
 
+/*
+ * Stream ciphers, negotiated through the session level SDP attribute
+ * below. Peers without the attribute use the default NaCl box.
+ */
+#define CRYPTO_CIPHER_ATTRIBUTE         "x-cipher"
+
+typedef enum CryptoCipher {
+    CryptoCipher_XSalsa20Poly1305 = 0,
+    CryptoCipher_AES256GCM
+} CryptoCipher;
+
+const char *crypto_cipher_list(void);
+
+int crypto_cipher_select(const char *offer, size_t offer_len,
+                         const char *answer, size_t answer_len);
+
+const char *crypto_cipher_name(int cipher);
+
+void crypto_cipher_setup(ElaSession *ws);
+
 int crypto_handler_create(ElaStream *s, StreamHandler **handler);
 
+int compress_handler_create(ElaStream *s, StreamHandler **handler);
+
+void compress_handler_get_stats(StreamHandler *handler,
+                                ElaStreamCompressStats *stats);
+
+int fec_handler_create(ElaStream *s, StreamHandler **handler);
+
+void fec_handler_get_stats(StreamHandler *handler, ElaStreamFecStats *stats);
+
+/* Largest window a scale factor of 14 can advertise (RFC 7323). */
+#define RELIABLE_BUFFER_LIMIT           (1U << 30)
+
+/* Largest retransmission timeout of the pseudo-TCP socket. */
+#define RELIABLE_RTO_LIMIT              60000
+
 int reliable_handler_create(ElaStream *s, StreamHandler **handler);
 
+void reliable_handler_get_stats(StreamHandler *handler,
+                                ElaStreamReliableStats *stats);
+
+int reliable_handler_get_mtu(StreamHandler *handler);
+
 #ifdef __cplusplus
 }
 #endif
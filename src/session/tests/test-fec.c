@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Runs an FEC encoder and decoder back to back over a simulated path that
+ * loses, duplicates and reorders packets, and checks that what comes out
+ * is intact, never delivered twice, and that lost packets are recovered.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fec_codec.h"
+
+#define PACKETS             20000
+#define PATH_DEPTH          4
+
+typedef struct Packet {
+    size_t len;
+    uint8_t data[FEC_PARITY_MAX_LEN];
+} Packet;
+
+typedef struct Path {
+    unsigned int seed;
+    int loss;               /* per mille */
+    int duplicate;          /* per mille */
+    int reorder;            /* per mille */
+    Packet held[PATH_DEPTH];
+    int nheld;
+} Path;
+
+static FecEncoder encoder;
+static FecDecoder decoder;
+static Path path;
+
+static uint8_t *delivered;
+static int ndelivered;
+static int nrecovered;
+static int nparity;
+
+static void fail(const char *what, int id)
+{
+    fprintf(stderr, "FEC test failed: %s (packet %d).\n", what, id);
+    exit(1);
+}
+
+static int path_random(void)
+{
+    path.seed = path.seed * 1103515245 + 12345;
+    return (int)((path.seed >> 16) % 1000);
+}
+
+static size_t packet_len(int id)
+{
+    return 100 + (size_t)id % 900;
+}
+
+static void packet_fill(int id, uint8_t *p)
+{
+    size_t i, len = packet_len(id);
+
+    memcpy(p, &id, sizeof(id));
+    for (i = sizeof(id); i < len; i++)
+        p[i] = (uint8_t)(id + i);
+}
+
+static void app_receive(const uint8_t *p, size_t len)
+{
+    size_t i;
+    int id;
+
+    if (len < sizeof(id))
+        fail("short packet", -1);
+
+    memcpy(&id, p, sizeof(id));
+    if (id < 0 || id >= PACKETS || len != packet_len(id))
+        fail("corrupted packet", id);
+
+    for (i = sizeof(id); i < len; i++) {
+        if (p[i] != (uint8_t)(id + i))
+            fail("corrupted packet", id);
+    }
+
+    if (delivered[id])
+        fail("packet delivered twice", id);
+
+    delivered[id] = 1;
+    ndelivered++;
+}
+
+static void receive(const uint8_t *p, size_t len)
+{
+    uint8_t out[FEC_PAYLOAD_MAX];
+    size_t out_len;
+    int rc;
+
+    rc = fec_decode(&decoder, p, len, out, &out_len);
+    if (rc < 0)
+        fail("packet rejected", -1);
+
+    if (rc & FEC_DELIVER)
+        app_receive(p + FEC_HEADER_LEN, len - FEC_HEADER_LEN);
+
+    if (rc & FEC_RECOVERED) {
+        nrecovered++;
+        app_receive(out, out_len);
+    }
+
+    // Reports go back on a path of their own, which does not lose them.
+    rc = fec_decoder_loss(&decoder);
+    if (rc >= 0)
+        fec_encoder_on_report(&encoder, rc);
+}
+
+static void path_send(const uint8_t *p, size_t len)
+{
+    Packet *pkt;
+
+    if (path_random() < path.loss)
+        return;
+
+    if (path_random() < path.duplicate)
+        receive(p, len);
+
+    // Hold the packet back, to come out after a later one.
+    if (path_random() < path.reorder && path.nheld < PATH_DEPTH) {
+        pkt = &path.held[path.nheld++];
+        memcpy(pkt->data, p, len);
+        pkt->len = len;
+        return;
+    }
+
+    receive(p, len);
+
+    if (path.nheld && path_random() < 500) {
+        pkt = &path.held[--path.nheld];
+        receive(pkt->data, pkt->len);
+    }
+}
+
+static void path_flush(void)
+{
+    while (path.nheld) {
+        Packet *pkt = &path.held[--path.nheld];
+        receive(pkt->data, pkt->len);
+    }
+}
+
+static void send_packet(int id)
+{
+    uint8_t p[FEC_HEADER_LEN + FEC_PAYLOAD_MAX];
+    uint8_t parity[FEC_PARITY_MAX_LEN];
+    size_t len = packet_len(id);
+
+    packet_fill(id, p + FEC_HEADER_LEN);
+
+    if (fec_encode(&encoder, p + FEC_HEADER_LEN, len, p)) {
+        path_send(p, FEC_HEADER_LEN + len);
+        path_send(parity, fec_encode_parity(&encoder, parity));
+        nparity++;
+    } else {
+        path_send(p, FEC_HEADER_LEN + len);
+    }
+}
+
+static void reset(int loss, int duplicate, int reorder)
+{
+    fec_encoder_init(&encoder);
+    fec_decoder_init(&decoder);
+
+    memset(&path, 0, sizeof(path));
+    path.seed = 1;
+    path.loss = loss;
+    path.duplicate = duplicate;
+    path.reorder = reorder;
+
+    memset(delivered, 0, PACKETS);
+    ndelivered = 0;
+    nrecovered = 0;
+    nparity = 0;
+}
+
+static void test_path(int loss, int duplicate, int reorder, int min_delivered)
+{
+    uint8_t parity[FEC_PARITY_MAX_LEN];
+    size_t len;
+    int i;
+
+    reset(loss, duplicate, reorder);
+
+    for (i = 0; i < PACKETS; i++)
+        send_packet(i);
+
+    // The tail, as the handler closes it once the writer goes quiet.
+    len = fec_encode_parity(&encoder, parity);
+    if (len) {
+        path_send(parity, len);
+        nparity++;
+    }
+    path_flush();
+
+    printf("loss %d, duplicates %d, reordered %d per mille: delivered "
+           "%d of %d, %d recovered, %d parity, group size %d\n",
+           loss, duplicate, reorder, ndelivered, PACKETS, nrecovered,
+           nparity, fec_encoder_group_size(&encoder));
+
+    if (ndelivered * 1000LL < (long long)min_delivered * PACKETS)
+        fail("too few packets delivered", ndelivered);
+
+    if (loss && !nrecovered)
+        fail("nothing recovered", -1);
+}
+
+/*
+ * A group closed before it is full, as the handler does when the writer
+ * goes quiet, still recovers its lost packet, and the packet is not
+ * delivered again if it shows up late.
+ */
+static void test_short_group(void)
+{
+    uint8_t p[3][FEC_HEADER_LEN + FEC_PAYLOAD_MAX];
+    uint8_t parity[FEC_PARITY_MAX_LEN];
+    size_t len;
+    int i;
+
+    reset(0, 0, 0);
+
+    for (i = 0; i < 3; i++) {
+        packet_fill(i, p[i] + FEC_HEADER_LEN);
+        if (fec_encode(&encoder, p[i] + FEC_HEADER_LEN, packet_len(i), p[i]))
+            fail("group filled early", i);
+    }
+
+    len = fec_encode_parity(&encoder, parity);
+    if (!len || parity[1] != 3 || parity[2] != 3)
+        fail("short group not closed", -1);
+
+    if (fec_encode_parity(&encoder, parity) != 0)
+        fail("empty group closed", -1);
+
+    // Parity first, then the ends of the group, then the lost one late.
+    receive(parity, len);
+    receive(p[0], FEC_HEADER_LEN + packet_len(0));
+    receive(p[2], FEC_HEADER_LEN + packet_len(2));
+    if (nrecovered != 1 || !delivered[1])
+        fail("short group not recovered", 1);
+
+    receive(p[1], FEC_HEADER_LEN + packet_len(1));
+    if (ndelivered != 3)
+        fail("wrong packets delivered", ndelivered);
+
+    printf("short group: recovered\n");
+}
+
+int main(void)
+{
+    delivered = (uint8_t *)calloc(PACKETS, 1);
+    if (!delivered)
+        return 1;
+
+    test_short_group();
+
+    test_path(0, 0, 0, 1000);
+    test_path(10, 0, 0, 997);
+    test_path(50, 0, 0, 985);
+    test_path(100, 0, 0, 970);
+    test_path(50, 50, 200, 985);
+
+    free(delivered);
+
+    printf("Done\n");
+    return 0;
+}
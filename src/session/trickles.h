@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2018 Elastos Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __TRICKLES_H__
+#define __TRICKLES_H__
+
+#include <string.h>
+#include <stdint.h>
+#include <crystal.h>
+
+#include "session.h"
+
+#define TRICKLE_MAX_PENDING_LEN         4096
+#define TRICKLE_MAX_PENDING_PER_PEER    4
+#define TRICKLE_PENDING_TIMEOUT         30  /* seconds */
+
+/*
+ * Trickled candidates from a peer, keyed by "<friendid>:<ice-ufrag>".
+ * Candidates can arrive before the session applies the remote SDP, so they
+ * are kept pending until a session with a matching ufrag attaches itself.
+ * Entries nobody attached to, and entries left by closed sessions (which
+ * drop late candidates), go away after TRICKLE_PENDING_TIMEOUT.
+ */
+typedef struct Trickle {
+    hash_entry_t        he;
+    ElaSession          *session;
+    int                 detached;
+    int64_t             expire;
+    size_t              len;
+    char                data[TRICKLE_MAX_PENDING_LEN];
+    char                key[ELA_MAX_ID_LEN + 82];
+} Trickle;
+
+static inline
+int trickles_key_compare(const void *key1, size_t len1,
+                         const void *key2, size_t len2)
+{
+    return strcmp(key1, key2);
+}
+
+static inline
+hashtable_t *trickles_create(int capacity)
+{
+    return hashtable_create(capacity, 0, NULL, trickles_key_compare);
+}
+
+static inline
+void trickles_put(hashtable_t *htab, Trickle *trickle)
+{
+    trickle->he.data = trickle;
+    trickle->he.key = (void *)trickle->key;
+    trickle->he.keylen = strlen(trickle->key);
+
+    hashtable_put(htab, &trickle->he);
+}
+
+static inline
+Trickle *trickles_get(hashtable_t *htab, const char *key)
+{
+    return (Trickle *)hashtable_get(htab, (void *)key, strlen(key));
+}
+
+static inline
+Trickle *trickles_remove(hashtable_t *htab, const char *key)
+{
+    return (Trickle *)hashtable_remove(htab, (void *)key, strlen(key));
+}
+
+static inline
+hashtable_iterator_t *trickles_iterate(hashtable_t *htab,
+                                       hashtable_iterator_t *iterator)
+{
+    return hashtable_iterate(htab, iterator);
+}
+
+// return 1 on success, 0 end of iterator, -1 on modified conflict or error.
+static inline
+int trickles_iterator_next(hashtable_iterator_t *iterator, Trickle **trickle)
+{
+    return hashtable_iterator_next(iterator, NULL, NULL, (void **)trickle);
+}
+
+static inline
+int trickles_iterator_has_next(hashtable_iterator_t *iterator)
+{
+    return hashtable_iterator_has_next(iterator);
+}
+
+// return 1 on success, 0 nothing removed, -1 on modified conflict or error.
+static inline
+int trickles_iterator_remove(hashtable_iterator_t *iterator)
+{
+    return hashtable_iterator_remove(iterator);
+}
+
+#endif /* __TRICKLES_H__ */
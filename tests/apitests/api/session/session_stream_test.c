@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <pthread.h>
 #ifdef HAVE_ALLOCA_H
@@ -178,9 +179,19 @@ static void stream_state_changed(ElaSession *ws, int stream,
     cond_signal(sc->cond);
 }
 
+static Condition DEFINE_COND(writable_cond);
+
+static void stream_writable(ElaSession *ws, int stream, void *context)
+{
+    vlogD("Stream [%d] writable", stream);
+
+    cond_signal(&writable_cond);
+}
+
 static ElaStreamCallbacks stream_callbacks = {
     .stream_data = stream_on_data,
-    .state_changed = stream_state_changed
+    .state_changed = stream_state_changed,
+    .stream_writable = stream_writable
 };
 
 static Condition DEFINE_COND(stream_cond);
@@ -411,6 +422,188 @@ static void test_stream_reliable_plain_portforwarding(void)
     test_stream_write(stream_options);
 }
 
+static void test_stream_compress(void)
+{
+    test_stream_write(ELA_STREAM_COMPRESS);
+}
+
+static void test_stream_reliable_compress(void)
+{
+    int stream_options = 0;
+
+    stream_options |= ELA_STREAM_COMPRESS;
+    stream_options |= ELA_STREAM_RELIABLE;
+
+    test_stream_write(stream_options);
+}
+
+static void test_stream_reliable_parallel_crypto(void)
+{
+    int stream_options = 0;
+
+    stream_options |= ELA_STREAM_RELIABLE;
+    stream_options |= ELA_STREAM_PARALLEL_CRYPTO;
+
+    test_stream_write(stream_options);
+}
+
+static void test_stream_reliable_bbr(void)
+{
+    int stream_options = 0;
+
+    stream_options |= ELA_STREAM_RELIABLE;
+    stream_options |= ELA_STREAM_BBR;
+
+    test_stream_write(stream_options);
+}
+
+static void test_stream_fec(void)
+{
+    test_stream_write(ELA_STREAM_FEC);
+}
+
+static void test_stream_reliable_low_latency(void)
+{
+    int stream_options = 0;
+
+    stream_options |= ELA_STREAM_RELIABLE;
+    stream_options |= ELA_STREAM_LOW_LATENCY;
+
+    test_stream_write(stream_options);
+}
+
+static int do_nonblocking_write(TestContext *context)
+{
+#define NONBLOCKING_PACKET_SIZE 64*1024
+#define NONBLOCKING_MAX_PACKETS 4096
+
+    SessionContext *sctxt = context->session;
+    StreamContext *stream_ctxt = context->stream;
+    char *packet;
+    ssize_t rc;
+    int full = 0;
+    int i;
+
+    cond_reset(&writable_cond);
+
+    rc = ela_stream_set_nonblocking(sctxt->session, stream_ctxt->stream_id,
+                                    true);
+    if (rc < 0)
+        return -1;
+
+    packet = (char *)malloc(NONBLOCKING_PACKET_SIZE);
+    if (!packet)
+        return -1;
+    memset(packet, 'N', NONBLOCKING_PACKET_SIZE);
+
+    // Writes far faster than the peer acknowledges fill the send buffer.
+    for (i = 0; i < NONBLOCKING_MAX_PACKETS && !full; i++) {
+        rc = ela_stream_write(sctxt->session, stream_ctxt->stream_id,
+                              packet, NONBLOCKING_PACKET_SIZE);
+        if (rc < 0) {
+            if (ela_get_error() != ELA_SYS_ERROR(EAGAIN)) {
+                vlogE("Write data failed (0x%x)", ela_get_error());
+                goto error;
+            }
+
+            vlogD("Write %d failed with EAGAIN.", i);
+            full = 1;
+        } else if (rc < NONBLOCKING_PACKET_SIZE) {
+            vlogD("Write %d took %zd of %d bytes.", i, rc,
+                  NONBLOCKING_PACKET_SIZE);
+            full = 1;
+        } else if (rc != NONBLOCKING_PACKET_SIZE) {
+            goto error;
+        }
+    }
+
+    if (!full) {
+        vlogE("Send buffer never filled up.");
+        goto error;
+    }
+
+    if (!cond_trywait(&writable_cond, 60000)) {
+        vlogE("No writable notification.");
+        goto error;
+    }
+
+    rc = ela_stream_write(sctxt->session, stream_ctxt->stream_id,
+                          packet, NONBLOCKING_PACKET_SIZE);
+    if (rc <= 0) {
+        vlogE("Writable stream took no data (0x%x).", ela_get_error());
+        goto error;
+    }
+
+    free(packet);
+    return ela_stream_set_nonblocking(sctxt->session, stream_ctxt->stream_id,
+                                      false);
+
+error:
+    free(packet);
+    return -1;
+}
+
+static void test_stream_reliable_nonblocking(void)
+{
+    test_stream_scheme(ElaStreamType_text, ELA_STREAM_RELIABLE,
+                       &test_context, do_nonblocking_write);
+}
+
+static int check_nonblocking_rejected(TestContext *context)
+{
+    int rc;
+
+    rc = ela_stream_set_nonblocking(context->session->session,
+                                    context->stream->stream_id, true);
+    if (rc != -1 || ela_get_error() != ELA_GENERAL_ERROR(ELAERR_WRONG_STATE))
+        return -1;
+
+    return 0;
+}
+
+static void test_stream_unreliable_nonblocking(void)
+{
+    test_stream_scheme(ElaStreamType_text, 0, &test_context,
+                       check_nonblocking_rejected);
+}
+
+static int check_session_timings(TestContext *context)
+{
+    ElaSession *ws = context->session->session;
+    ElaSessionTimings timings;
+    int rc;
+
+    rc = ela_session_get_timings(NULL, &timings);
+    if (rc != -1 || ela_get_error() != ELA_GENERAL_ERROR(ELAERR_INVALID_ARGS))
+        return -1;
+
+    rc = ela_session_get_timings(ws, &timings);
+    if (rc < 0)
+        return -1;
+
+    vlogD("Session connected in %d ms: turn %d ms, gathering %d ms, "
+          "signaling %d ms, checking %d ms, handshake %d ms.",
+          timings.total, timings.turn, timings.gathering, timings.signaling,
+          timings.checking, timings.handshake);
+
+    // The stream is connected, so every phase has completed.
+    if (timings.turn < 0 || timings.gathering < 0 || timings.signaling < 0 ||
+        timings.checking < 0 || timings.handshake < 0 || timings.total < 0)
+        return -1;
+
+    if (timings.total < timings.turn || timings.total < timings.signaling ||
+        timings.total < timings.checking)
+        return -1;
+
+    return 0;
+}
+
+static void test_session_timings(void)
+{
+    test_stream_scheme(ElaStreamType_text, ELA_STREAM_RELIABLE,
+                       &test_context, check_session_timings);
+}
+
 static CU_TestInfo cases[] = {
     { "test_stream", test_stream_unreliable },
     { "test_stream_plain", test_stream_unreliable_plain },
@@ -422,6 +615,15 @@ static CU_TestInfo cases[] = {
     { "test_stream_reliable_plain_multiplexing", test_stream_reliable_plain_multiplexing },
     { "test_stream_reliable_portforwarding", test_stream_reliable_portforwarding },
     { "test_stream_reliable_plain_portforwarding", test_stream_reliable_plain_portforwarding },
+    { "test_stream_compress", test_stream_compress },
+    { "test_stream_reliable_compress", test_stream_reliable_compress },
+    { "test_stream_reliable_parallel_crypto", test_stream_reliable_parallel_crypto },
+    { "test_stream_reliable_bbr", test_stream_reliable_bbr },
+    { "test_stream_reliable_low_latency", test_stream_reliable_low_latency },
+    { "test_stream_fec", test_stream_fec },
+    { "test_session_timings", test_session_timings },
+    { "test_stream_reliable_nonblocking", test_stream_reliable_nonblocking },
+    { "test_stream_unreliable_nonblocking", test_stream_unreliable_nonblocking },
 
     { NULL, NULL }
 };